@@ -2,7 +2,8 @@
 #define _MILU_H
 
 #include "hashtbl/hashtbl.h"
-#include "hash/hash.h"
+#include "hashtbl/ptrtbl.h"
+#include "hashtbl/inttbl.h"
 #include "hash/hash.h"
 #include "pool/poolbank.h"
 
@@ -27,10 +28,42 @@
 #endif
 
 //must be init'd
-struct hash_table * _milu_htable = NULL;
+struct hash_table * _milu_htable = NULL; /* _milu_nshards tables */
+#ifdef _PTRTBL
+/* open addressing tracking tables, used instead of _milu_htable */
+struct ptr_table * _milu_ptable = NULL;
+#endif
+#ifdef _INTTBL
+/* compact integer key tracking tables, used instead of _milu_htable */
+struct int_table * _milu_itable = NULL;
+#endif
+
+/*
+ * Tracked pointers are spread over independent tables (shards), each with
+ * its own locks and its own resizes. MILU_SHARDS in the environment
+ * overrides the default, rounded up to a power of two.
+ */
+#define MILU_DEF_SHARDS 16
+#define MILU_MAX_SHARDS 256
+unsigned int _milu_nshards = 1;
+
+/* MILU_STATS=1: count probes, resizes and lock contention, see mem_report() */
+uint8_t _milu_stats = 0;
+
+/* MILU_NOBT=1: no backtraces, leaks are reported by call address only.
+ * A backtrace costs far more than the table, this leaves the table to
+ * measure (see src/tests/bench_mt.c) */
+uint8_t _milu_nobt = 0;
+
+/* threads walking the tables at exit, one per online cpu at most */
+#define MILU_MAX_WALKERS 16
 #define POOLSIZE 20000
 struct bank * _milu_pools = NULL;
 
+/* MILU_PERCPU=1: per-CPU caches in front of _milu_pools instead of
+ * per-thread magazines, for processes with lots of threads */
+struct bank_pcpu * _milu_pcpu = NULL;
+
 typedef void * (* malloc_fn_t)( size_t );
 typedef void * (* realloc_fn_t)( void *, size_t );
 typedef void * (* calloc_fn_t)( size_t, size_t );
@@ -63,7 +96,11 @@ struct memalloc {
   char          **bt;
   size_t        size;
 
+#if defined(_INTTBL)
+  struct int_entry      ientry;
+#elif !defined(_PTRTBL)
   struct hash_entry     hentry;
+#endif
 #ifdef _POOLED_ALLOC
   struct list_head      plist; /* Available/In-Use Pool lists */
 #endif
@@ -97,14 +134,35 @@ struct pool {
     bt = backtrace_symbols(frames, depth); \
     depth; })
 
-#define KEY_HASHBITS 8
 /*
  * @ptr : void ptr we wish to hash
  * @len : this parameter is ignored, we need to comply with prototype.
+ *
+ * The full pointer is handed back: the table folds it with the golden
+ * ratio prime and keeps as many bits as it has buckets (see
+ * hash_table_bucket_of()). Truncating here would cap the number of
+ * buckets in use no matter how large the table grows.
  * */
-static unsigned long milu_hash_ptr(const void *ptr, size_t UNUSED(len))
+static inline size_t milu_hash_ptr(const void *ptr, size_t UNUSED(len))
 {
-    return hash_ptr(ptr, KEY_HASHBITS);
+    return (size_t)ptr;
+}
+
+/*
+ * @ptr : tracked pointer
+ * @nshards : number of shards, a power of two
+ *
+ * Raw address bits spread badly (alignment, size classes), so the pointer
+ * is folded with the golden ratio like the tables do. The tables pick
+ * buckets (and lock stripes) from the top 31 bits of the product at most,
+ * the shard comes from the bits right below: it says nothing about the
+ * bucket within the shard.
+ * */
+static inline unsigned int milu_shard_of(const void *ptr, unsigned int nshards)
+{
+    uint64_t h = (uint64_t)(uintptr_t)ptr * GOLDEN_RATIO_64;
+
+    return (unsigned int)((h >> 24) & (nshards - 1));
 }
 
 #ifdef _VERBOSE
@@ -9,15 +9,20 @@
  * Chuck Lever verified the effectiveness of this technique:
  * http://www.citi.umich.edu/techreports/reports/citi-tr-00-1.pdf
  *
- * These primes are chosen to be bit-sparse, that is operations on
- * them can use shifts and additions instead of multiplications for
- * machines where multiplications are slow.
+ * The original primes were chosen to be bit-sparse, so that operations
+ * on them could use shifts and additions instead of multiplications.
+ * They mix poorly: keys that differ by small strides (e.g. heap pointers)
+ * end up sharing the top bits, which is exactly what we keep. Any CPU we
+ * care about multiplies in a few cycles, so use the dense 2^n/phi
+ * constants instead.
  */
 
 #if 0
 #include <asm-generic/types.h>
 #include <asm-generic/bitsperlong.h>
 #endif
+#include <stdint.h>
+#include <stddef.h>
 #include "compatibility.h"
 
 /* 2^31 + 2^29 - 2^25 + 2^22 - 2^19 - 2^16 + 1 */
@@ -25,6 +30,10 @@
 /*  2^63 + 2^61 - 2^57 + 2^54 - 2^51 - 2^18 + 1 */
 #define GOLDEN_RATIO_PRIME_64 0x9e37fffffffc0001UL
 
+/* 2^32 / phi, 2^64 / phi */
+#define GOLDEN_RATIO_32 0x61C88647UL
+#define GOLDEN_RATIO_64 0x61C8864680B583EBULL
+
 #if __BITS_PER_LONG == 32
 #define GOLDEN_RATIO_PRIME GOLDEN_RATIO_PRIME_32
 #define hash_long(val, bits) hash_32(val, bits)
@@ -37,22 +46,7 @@
 
 static inline uint64_t hash_64(uint64_t val, unsigned int bits)
 {
-  uint64_t hash = val;
-
-  /*  Sigh, gcc can't optimize this alone like it does for 32 bits. */
-  uint64_t n = hash;
-  n <<= 18;
-  hash -= n;
-  n <<= 33;
-  hash -= n;
-  n <<= 3;
-  hash += n;
-  n <<= 3;
-  hash -= n;
-  n <<= 4;
-  hash += n;
-  n <<= 2;
-  hash += n;
+  uint64_t hash = val * GOLDEN_RATIO_64;
 
   /* High bits are more random, so use them. */
   return hash >> (64 - bits);
@@ -60,8 +54,7 @@ static inline uint64_t hash_64(uint64_t val, unsigned int bits)
 
 static inline uint32_t hash_32(uint32_t val, unsigned int bits)
 {
-  /* On some cpus multiply is faster, on others gcc will do shifts */
-  uint32_t hash = val * GOLDEN_RATIO_PRIME_32;
+  uint32_t hash = val * GOLDEN_RATIO_32;
 
   /* High bits are more random, so use them. */
   return hash >> (32 - bits);
@@ -72,13 +65,49 @@ static inline unsigned long hash_ptr(const void *ptr, unsigned int bits)
   return hash_long((unsigned long)ptr, bits);
 }
 
-int hash64_cmp(const void * key_a, const void * key_b, size_t size) {
+/*
+ * Integer keys are stored by value in hash_entry.key, so compare the
+ * values themselves: dereferencing them would read the caller's memory.
+ */
+static inline int hash64_cmp(const void * key_a, const void * key_b, size_t size) {
     if(size != sizeof(uint64_t)){
         //we've got a problem.
-        return 0;
+        return 1;
      }
-    return (*(uint64_t *)key_a - *(uint64_t *)key_b);
+    return ((uint64_t)(uintptr_t)key_a != (uint64_t)(uintptr_t)key_b);
 }
 
+/*
+ * String hashes, for tables with string (or any byte string) keys. Same
+ * prototype as a table hash function (see __hash in hashtbl.h).
+ *
+ * hash_str() is the portable one. The CRC32C one isn't faster on every
+ * CPU (see bench_strhash), and its lanes are plain CRCs with no seed, so
+ * it only takes over where the library is built with HASH_STR_CRC32C
+ * (cmake -DMILU_HASH_CRC32C=ON) and the CPU has SSE4.2. The two give
+ * different values, so don't keep hashes around across processes or
+ * machines.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* wyhash style: 64x64->128 multiplies folded, 48 bytes per round */
+size_t hash_str_portable(const void *key, size_t len);
+
+/* four CRC32C lanes over 32 byte blocks, mixed like the portable one.
+ * keys of 16 bytes or less go to hash_str_portable(). falls back to it
+ * altogether where SSE4.2 isn't there. */
+size_t hash_str_crc32c(const void *key, size_t len);
+
+size_t hash_str(const void *key, size_t len);
+
+/* 1 if hash_str() is the CRC32C one */
+int hash_str_accelerated(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _HASH_H */
 
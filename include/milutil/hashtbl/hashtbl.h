@@ -11,58 +11,187 @@
 #include <math.h>
 
 #include "list/list.h"
+#include "hash/hash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef size_t (* __hash)(const void *, size_t len);
 typedef int (*keycmp_ptr) (const void *, const void *, size_t);
 
+typedef void * (* hash_table_allocator)(size_t size);
+typedef void (* hash_table_deallocator)(void * ptr);
+
 /**
  *
- * Hash Table Primes: http://www.planetmath.org/GoodHashTablePrimes.html
+ * Hash table sizes are powers of two.
+ *
+ * The value returned by the user hash function is folded with the golden
+ * ratio multiplier from hash.h and the top bits of the product select the
+ * bucket (Fibonacci hashing). That keeps the full width of the hash useful
+ * no matter how many buckets we have, avoids a division by a prime on
+ * every lookup, and is forgiving with weak low bits (aligned pointers).
+ *
+ * Growing doubles the table without stopping the world: the new bucket
+ * array is swapped in next to the old one and every insert/delete moves a
+ * few old buckets over (_HASH_MIGRATE_STEP). Old bucket i only feeds new
+ * buckets 2i and 2i+1; until it has been moved, keys that map to it are
+ * looked up, inserted and deleted there, afterwards in the new array. New
+ * buckets are set up as their old bucket moves, so starting a resize costs
+ * an allocation, not a pass over the table.
+ *
+ * Shrinking is the same the other way around: once safe deletes take the
+ * load under the shrink factor, a bucket array half the size is swapped
+ * in and old buckets 2i and 2i+1 are merged into new bucket i. Growing
+ * then takes a load of _LOAD_FACTOR again, three times what is left right
+ * after a shrink with the default 1/8. Tables never shrink below the size
+ * they started with.
  *
- * Using primes for hash tables is a good idea because it minimizes clustering in the hashed table. 
- * Item (2) is nice because it is convenient for growing a hash table in the face of expanding data. 
- * Item (3) has, allegedly, been shown to yield especially good results in practice.
+ * Buckets don't have a mutex each: a fixed set of cache line sized lock
+ * stripes is shared by all of them (HASH_TABLE_LOCK_STRIPES by default).
+ * The stripe comes from the top bits of the folded hash, like the bucket
+ * does, so bucket n of a 2^b table is guarded by stripe n >> (b - s). A
+ * key keeps its stripe when the table doubles: an old bucket and the two
+ * new buckets it feeds are under the same lock.
+ *
+ * Each stripe also carries a sequence count, bumped by whoever changes a
+ * chain under it. hash_table_lookup_key_lockless_*() walk the chain
+ * without taking the lock and start over if the count moved. They
+ * announce themselves in a per-thread reader slot, and the bucket array
+ * a resize leaves behind is only freed once no slot is busy.
  *
  */
 
-#define N_HASH_PRIMES 25
+#define HASH_TABLE_MIN_BITS 4
+#define HASH_TABLE_MAX_BITS 31
 
-static const uint64_t hashtbl_prime_sz[N_HASH_PRIMES] = {
-    97, 193, 389, 769, 1543, 3079, 6151, 12289, 24593, 49157, 98317, 196613, 393241, 786433, 1572869,
-    3145739, 6291469, 12582917, 25165843, 50331653, 100663319, 201326611, 402653189, 805306457, 1610612741
-};
+#ifndef HASH_TABLE_LOCK_STRIPES
+#define HASH_TABLE_LOCK_STRIPES 1024
+#endif
+#ifndef HASH_TABLE_READER_SLOTS
+#define HASH_TABLE_READER_SLOTS 64 /* power of two */
+#endif
+#define HASH_TABLE_CACHELINE 64
 
+/* a bucket lock with a cache line of its own */
+struct hash_lock_stripe {
+    pthread_mutex_t lock;
+    unsigned int seq; /* odd while a chain under the lock changes */
+    unsigned int contended; /* lock was busy, with stats on only */
+} __attribute__((aligned(HASH_TABLE_CACHELINE)));
+
+/* lockless readers in flight, threads are spread over the slots */
+struct hash_reader_slot {
+    unsigned long active;
+} __attribute__((aligned(HASH_TABLE_CACHELINE)));
+
+/*
+ * String keys are copied into the key arena of the table they're
+ * inserted into, see hash_table_key_alloc(). Entries that come with room
+ * of their own (struct hash_str_entry) keep keys of up to
+ * HASH_ENTRY_INLINE_KEY bytes there instead. @key points at the copy
+ * either way. Only keys set up by hash_entry_init() alone still come from
+ * malloc(). Integer keys are stored by value, and their entries don't pay
+ * for any of this.
+ */
+#ifndef HASH_ENTRY_INLINE_KEY
+#define HASH_ENTRY_INLINE_KEY 24
+#endif
+
+/* where a key lives, hash_entry._skey */
+#define HASH_KEY_INT    0 /* integer key, stored by value in @key */
+#define HASH_KEY_HEAP   1 /* malloc()ed */
+#define HASH_KEY_INLINE 2 /* in hash_str_entry._ikey */
+#define HASH_KEY_ARENA  3 /* in the table's key arena */
 
 struct hash_entry {
     void * key;
     size_t klen;
     struct list_head list; //collision resolved by chaining
     char _skey; //impacts mem usage, but unavoidable for str+int hashtables.
+    uint32_t _hash; //folded key hash, see hash_table_fold(). fits in _skey's padding.
+};
+
+/* a hash_entry with room for a short string key, 64 bytes in all */
+struct hash_str_entry {
+    struct hash_entry e;
+    char _ikey[HASH_ENTRY_INLINE_KEY];
+};
+
+/* chunks of the key arena, newest first */
+struct hash_key_chunk {
+    struct hash_key_chunk *next;
+    size_t size;
+    size_t used; /* may run past size, the chunk is full then */
+    char data[];
 };
 
+#ifndef HASH_KEY_CHUNK
+#define HASH_KEY_CHUNK 16384 /* key arena chunk, larger keys get their own */
+#endif
+
+/*
+ * Bucket arrays are bare list heads. Once a resize has moved an old
+ * bucket, its next pointer is NULL, see hash_bucket_moved().
+ */
 struct hash_table {
-    struct hash_entry *table;
+    struct list_head *table;
 
     size_t buckets;
-    pthread_mutex_t *bucket_locks;
+    unsigned int _hbits; /* buckets == 1 << _hbits */
 
-    pthread_mutex_t lock;
+    struct hash_lock_stripe *_stripes;
+    unsigned int _sbits; /* 1 << _sbits stripes, never more than buckets */
+    struct hash_reader_slot *_readers;
+    void *_stripes_mem; /* stripes and reader slots */
+
+    pthread_mutex_t lock; /* key arena refills */
     __hash my_hash_fn;
     keycmp_ptr keycmp;
 
     /* private variables */
-    unsigned int __ht_i;
 #ifndef _LOAD_FACTOR
 #define _LOAD_FACTOR 0.75f /* Default load factor for hashtable is 3/4  */
+#endif
+#ifndef _SHRINK_FACTOR
+#define _SHRINK_FACTOR 0.125f /* safe deletes halve the table under 1/8 */
 #endif
 
     float _factor;
     size_t _resize_threshold;
+    float _shrink_factor;     /* see hash_table_set_shrink() */
+    size_t _shrink_threshold; /* 0 at the size the table started with */
+    unsigned int _min_hbits;
     size_t _used_buckets;
-    struct list_head *pos;
-
+    size_t _nentries;
+
+    /*
+     * Incremental resize: while _old_table is set, entries are still being
+     * moved out of it, a few buckets per insert/delete.
+     */
+    struct list_head *_old_table;
+    size_t _old_buckets;
+    unsigned int _old_hbits;
+    uint64_t _migrate; /* (_seq << 32) | next old bucket to move */
+    size_t _migrated;  /* old buckets moved so far */
+    unsigned int _seq; /* bucket array layout sequence count, see below */
+
+    /*
+     * Keys too long for the entries, released by hash_table_finit() only:
+     * deleting an entry doesn't give its key's room back.
+     */
+    struct hash_key_chunk *_keys;
+
+    struct hash_table_counters *_stats; /* NULL unless stats are on */
 };
 
+#ifndef _HASH_MIGRATE_STEP
+#define _HASH_MIGRATE_STEP 4 /* old buckets moved per insert/delete */
+#endif
+#ifndef _HASH_MERGE_RATIO
+#define _HASH_MERGE_RATIO 4 /* merges per _HASH_MIGRATE_STEP when shrinking */
+#endif
 
 /**
  * This is a particular hashtable implementation, we will be
@@ -73,14 +202,21 @@ struct hash_table {
  *
  */
 
+/* the stripe guarding bucket @n of a 2^@bits bucket array */
+static inline pthread_mutex_t *hash_table_stripe(const struct hash_table *t,
+        size_t n, unsigned int bits)
+{
+    return (&t->_stripes[n >> (bits - t->_sbits)].lock);
+}
+
 static inline int hash_table_bucket_lock(struct hash_table *t, unsigned int n)
 {
-    return (pthread_mutex_lock(&(t->bucket_locks[n])));
+    return (pthread_mutex_lock(hash_table_stripe(t, n, t->_hbits)));
 }
 
 static inline int hash_table_bucket_unlock(struct hash_table *t, unsigned int n)
 {
-    return (pthread_mutex_unlock(&(t->bucket_locks[n])));
+    return (pthread_mutex_unlock(hash_table_stripe(t, n, t->_hbits)));
 }
 
 static inline int hash_table_lock(struct hash_table *t)
@@ -93,9 +229,42 @@ static inline int hash_table_unlock(struct hash_table *t)
     return (pthread_mutex_unlock(&(t->lock)));
 }
 
+static inline void hash_table_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/*
+ * The bucket arrays (table, old table, their locks and sizes) only change
+ * when a resize starts or ends. Writers do that under t->lock and bump
+ * t->_seq before and after, so it is odd while they are at it. Readers
+ * don't take t->lock: they copy what they need between
+ * hash_table_read_begin() and hash_table_read_retry() and start over if
+ * the count moved. An even _seq also names the current layout.
+ */
+static inline unsigned int hash_table_read_begin(const struct hash_table *t)
+{
+    unsigned int seq;
+
+    while((seq = __atomic_load_n(&t->_seq, __ATOMIC_ACQUIRE)) & 1)
+        hash_table_cpu_relax();
+    return seq;
+}
+
+static inline int hash_table_read_retry(const struct hash_table *t,
+        unsigned int seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (__atomic_load_n(&t->_seq, __ATOMIC_RELAXED) != seq);
+}
+
 static inline int hash_table_bucket_locked(struct hash_table *t, unsigned int n)
 {
-    return (pthread_mutex_trylock(&t->bucket_locks[n]) == EBUSY);
+    return (pthread_mutex_trylock(hash_table_stripe(t, n, t->_hbits)) == EBUSY);
 }
 
 static inline int hash_table_locked(struct hash_table *t)
@@ -103,30 +272,103 @@ static inline int hash_table_locked(struct hash_table *t)
     return (pthread_mutex_trylock(&(t->lock)) == EBUSY);
 }
 
+/*
+ * @hv: value returned by the table hash function
+ * @bits: log2 of the number of buckets
+ * Returns the bucket @hv falls into.
+ */
+static inline unsigned int hash_table_bucket_of(size_t hv, unsigned int bits)
+{
+    return (unsigned int)hash_long((unsigned long)hv, bits);
+}
+
+/*
+ * The top 32 bits of the folded hash: tables never have more than 2^31
+ * buckets, so they give the bucket (and stripe) at any size. Entries keep
+ * them, resizes don't call the hash function again and lookups only
+ * compare keys whose folded hash matches.
+ */
+static inline uint32_t hash_table_fold(size_t hv)
+{
+    return (uint32_t)hash_long((unsigned long)hv, 32);
+}
+
+/* same as hash_table_bucket_of() from a hash_table_fold() value */
+static inline unsigned int hash_table_bucket_of_fold(uint32_t f,
+        unsigned int bits)
+{
+    return (unsigned int)(f >> (32 - bits));
+}
+
+static inline uint32_t hash_table_key_fold(const struct hash_table *t,
+        const void *key, size_t len)
+{
+    return hash_table_fold(t->my_hash_fn(key, len));
+}
+
 static inline int hash_table_hash_code(const struct hash_table *t,
         const void *key, size_t len)
 {
-    return (t->my_hash_fn(key, len) % t->buckets);
+    return hash_table_bucket_of(t->my_hash_fn(key, len), t->_hbits);
 }
 
 static inline int hash_table_hash_code_safe(struct hash_table *t,
         const void *key, size_t len)
 {
     int n;
+    unsigned int seq;
+    size_t hv = t->my_hash_fn(key, len);
 
-    hash_table_lock(t);
-    n = t->my_hash_fn(key, len) % t->buckets;
-    hash_table_unlock(t);
+    do {
+        seq = hash_table_read_begin(t);
+        n = hash_table_bucket_of(hv, t->_hbits);
+    } while(hash_table_read_retry(t, seq));
 
     return n;
 }
 
+/* old bucket heads are marked once moved: no list has a NULL next */
+static inline int hash_bucket_moved(const struct list_head *head)
+{
+    return (__atomic_load_n(&head->next, __ATOMIC_RELAXED) == NULL);
+}
+
+/* after the new buckets are set up: lockless readers may follow them */
+static inline void hash_bucket_mark_moved(struct list_head *head)
+{
+    head->prev = NULL;
+    __atomic_store_n(&head->next, NULL, __ATOMIC_RELEASE);
+}
+
+/*
+ * The bucket folded hash @hv lives in: while resizing, the old bucket
+ * until it has been moved, the current one after that. @current is
+ * cleared for an old bucket. not thread-safe.
+ */
+static inline struct list_head *hash_table_head(const struct hash_table *h,
+        uint32_t hv, int *current)
+{
+    struct list_head *head;
+
+    *current = 1;
+    if(h->_old_table)
+    {
+        head = &h->_old_table[hash_table_bucket_of_fold(hv, h->_old_hbits)];
+        if(!hash_bucket_moved(head))
+        {
+            *current = 0;
+            return head;
+        }
+    }
+    return &h->table[hash_table_bucket_of_fold(hv, h->_hbits)];
+}
+
 static inline int hash_entry_init(struct hash_entry *e,
         const void *key, size_t len, char skey)
 {
 
     INIT_LIST_HEAD(&(e->list));
-    e->_skey = !!skey;
+    e->_skey = (skey ? HASH_KEY_HEAP : HASH_KEY_INT);
 
     if(e->_skey) {
         if (!key)
@@ -153,79 +395,136 @@ static inline int hash_entry_init(struct hash_entry *e,
 
 static inline void hash_entry_finit(struct hash_entry *e)
 {
-    if (e->key && e->_skey)
+    if (e->key && e->_skey == HASH_KEY_HEAP)
         free(e->key);
     e->klen = 0;
 }
 
-static inline int hash_table_init(struct hash_table *h
-        , unsigned int b
-        , keycmp_ptr keycmp
-        , __hash hash_fn )
+/* hash_str_entry_init()
+ * Description: hash_entry_init() for a string key, copied into @se
+ *              itself if it fits.
+ */
+static inline int hash_str_entry_init(struct hash_str_entry *se,
+        const char *key, size_t len)
 {
-    unsigned int i = 0;
-    size_t hashtblsz = 0;
+    struct hash_entry *e = &se->e;
+
+    if(!key || len > HASH_ENTRY_INLINE_KEY)
+        return hash_entry_init(e, (const void *)key, len, 1);
 
-    pthread_mutex_init(&(h->lock), NULL);
+    INIT_LIST_HEAD(&(e->list));
+    e->_skey = HASH_KEY_INLINE;
+    e->key = se->_ikey;
+    memcpy(e->key, key, len);
+    e->klen = len;
 
+    return 0;
+}
 
-    /* Lets decide the REAL hash table size  */
-    hashtblsz = (size_t) roundf((float)b/_LOAD_FACTOR);
-    if(hashtblsz <= hashtbl_prime_sz[N_HASH_PRIMES-1])
-    {
-        for( i=0 ; i<N_HASH_PRIMES ; i++ )
-        {
-            if(hashtblsz <= hashtbl_prime_sz[i])
-            {
-                hashtblsz = hashtbl_prime_sz[i];
-                break;
-            }
+/* hash_table_init()
+ * @h: &struct hash_table to initialize
+ * @b: number of entries we expect before the first resize
+ * @keycmp: key compare function, memcmp if NULL
+ * @hash_fn: hash function
+ * Returns: 0 on success, -1 otherwise.
+ */
+int hash_table_init(struct hash_table *h, unsigned int b,
+        keycmp_ptr keycmp, __hash hash_fn);
 
-        }
-    }
+/* hash_table_init_stripes()
+ * @stripes: number of bucket lock stripes, rounded up to a power of two
+ *           (at least 2) and capped to the initial number of buckets.
+ * Description: same as hash_table_init() with HASH_TABLE_LOCK_STRIPES.
+ */
+int hash_table_init_stripes(struct hash_table *h, unsigned int b,
+        keycmp_ptr keycmp, __hash hash_fn, unsigned int stripes);
 
-    h->buckets = hashtblsz;
-    h->_used_buckets = 0;
-    h->_factor = _LOAD_FACTOR; //hard coded for now.
-    h->_resize_threshold = b;
+/* hash_table_finit()
+ * @h: &struct hash_table
+ * Description: releases the bucket arrays, entries are left alone.
+ */
+void hash_table_finit(struct hash_table *h);
 
-    if ((h->table =
-                (struct hash_entry *)malloc(sizeof(struct hash_entry) * h->buckets)) ==
-            NULL)
-        return -1;
+static inline int hash_table_resizing(const struct hash_table *h)
+{
+    return (h->_old_table != NULL);
+}
 
-    if ((h->bucket_locks =
-                (pthread_mutex_t *) malloc(sizeof(pthread_mutex_t) * h->buckets)) == NULL)
-        return -1;
+/* hash_table_finish_resize()
+ * @h: &struct hash_table
+ * Description: moves whatever is left of an ongoing resize into the current
+ *              bucket array. hash_table_for_each() only walks the current
+ *              array, call this first if @h might be resizing. thread-safe.
+ */
+void hash_table_finish_resize(struct hash_table *h);
+
+struct hash_table_mem {
+    size_t buckets;     /* bucket heads, both arrays while resizing */
+    size_t locks;       /* lock stripes and reader slots */
+    size_t bucket_locks; /* what one pthread_mutex_t per bucket would take */
+    size_t saved;       /* bucket_locks - locks */
+    size_t keys;        /* key arena */
+};
 
-    for ( i=h->buckets-1 ; i != 0; i--) {
-        hash_entry_init(&(h->table[i]), NULL, 0, 0);
-        pthread_mutex_init(&h->bucket_locks[i], NULL);
-    }
+/* hash_table_set_shrink()
+ * @h: &struct hash_table
+ * @factor: load under which safe deletes halve @h, 0 to never shrink.
+ *          _SHRINK_FACTOR by default.
+ * Returns: 0 on success, -1 if @factor is negative or not under half
+ *          the load factor (grows and shrinks would take turns).
+ */
+int hash_table_set_shrink(struct hash_table *h, float factor);
 
-    hash_entry_init(&(h->table[0]), NULL, 0, 0);
-    pthread_mutex_init(&h->bucket_locks[0], NULL);
+#define HASH_STATS_CHAIN_BINS 16
 
-    if (keycmp)
-        h->keycmp = keycmp;
-    else
-        h->keycmp = memcmp;
+/*
+ * What hash_table_get_stats() reports. The chain histogram is taken on
+ * the spot, the rest is counted from hash_table_stats_enable() on.
+ */
+struct hash_table_stats {
+    size_t chains[HASH_STATS_CHAIN_BINS]; /* buckets by chain length, the
+                                             last bin has the longer ones */
+    size_t max_chain;
+    uint64_t lookups;        /* key searches, deletes included */
+    uint64_t probes;         /* entries they looked at */
+    uint64_t max_probes;
+    uint64_t resizes;        /* grows and shrinks started */
+    uint64_t resize_ns;      /* from their start to the last bucket moved */
+    uint64_t lock_acquires;  /* bucket stripe locks taken */
+    uint64_t lock_contended; /* of which had to wait (trylock failed) */
+    unsigned int hot_stripe; /* the stripe that had to wait the most */
+    unsigned int hot_contended;
+};
 
-    if (hash_fn)
-        h->my_hash_fn = hash_fn;
-    else
-        return -1;
+/* hash_table_stats_enable()
+ * @h: &struct hash_table
+ * Description: starts counting lookups, resizes and lock contention for
+ *              @h. Counters are shared by all threads: meant for
+ *              diagnosing, not for tables on a hot path.
+ * Returns: 0 on success, -1 if the counters couldn't be allocated.
+ */
+int hash_table_stats_enable(struct hash_table *h);
 
-    return 0;
-}
+/* hash_table_get_stats()
+ * @h: &struct hash_table
+ * @st: filled with the chain lengths of @h and its counters, zero if stats
+ *      are off. takes each stripe lock in turn. thread-safe.
+ */
+void hash_table_get_stats(struct hash_table *h, struct hash_table_stats *st);
 
-static inline void hash_table_finit(struct hash_table *h)
-{
+/* hash_table_mem_usage()
+ * @h: &struct hash_table
+ * @m: filled with the bytes @h uses for buckets, locks and long keys,
+ *     entries aside.
+ */
+void hash_table_mem_usage(struct hash_table *h, struct hash_table_mem *m);
 
-    if (h->table)
-        free(h->table);
-    h->buckets = 0;
-}
+/* custom_h_allocator()
+ * Description: allocator for the bucket arrays of every hash table, e.g.
+ *              to keep them off a heap the table is tracking.
+ */
+void custom_h_allocator(hash_table_allocator allocator,
+        hash_table_deallocator deallocator);
 
 /* insert_hash_table_i()
  * @h: &struct hash_table hash table to insert hash_entry into
@@ -246,6 +545,16 @@ void hash_table_insert_s(struct hash_table *h,
                          const char * key, size_t len);
 
 
+/* hash_table_insert_str()
+ * @h: &struct hash_table hash table to insert into
+ * @se: &struct hash_str_entry
+ * Description: hash_table_insert_s(), keeping short keys in @se rather
+ *              than in the key arena. not thread-safe.
+ */
+void hash_table_insert_str(struct hash_table *h,
+                           struct hash_str_entry *se,
+                           const char * key, size_t len);
+
 /* insert_hash_table_safe()
  * @h: &struct hash_table hash table to insert hash_entry into
  * @e: &struct hash_entry
@@ -268,6 +577,13 @@ void hash_table_insert_safe_s(struct hash_table *h,
         struct hash_entry *e,
         const char * key, size_t len);
 
+/* hash_table_insert_safe_str()
+ * Description: same as hash_table_insert_str(). thread-safe.
+ */
+void hash_table_insert_safe_str(struct hash_table *h,
+        struct hash_str_entry *se,
+        const char * key, size_t len);
+
 /* hash_table_lookup_key()
  * @h: hash table to look into
  * @key the key to look for
@@ -303,6 +619,100 @@ struct hash_entry *hash_table_lookup_key_safe_s(struct hash_table *h,
         const char *key,
         size_t len);
 
+/* hash_table_lookup_key_lockless()
+ * @h: hash table to look into
+ * @key the key to look for
+ * @len: length of the key
+ * Description: same as hash_table_lookup_key_safe() without taking the
+ *              bucket lock: retries if a writer got to the bucket meanwhile
+ *              and takes the lock after a few failed attempts.
+ * Notes: entries may be read after they've been deleted, their memory
+ *        must stay mapped (e.g. come from a pool) and, for string keys,
+ *        so must the key.
+ */
+struct hash_entry *hash_table_lookup_key_lockless_i(struct hash_table *h,
+        const uintptr_t key,
+        size_t len);
+
+struct hash_entry *hash_table_lookup_key_lockless_s(struct hash_table *h,
+        const char *key,
+        size_t len);
+
+/* hash_table_insert_bulk_i()
+ * @h: &struct hash_table hash table to insert into
+ * @entries: @n entries to insert
+ * @keys: the key of each entry
+ * @len: length of the keys
+ * @n: number of entries
+ * Description: hash_table_insert_safe_i() for many entries at once. They
+ *              are sorted by hash first, so each lock stripe is taken once
+ *              for all the entries under it. thread-safe.
+ */
+void hash_table_insert_bulk_i(struct hash_table *h, struct hash_entry **entries,
+        const uintptr_t *keys, size_t len, size_t n);
+
+/* hash_table_del_bulk_i()
+ * @out: filled with the entry deleted for each key, NULL if there's none
+ * Description: hash_table_del_key_safe_i() for many keys at once, grouped
+ *              by lock stripe like hash_table_insert_bulk_i(). thread-safe.
+ * Returns: the number of keys deleted.
+ */
+size_t hash_table_del_bulk_i(struct hash_table *h, const uintptr_t *keys,
+        size_t len, struct hash_entry **out, size_t n);
+
+/* hash_table_lookup_batch_i()
+ * @h: hash table to look into
+ * @keys: @n keys to look for
+ * @len: length of the keys
+ * @out: filled with the entry found for each key, NULL if there's none
+ * @n: number of keys
+ * Description: hash_table_lookup_key_lockless_i() for a batch of keys, the
+ *              bucket heads and chains of several keys are prefetched at
+ *              once. Same notes as the lockless lookups.
+ * Returns: the number of keys found.
+ */
+size_t hash_table_lookup_batch_i(struct hash_table *h, const uintptr_t *keys,
+        size_t len, struct hash_entry **out, size_t n);
+
+/* hash_table_del_batch_i()
+ * @out: filled with the entry deleted for each key, NULL if there's none
+ * Description: hash_table_del_key_safe_i() for a batch of keys, prefetched
+ *              like hash_table_lookup_batch_i(). thread-safe.
+ * Returns: the number of keys deleted.
+ */
+size_t hash_table_del_batch_i(struct hash_table *h, const uintptr_t *keys,
+        size_t len, struct hash_entry **out, size_t n);
+
+
+/* hash_table_insert_hashed()
+ * @h: &struct hash_table
+ * @e: &struct hash_entry, key and klen set (see hash_entry_init())
+ * @hv: hash_table_fold() of what the hash function gives for the key
+ * Description: thread-safe insert that doesn't call the hash function,
+ *              for callers that hash keys themselves (hashtbl.hpp).
+ */
+void hash_table_insert_hashed(struct hash_table *h, struct hash_entry *e,
+        uint32_t hv);
+
+/* hash_table_del_hashed()
+ * @hv: hash_table_fold() of what the hash function gives for @key
+ * Description: hash_table_del_key_safe() for callers that hash keys
+ *              themselves, like hash_table_insert_hashed().
+ * Returns: the entry unlinked, NULL if there was none.
+ */
+struct hash_entry *hash_table_del_hashed(struct hash_table *h, uint32_t hv,
+        const void *key, size_t len);
+
+/* hash_table_unlink_safe()
+ * @h: &struct hash_table
+ * @e: &struct hash_entry linked in @h
+ * Description: thread-safe removal of @e itself, no key search.
+ */
+void hash_table_unlink_safe(struct hash_table *h, struct hash_entry *e);
+
+/* same as above, not thread-safe. never moves buckets around, so
+ * hash_table_for_each() users can unlink what they walk. */
+void hash_table_unlink(struct hash_table *h, struct hash_entry *e);
 
 /* same as hash_table_lookup_key() but this function takes a valid hash_entry as input.
  * a valid hash_entry is the one that has key, len set appropriately. in other words, a
@@ -317,7 +727,7 @@ static inline struct hash_entry *hash_table_lookup_hash_entry(const struct
     {
         entry =  (hash_table_lookup_key_s(h, (const char *)e->key, e->klen));
     } else {
-        entry =  (hash_table_lookup_key_i(h, (const uintptr_t)e->key, e->klen));
+        entry =  (hash_table_lookup_key_i(h, (uintptr_t)e->key, e->klen));
     }
     return entry;
 }
@@ -334,7 +744,7 @@ static inline struct hash_entry *hash_table_lookup_hash_entry_safe(struct hash_t
     {
         entry =  (hash_table_lookup_key_safe_s(h, (const char *)e->key, e->klen));
     } else {
-        entry =  (hash_table_lookup_key_safe_i(h, (const uintptr_t)e->key, e->klen));
+        entry =  (hash_table_lookup_key_safe_i(h, (uintptr_t)e->key, e->klen));
     }
     return entry;
 }
@@ -363,7 +773,7 @@ static inline struct hash_entry *hash_table_del_hash_entry(struct hash_table *h,
     {
         entry = (hash_table_del_key_s(h, (const char *)e->key, e->klen));
     } else {
-        entry = (hash_table_del_key_i(h, (const uintptr_t)e->key, e->klen));
+        entry = (hash_table_del_key_i(h, (uintptr_t)e->key, e->klen));
     }
     return entry;
 }
@@ -377,7 +787,7 @@ static inline struct hash_entry *hash_table_del_hash_entry_safe(struct
     {
         entry = (hash_table_del_key_safe_s(h, (const char *)e->key, e->klen));
     } else {
-        entry = (hash_table_del_key_safe_i(h, (const uintptr_t)e->key, e->klen));
+        entry = (hash_table_del_key_safe_i(h, (uintptr_t)e->key, e->klen));
     }
     return entry;
 }
@@ -391,16 +801,87 @@ static inline struct hash_entry *hash_table_del_hash_entry_safe(struct
 #define hash_entry(ptr, type, member) \
     ((type *)((char *)(ptr)-(unsigned long)(&((type *)0)->member)))
 
+/*
+ * Table walks keep their cursor in a struct hash_table_iter of their own,
+ * so any number of them can run over the same table. They only cover the
+ * current bucket array, see hash_table_finish_resize(). The entry last
+ * returned may be deleted (hash_table_del_hash_entry()) before moving on.
+ */
+struct hash_table_iter {
+    struct hash_table *h;
+    size_t bucket;          /* bucket being walked */
+    size_t end;             /* first bucket not to walk */
+    struct list_head *next; /* next in the bucket, NULL if not started */
+};
+
+/* walks buckets [@begin, @end) of @h */
+static inline void hash_table_iter_init_range(struct hash_table_iter *it,
+        struct hash_table *h, size_t begin, size_t end)
+{
+    it->h = h;
+    it->bucket = begin;
+    it->end = (end < h->buckets ? end : h->buckets);
+    it->next = NULL;
+}
+
+static inline void hash_table_iter_init(struct hash_table_iter *it,
+        struct hash_table *h)
+{
+    hash_table_iter_init_range(it, h, 0, h->buckets);
+}
+
+/* returns the next entry, NULL once the walk is over */
+static inline struct hash_entry *hash_table_iter_next(struct hash_table_iter *it)
+{
+    struct list_head *head, *pos;
+
+    while(it->bucket < it->end)
+    {
+        head = &it->h->table[it->bucket];
+        pos = (it->next ? it->next : head->next);
+        if(pos != head)
+        {
+            it->next = pos->next;
+            return list_entry(pos, struct hash_entry, list);
+        }
+        it->bucket++;
+        it->next = NULL;
+    }
+    return NULL;
+}
+
 /*
  * @hentry: &struct hash_entry
  * @htable: &struct hash_table
+ * @it: struct hash_table_iter
+ */
+#define hash_table_for_each(hentry, htable, it)     \
+    for (hash_table_iter_init(&(it), (htable));     \
+            ((hentry) = hash_table_iter_next(&(it))); )
+
+typedef void (* hash_table_walk_fn)(struct hash_entry *e, void *arg);
+
+#ifndef HASH_TABLE_MAX_WALKERS
+#define HASH_TABLE_MAX_WALKERS 64
+#endif
+#ifndef HASH_TABLE_WALK_CHUNK
+#define HASH_TABLE_WALK_CHUNK 4096 /* buckets handed to a walker at a time */
+#endif
+
+/* hash_table_parallel_for_each()
+ * @h: &struct hash_table, not resizing (see hash_table_finish_resize())
+ * @nthreads: walkers, the calling thread included
+ * @fn: called for every entry, from any of the walkers
+ * @arg: passed along to @fn
+ * Description: walks the current bucket array with @nthreads threads, each
+ *              taking HASH_TABLE_WALK_CHUNK buckets at a time. Small tables
+ *              are walked by the calling thread. @fn may delete the entry
+ *              it is given with hash_table_del_hash_entry(), nothing else
+ *              may modify @h meanwhile.
+ * Returns: the number of threads that took part.
  */
-#define hash_table_for_each(hentry, htable)     \
-    for ((htable)->__ht_i=0; ((htable)->__ht_i < (htable)->buckets); ++((htable)->__ht_i))      \
-        for(((htable)->pos= (htable)->table[(htable)->__ht_i].list.next);               \
-                ((htable)->pos != &((htable)->table[(htable)->__ht_i].list)) && \
-                ((hentry) = ((struct hash_entry *)((char *)((htable)->pos)-(unsigned long)(&((struct hash_entry *)0)->list))) );        \
-                (htable)->pos= (htable)->pos->next)
+unsigned int hash_table_parallel_for_each(struct hash_table *h,
+        unsigned int nthreads, hash_table_walk_fn fn, void *arg);
 
 /*
  * @hentry: &struct hash_entry
@@ -412,18 +893,22 @@ static inline struct hash_entry *hash_table_del_hash_entry_safe(struct
 #if 0
 #define hash_table_for_each_safe(hentry, htable, pos, n, hti)      \
     for ( hti=0; (hti < (htable)->buckets); ++hti ) \
-                for( pos=(htable)->table[hti].list.next, n=pos->next; \
-                        pos != &(htable)->table[hti].list &&    \
+                for( pos=(htable)->table[hti].next, n=pos->next; \
+                        pos != &(htable)->table[hti] &&    \
                         (hentry) = ((struct hash_entry *)((char *)(pos)- \
                                 (unsigned long)(&((struct hash_entry *)0)->list))) ; \
                         pos = n, n=pos->next)
 #endif
 #define hash_table_for_each_safe(hentry, htable, pos, n, hti)      \
     for ((hti)=0; ((hti) < (htable)->buckets); ++(hti)) \
-                for(((pos)= (htable)->table[(hti)].list.next), n =(pos)->next;          \
-                        ((pos) != &((htable)->table[(hti)].list)) &&    \
+                for(((pos)= (htable)->table[(hti)].next), n =(pos)->next;          \
+                        ((pos) != &((htable)->table[(hti)])) &&    \
                         ((hentry) = ((struct hash_entry *)((char *)((pos))-(unsigned long)(&((struct hash_entry *)0)->list))) ) ; \
                         pos = n, n = pos->next)
 
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,199 @@
+#ifndef _HASHTBL_HPP
+#define _HASHTBL_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <new>
+
+#include "hashtbl/hashtbl.h"
+
+/**
+ * struct hash_table for C++ objects, keyed by pointers or integers.
+ *
+ * The C table calls its hash function and key compare through the
+ * pointers it was set up with, on every lookup. Here both are template
+ * parameters: lookups fold the hash and walk the chain inline, with Hash
+ * and Eq inlined into the loop. Inserts hand the folded hash to
+ * hash_table_insert_hashed() and removals go through
+ * hash_table_unlink_safe(), so resizing and locking stay the C table's.
+ *
+ * Keys are stored by value in hash_entry.key, like the _i API does, so
+ * they have to be trivially copyable and fit in a pointer.
+ *
+ * Thread safety follows the C calls underneath: insert() and both
+ * erase() calls lock the stripe they touch and are safe against each
+ * other. find(), for_each() and erase_if() don't lock (same as
+ * hash_table_lookup_key_i()) and need writers kept out.
+ *
+ *   struct conn { struct hash_entry hentry; int fd; ... };
+ *   milu::intrusive_hash_map<int, conn, &conn::hentry> conns;
+ *
+ */
+
+namespace milu {
+
+/* the table folds hashes with the golden ratio, the key itself will do */
+template <typename Key>
+struct identity_hash {
+    size_t operator()(const Key &k) const { return (size_t)k; }
+};
+
+template <typename Key, typename T, struct hash_entry T::*Entry,
+         typename Hash = identity_hash<Key>, typename Eq = std::equal_to<Key> >
+class intrusive_hash_map {
+public:
+    explicit intrusive_hash_map(unsigned int n = 16)
+    {
+        if(hash_table_init(&t_, n, key_cmp, key_hash))
+            throw std::bad_alloc();
+    }
+
+    ~intrusive_hash_map() { hash_table_finit(&t_); }
+
+    /* links @obj under @k, duplicate keys are not checked for */
+    void insert(const Key &k, T &obj)
+    {
+        struct hash_entry *e = &(obj.*Entry);
+
+        hash_entry_init(e, encode(k), sizeof(Key), 0);
+        hash_table_insert_hashed(&t_, e, hash_table_fold(Hash()(k)));
+    }
+
+    /* the first object linked under @k, NULL if there's none */
+    T *find(const Key &k) const
+    {
+        struct hash_entry *e;
+        struct list_head *head, *pos;
+        uint32_t hv = hash_table_fold(Hash()(k));
+        int current;
+
+        head = hash_table_head(&t_, hv, &current);
+        for( pos=head->next ; pos!=head ; pos=pos->next )
+        {
+            e = entry_of(pos);
+            if(e->_hash == hv && Eq()(decode(e), k))
+                return owner_of(e);
+        }
+        return NULL;
+    }
+
+    /* unlinks and returns the first object under @k, NULL if none */
+    T *erase(const Key &k)
+    {
+        struct hash_entry *e;
+
+        //looked up under the stripe lock, find() can't be used here.
+        e = hash_table_del_hashed(&t_, hash_table_fold(Hash()(k)),
+                encode(k), sizeof(Key));
+        return (e ? owner_of(e) : NULL);
+    }
+
+    /* unlinks @obj, which must be in the map */
+    void erase(T &obj)
+    {
+        hash_table_unlink_safe(&t_, &(obj.*Entry));
+    }
+
+    /* calls @f(key, obj) for every object, @f must leave the map alone.
+     * returns @f, as std::for_each() does. */
+    template <typename F>
+    F for_each(F f)
+    {
+        struct hash_table_iter it;
+        struct hash_entry *e;
+
+        hash_table_finish_resize(&t_);
+        hash_table_for_each(e, &t_, it)
+            f(decode(e), *owner_of(e));
+        return f;
+    }
+
+    /* unlinks every object @f(key, obj) is true for, returns how many */
+    template <typename F>
+    size_t erase_if(F f)
+    {
+        struct hash_table_iter it;
+        struct hash_entry *e;
+        size_t n = 0;
+
+        hash_table_finish_resize(&t_);
+        hash_table_for_each(e, &t_, it)
+        {
+            if(f(decode(e), *owner_of(e)))
+            {
+                hash_table_unlink(&t_, e);
+                n++;
+            }
+        }
+        return n;
+    }
+
+    size_t size() const { return t_._nentries; }
+    bool empty() const { return !t_._nentries; }
+
+    /* for the C calls, e.g. hash_table_get_stats() */
+    struct hash_table *table() { return &t_; }
+
+private:
+    intrusive_hash_map(const intrusive_hash_map &);
+    intrusive_hash_map &operator=(const intrusive_hash_map &);
+
+    static void *encode(const Key &k)
+    {
+        void *p = NULL;
+
+        std::memcpy(&p, &k, sizeof(Key));
+        return p;
+    }
+
+    static Key decode(const struct hash_entry *e)
+    {
+        Key k;
+
+        std::memcpy(&k, &e->key, sizeof(Key));
+        return k;
+    }
+
+    static struct hash_entry *entry_of(struct list_head *pos)
+    {
+        return reinterpret_cast<struct hash_entry *>(
+                reinterpret_cast<char *>(pos) - offsetof(struct hash_entry, list));
+    }
+
+    static T *owner_of(struct hash_entry *e)
+    {
+        //offsetof() doesn't take member pointers.
+        const T *probe = reinterpret_cast<const T *>(sizeof(T));
+        size_t off = reinterpret_cast<const char *>(&(probe->*Entry)) -
+            reinterpret_cast<const char *>(probe);
+
+        return reinterpret_cast<T *>(reinterpret_cast<char *>(e) - off);
+    }
+
+    /* what the C side calls, if @t_ is handed to the C API */
+    static size_t key_hash(const void *key, size_t)
+    {
+        Key k;
+
+        std::memcpy(&k, &key, sizeof(Key));
+        return Hash()(k);
+    }
+
+    static int key_cmp(const void *a, const void *b, size_t)
+    {
+        Key x, y;
+
+        std::memcpy(&x, &a, sizeof(Key));
+        std::memcpy(&y, &b, sizeof(Key));
+        return !Eq()(x, y);
+    }
+
+    typedef char key_fits_in_a_pointer[sizeof(Key) <= sizeof(void *) ? 1 : -1];
+
+    mutable struct hash_table t_;
+};
+
+} // namespace milu
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef _INTTBL_H
+#define _INTTBL_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "hash/hash.h"
+#include "hashtbl/hashtbl.h"
+
+/**
+ * Chained table for uintptr_t keys with compact intrusive entries.
+ *
+ * struct hash_entry pays for string keys and O(1) unlinking: a key
+ * pointer, its length, the _skey flag and a doubly linked list_head, 40
+ * bytes per entry and 16 per bucket head. Integer keys need none of that:
+ * an int_entry is the key and a next pointer (16 bytes) and a bucket is
+ * a single pointer to the first entry. Removal is by key and walks the
+ * chain anyway, so a singly linked chain does (an hlist_node would add a
+ * pprev back pointer for nothing).
+ *
+ * Otherwise it works like struct hash_table: power of two bucket arrays
+ * picked by Fibonacci hashing, lock stripes shared by the buckets, and
+ * incremental resizes where old bucket i feeds new buckets 2i and 2i+1.
+ * A moved old bucket head is set to INT_TABLE_MOVED.
+ *
+ */
+
+#define INT_TABLE_MIN_BITS 4
+#define INT_TABLE_MAX_BITS 31
+
+#ifndef INT_TABLE_LOCK_STRIPES
+#define INT_TABLE_LOCK_STRIPES 1024
+#endif
+
+struct int_entry {
+    uintptr_t key;
+    struct int_entry *next;
+};
+
+#define INT_TABLE_MOVED ((struct int_entry *)1)
+
+struct int_table {
+    struct int_entry **table;
+
+    size_t buckets;
+    unsigned int _hbits; /* buckets == 1 << _hbits */
+
+    struct hash_lock_stripe *_stripes;
+    unsigned int _sbits; /* 1 << _sbits stripes, never more than buckets */
+    void *_stripes_mem;
+
+    pthread_mutex_t lock;
+
+    size_t _resize_threshold;
+    size_t _used_buckets;
+    size_t _nentries;
+
+    /* incremental resize, see struct hash_table */
+    struct int_entry **_old_table;
+    size_t _old_buckets;
+    unsigned int _old_hbits;
+    uint64_t _migrate; /* (_seq << 32) | next old bucket to move */
+    size_t _migrated;  /* old buckets moved so far */
+    unsigned int _seq; /* bucket array layout sequence count */
+};
+
+typedef void * (* int_table_allocator)(size_t size);
+typedef void (* int_table_deallocator)(void * ptr);
+
+static inline int int_table_lock(struct int_table *t)
+{
+    return (pthread_mutex_lock(&(t->lock)));
+}
+
+static inline int int_table_unlock(struct int_table *t)
+{
+    return (pthread_mutex_unlock(&(t->lock)));
+}
+
+static inline unsigned int int_table_bucket_of(uintptr_t key, unsigned int bits)
+{
+    return (unsigned int)hash_long((unsigned long)key, bits);
+}
+
+static inline int int_table_resizing(const struct int_table *t)
+{
+    return (t->_old_table != NULL);
+}
+
+/* int_table_init()
+ * @t: &struct int_table to initialize
+ * @n: number of entries we expect before the first resize
+ * Returns: 0 on success, -1 otherwise.
+ */
+int int_table_init(struct int_table *t, size_t n);
+
+/* int_table_finit()
+ * @t: &struct int_table
+ * Description: releases the bucket arrays, entries are left alone.
+ */
+void int_table_finit(struct int_table *t);
+
+/* int_table_finish_resize()
+ * @t: &struct int_table
+ * Description: completes an ongoing resize, int_table_for_each() only
+ *              walks the current bucket array. thread-safe.
+ */
+void int_table_finish_resize(struct int_table *t);
+
+/* int_table_mem_usage()
+ * @t: &struct int_table
+ * @m: filled with the bytes @t uses for buckets and locks, entries aside.
+ */
+void int_table_mem_usage(struct int_table *t, struct hash_table_mem *m);
+
+/* int_table_insert()
+ * @t: &struct int_table
+ * @e: &struct int_entry to link
+ * @key: key @e is found by
+ * Description: inserts @e, duplicate keys are not checked for.
+ *              not thread-safe.
+ */
+void int_table_insert(struct int_table *t, struct int_entry *e, uintptr_t key);
+
+/* int_table_lookup()
+ * @t: &struct int_table
+ * @key: the key to look for
+ * Returns: the entry for @key, NULL if there's none. not thread-safe.
+ */
+struct int_entry *int_table_lookup(const struct int_table *t, uintptr_t key);
+
+/* int_table_del()
+ * @t: &struct int_table
+ * @key: the key to remove
+ * Returns: the entry unlinked, NULL if there was none. not thread-safe,
+ *          never moves buckets around (see int_table_for_each()).
+ */
+struct int_entry *int_table_del(struct int_table *t, uintptr_t key);
+
+/* thread-safe versions of the above, inserts/deletes help resizing. */
+void int_table_insert_safe(struct int_table *t, struct int_entry *e,
+        uintptr_t key);
+
+struct int_entry *int_table_lookup_safe(struct int_table *t, uintptr_t key);
+
+struct int_entry *int_table_del_safe(struct int_table *t, uintptr_t key);
+
+void custom_it_allocator(int_table_allocator allocator,
+        int_table_deallocator deallocator);
+
+/*
+ * @entry: &struct int_entry cursor
+ * @itable: &struct int_table
+ * @n: &struct int_entry, next entry
+ * @i: size_t bucket index
+ * Walks the current bucket array, call int_table_finish_resize() first.
+ * @entry may be deleted with int_table_del() along the way.
+ */
+#define int_table_for_each_safe(entry, itable, n, i)                    \
+    for ((i)=0; (i) < (itable)->buckets; ++(i))                         \
+        for ((entry)=(itable)->table[(i)];                              \
+                (entry) && ((n)=(entry)->next, 1); (entry)=(n))
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef _PTRTBL_H
+#define _PTRTBL_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "hash/hash.h"
+
+/**
+ * Open addressing table for uintptr_t keys (pointers, mostly).
+ *
+ * struct hash_table chains intrusive entries: every probe follows a
+ * pointer to another cache line and calls the key compare and hash
+ * functions through pointers. Here keys and values live side by side in
+ * one flat slot array, the hash is inlined (Fibonacci hashing from
+ * hash.h) and collisions are resolved by linear probing, so a lookup
+ * usually touches a single cache line.
+ *
+ * Key 0 marks an empty slot, so NULL can't be stored. Deletions shift the
+ * following run back into place (no tombstones), which keeps probe
+ * sequences short under heavy malloc/free churn.
+ *
+ */
+
+#define PTR_TABLE_MIN_BITS 4
+#define PTR_TABLE_MAX_BITS 31
+
+/* The table is kept at most half full: ~1.5 probes per hit, ~2.5 per miss. */
+#define PTR_TABLE_MAX_LOAD(cap) ((cap) >> 1)
+
+struct ptr_slot {
+    uintptr_t key;
+    void * val;
+};
+
+struct ptr_table {
+    struct ptr_slot *slots;
+
+    size_t capacity; /* capacity == 1 << _bits */
+    unsigned int _bits;
+    size_t _nentries;
+    size_t _resize_threshold;
+
+    pthread_mutex_t lock;
+};
+
+typedef void * (* ptr_table_allocator)(size_t size);
+typedef void (* ptr_table_deallocator)(void * ptr);
+
+static inline int ptr_table_lock(struct ptr_table *t)
+{
+    return (pthread_mutex_lock(&(t->lock)));
+}
+
+static inline int ptr_table_unlock(struct ptr_table *t)
+{
+    return (pthread_mutex_unlock(&(t->lock)));
+}
+
+static inline size_t ptr_table_slot_of(const struct ptr_table *t, uintptr_t key)
+{
+    return (size_t)hash_long((unsigned long)key, t->_bits);
+}
+
+/* ptr_table_init()
+ * @t: &struct ptr_table to initialize
+ * @n: number of entries we expect to hold
+ * Description: sizes @t so that @n entries fit without growing.
+ * Returns: 0 on success, -1 if the slot array can't be allocated.
+ */
+int ptr_table_init(struct ptr_table *t, size_t n);
+
+void ptr_table_finit(struct ptr_table *t);
+
+/* ptr_table_insert()
+ * @t: &struct ptr_table
+ * @key: non-zero key
+ * @val: value stored along @key
+ * Description: inserts @key, replacing the value if it is already there.
+ *              Grows the table when it gets half full. not thread-safe.
+ * Returns: 0 on success, -1 on a zero key or allocation failure.
+ */
+int ptr_table_insert(struct ptr_table *t, uintptr_t key, void *val);
+
+/* ptr_table_lookup()
+ * @t: &struct ptr_table
+ * @key: the key to look for
+ * Returns: the value stored for @key, NULL if it is not there.
+ *          not thread-safe.
+ */
+void *ptr_table_lookup(const struct ptr_table *t, uintptr_t key);
+
+/* ptr_table_del()
+ * @t: &struct ptr_table
+ * @key: the key to remove
+ * Returns: the value stored for @key, NULL if it was not there.
+ *          not thread-safe.
+ */
+void *ptr_table_del(struct ptr_table *t, uintptr_t key);
+
+/* thread-safe versions of the above, serialized on t->lock. */
+int ptr_table_insert_safe(struct ptr_table *t, uintptr_t key, void *val);
+
+void *ptr_table_lookup_safe(struct ptr_table *t, uintptr_t key);
+
+void *ptr_table_del_safe(struct ptr_table *t, uintptr_t key);
+
+void custom_pt_allocator(ptr_table_allocator allocator,
+        ptr_table_deallocator deallocator);
+
+/*
+ * @slot: &struct ptr_slot cursor
+ * @ptable: &struct ptr_table
+ * @i: size_t index
+ * Iterates over the occupied slots. Not safe against insertions or
+ * deletions, those may move entries around.
+ */
+#define ptr_table_for_each(slot, ptable, i)                             \
+    for ((i)=0; (i) < (ptable)->capacity; ++(i))                        \
+        if (((slot) = &(ptable)->slots[(i)])->key)
+
+#endif
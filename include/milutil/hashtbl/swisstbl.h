@@ -0,0 +1,219 @@
+#ifndef _SWISSTBL_H
+#define _SWISSTBL_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hashtbl/hashtbl.h"
+
+#if defined(__SSE2__) && !defined(_SWISS_SCALAR)
+#include <emmintrin.h>
+#define SWISS_SSE2 1
+#endif
+
+/**
+ * Group probing table for struct hash_entry (Swiss table layout).
+ *
+ * The table keeps one control byte per slot next to a flat array of
+ * (key, hash_entry pointer) slots. A full slot's control byte holds 7 bits of the
+ * hash (h2), so a probe compares 16 control bytes at once (SSE2
+ * compare/movemask, or a scalar loop) and only dereferences entries whose
+ * tag matches. The remaining hash bits pick the group where the probe
+ * starts (h1); groups are visited in triangular order, which covers the
+ * whole table for power-of-two group counts.
+ *
+ * Entries are the same struct hash_entry used by struct hash_table, keys
+ * are set up with hash_entry_init(), so users can switch table types
+ * without touching their structs. The entry's list member is unused here.
+ * The key is copied into the slot: integer keys are compared by value
+ * without touching the entry at all, so a hit costs the control group and
+ * the slot.
+ *
+ * This is a table of its own rather than a backend behind
+ * hash_table_lookup_key_*() and hash_table_del_key_*(). Those calls come
+ * with guarantees that hang on the chained layout: lockless lookups walk
+ * chains that stay linked while entries move, bucket lock stripes, an
+ * incremental resize that moves one chain at a time, and iterators and
+ * batches that work a bucket at a time. Slots here move wholesale on a
+ * rehash and are serialized on t->lock, so hiding them behind the same
+ * names would quietly drop those guarantees. Instead the calls mirror
+ * the hash_table ones (swiss_table_lookup_key_i() for
+ * hash_table_lookup_key_i(), and so on, with the same entries and keys),
+ * and a caller that doesn't need the above switches by renaming its
+ * calls.
+ *
+ */
+
+#define SWISS_GROUP 16
+#define SWISS_MIN_BITS 0 /* log2 of the number of groups */
+#define SWISS_MAX_BITS 26
+
+#define SWISS_EMPTY   ((int8_t)-128) /* 0b10000000 */
+#define SWISS_DELETED ((int8_t)-2)   /* 0b11111110 */
+
+/* max load is 7/8, counting tombstones */
+#define SWISS_MAX_LOAD(cap) ((cap) - ((cap) >> 3))
+
+struct swiss_slot {
+    const void *key; /* e->key: the key itself for integer keys */
+    struct hash_entry *e;
+};
+
+struct swiss_table {
+    int8_t *ctrl;
+    struct swiss_slot *slots;
+
+    size_t capacity; /* capacity == SWISS_GROUP << _bits */
+    unsigned int _bits;
+    size_t _nentries;
+    size_t _ndeleted;
+
+    pthread_mutex_t lock;
+    __hash my_hash_fn;
+    keycmp_ptr keycmp;
+};
+
+/* 32 bits of folded hash: top bits pick the group, low 7 bits are the tag */
+static inline uint32_t swiss_table_hash(const struct swiss_table *t,
+        const void *key, size_t len)
+{
+    return (uint32_t)hash_long((unsigned long)t->my_hash_fn(key, len), 32);
+}
+
+static inline size_t swiss_h1(const struct swiss_table *t, uint32_t hash)
+{
+    /* shifting a 32 bit value by 32 is undefined */
+    return (t->_bits ? (size_t)(hash >> (32 - t->_bits)) : 0);
+}
+
+static inline int8_t swiss_h2(uint32_t hash)
+{
+    return (int8_t)(hash & 0x7f);
+}
+
+/* bit i set when ctrl[i] == @h2 */
+static inline uint32_t swiss_group_match(const int8_t *ctrl, int8_t h2)
+{
+#ifdef SWISS_SSE2
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(h2)));
+#else
+    uint32_t mask = 0;
+    int i;
+
+    for( i=0 ; i<SWISS_GROUP ; i++ )
+        mask |= (uint32_t)(ctrl[i] == h2) << i;
+    return mask;
+#endif
+}
+
+/* bit i set when slot i is empty or deleted (high bit of the control byte) */
+static inline uint32_t swiss_group_match_free(const int8_t *ctrl)
+{
+#ifdef SWISS_SSE2
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+    uint32_t mask = 0;
+    int i;
+
+    for( i=0 ; i<SWISS_GROUP ; i++ )
+        mask |= (uint32_t)(ctrl[i] < 0) << i;
+    return mask;
+#endif
+}
+
+static inline uint32_t swiss_group_match_empty(const int8_t *ctrl)
+{
+    return swiss_group_match(ctrl, SWISS_EMPTY);
+}
+
+static inline int swiss_table_lock(struct swiss_table *t)
+{
+    return (pthread_mutex_lock(&(t->lock)));
+}
+
+static inline int swiss_table_unlock(struct swiss_table *t)
+{
+    return (pthread_mutex_unlock(&(t->lock)));
+}
+
+/* swiss_table_init()
+ * @t: &struct swiss_table to initialize
+ * @n: number of entries we expect to hold
+ * @keycmp: key compare function, memcmp if NULL
+ * @hash_fn: hash function
+ * Returns: 0 on success, -1 otherwise.
+ */
+int swiss_table_init(struct swiss_table *t, unsigned int n,
+        keycmp_ptr keycmp, __hash hash_fn);
+
+void swiss_table_finit(struct swiss_table *t);
+
+/* swiss_table_insert_i()
+ * @t: &struct swiss_table to insert hash_entry into
+ * @e: &struct hash_entry
+ * @key: use key to insert the hash_entry
+ * @len: length of the key
+ * Description: inserts @e into @t. not thread-safe.
+ * Returns: 0 on success, -1 if the table couldn't grow.
+ */
+int swiss_table_insert_i(struct swiss_table *t, struct hash_entry *e,
+        const uintptr_t key, size_t len);
+
+int swiss_table_insert_s(struct swiss_table *t, struct hash_entry *e,
+        const char *key, size_t len);
+
+/* swiss_table_lookup_key()
+ * @t: table to look into
+ * @key the key to look for
+ * @len: length of the key
+ * Returns: a pointer to the hash_entry that matches the key. otherwise NULL.
+ * Notes: in the presence of duplicate keys any one of them may be returned.
+ *        function is not thread safe.
+ */
+struct hash_entry *swiss_table_lookup_key_i(const struct swiss_table *t,
+        const uintptr_t key, size_t len);
+
+struct hash_entry *swiss_table_lookup_key_s(const struct swiss_table *t,
+        const char *key, size_t len);
+
+struct hash_entry *swiss_table_del_key_i(struct swiss_table *t,
+        const uintptr_t key, size_t len);
+
+struct hash_entry *swiss_table_del_key_s(struct swiss_table *t,
+        const char *key, size_t len);
+
+/* thread-safe versions of the above, serialized on t->lock. */
+int swiss_table_insert_safe_i(struct swiss_table *t, struct hash_entry *e,
+        const uintptr_t key, size_t len);
+
+int swiss_table_insert_safe_s(struct swiss_table *t, struct hash_entry *e,
+        const char *key, size_t len);
+
+struct hash_entry *swiss_table_lookup_key_safe_i(struct swiss_table *t,
+        const uintptr_t key, size_t len);
+
+struct hash_entry *swiss_table_lookup_key_safe_s(struct swiss_table *t,
+        const char *key, size_t len);
+
+struct hash_entry *swiss_table_del_key_safe_i(struct swiss_table *t,
+        const uintptr_t key, size_t len);
+
+struct hash_entry *swiss_table_del_key_safe_s(struct swiss_table *t,
+        const char *key, size_t len);
+
+/*
+ * @hentry: &struct hash_entry
+ * @stable: &struct swiss_table
+ * @i: size_t slot index
+ * Not safe against insertions (the table may be rehashed), deleting the
+ * current entry is fine.
+ */
+#define swiss_table_for_each(hentry, stable, i)                         \
+    for ((i)=0; (i) < (stable)->capacity; ++(i))                        \
+        if ((stable)->ctrl[(i)] >= 0 && ((hentry) = (stable)->slots[(i)].e))
+
+#endif
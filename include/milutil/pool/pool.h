@@ -2,38 +2,108 @@
 #define _MILU_POOL_H
 
 #include <stdint.h>
-#include "list/list.h"
-#include "queue/queue.h"
+#include <stddef.h>
 
-struct pool_entry {
-    void * ptr;
-    struct list_head q_e; //pool queue
-};
+/* free list head: (tag << 32) | (index + 1), 0 when the pool is empty.
+ * the tag goes up on every pop so a stale head can't be CAS'ed back in (ABA). */
+#define POOL_HEAD_IDX(h) ((uint32_t)(h))
+#define POOL_HEAD_TAG(h) ((uint32_t)((h) >> 32))
+#define POOL_HEAD(tag, idx) (((uint64_t)(tag) << 32) | (uint32_t)(idx))
+
+/* objects must at least hold the free list link */
+#define POOL_MIN_OBJSZ sizeof(uint32_t)
+
+/* pool memory starts on a segment boundary, so no two pools share a
+ * segment and the segment number alone tells the owner (see poolbank.h) */
+#define POOL_SEG_SHIFT 16
+#define POOL_SEG_SIZE ((size_t)1 << POOL_SEG_SHIFT)
+
+/* biggest pool, the free list indexes objects with 32 bits */
+#define POOL_MAX_OBJS (1U << 24)
 
+/*
+ * POOL_MMAP: memory straight from mmap() rather than the pool allocator,
+ * so it can be given back (see pool_purge()). POOL_HUGEPAGE: also
+ * 2MB aligned and madvise(MADV_HUGEPAGE)'d, fewer TLB misses over big
+ * pools of small objects. POOL_PURGED is set while a pool's pages are
+ * given back.
+ */
+#define POOL_MMAP     0x01
+#define POOL_HUGEPAGE 0x02
+#define POOL_PURGED   0x04
+
+#define POOL_HUGEPAGE_SIZE ((size_t)2 << 20)
+
+/*
+ * Fixed size objects carved out of one block. Free objects are kept in a
+ * lock-free (Treiber) stack threaded through the objects themselves: the
+ * first 4 bytes of a free object hold the index + 1 of the next free one.
+ * get and put are a single CAS on _head each.
+ */
 struct pool {
-    uint16_t _nobjs;
-    uint16_t _n_q;
+    uint32_t _nobjs;
     size_t _obj_sz;
 
-    struct pool_entry * _entries;
-    char * _pool_mem;
+    uint64_t _head;
+    uint32_t _bank_idx; //slot in the bank that owns it, if any.
+    uint8_t _flags;
+    uint32_t _idle_tag;   //head tag when _idle_since was taken.
+    uint64_t _idle_since; //since when no get was seen, 0 if not looked.
+    char * _pool_mem;   //segment aligned, inside _raw_mem.
+    char * _raw_mem;    //what the allocator (or mmap()) returned.
+    size_t _raw_len;
     uintptr_t _start_addr;
     uintptr_t _end_addr;
-
-    struct queue pool_q; 
-    struct queue avail_q; 
 };
 
 typedef void * (* pool_allocator)(size_t size);
 
-struct pool * create_pool(uint16_t p_sz, size_t o_sz);
+struct pool * create_pool(uint32_t p_sz, size_t o_sz);
+
+/* @flags: POOL_MMAP, POOL_HUGEPAGE (implies POOL_MMAP) */
+struct pool * create_pool_flags(uint32_t p_sz, size_t o_sz, uint8_t flags);
 
 int destroy_pool(struct pool * p);
 
 void * pool_get_ptr(struct pool * p);
 
+/* index + 1 of the object at @ptr, 0 if it isn't one of @p's */
+static inline uint32_t pool_idx_of(struct pool * p, void * ptr) {
+    uintptr_t addr = (uintptr_t)ptr;
+
+    //pointer doesn't belong in this pool
+    if (addr < p->_start_addr || addr >= p->_end_addr) {
+        return 0;
+    }
+    if((addr - p->_start_addr) % p->_obj_sz) {
+        return 0;
+    }
+    return (uint32_t)((addr - p->_start_addr) / p->_obj_sz) + 1;
+}
+
+/* true if @p had no free object when looked at */
+static inline int pool_empty(struct pool * p) {
+    return !POOL_HEAD_IDX(__atomic_load_n(&p->_head, __ATOMIC_SEQ_CST));
+}
+
 int pool_put_ptr(struct pool * p, void * ptr);
 
+uint32_t pool_get_batch(struct pool * p, void ** objs, uint32_t n);
+
+int pool_put_batch(struct pool * p, void ** objs, uint32_t n);
+
+/* free objects, counted along the list: only exact while no one else
+ * uses @p. */
+uint32_t pool_nfree(struct pool * p);
+
+/* gives the pages of an mmap'ed pool back to the OS if all its objects
+ * are free, the pool stays empty until pool_revive(). -1 if it isn't
+ * all free (or not mmap'ed). */
+int pool_purge(struct pool * p);
+
+/* refills a purged pool, the caller must be the only one reviving it */
+int pool_revive(struct pool * p);
+
 void custom_p_allocator(pool_allocator allocator);
 
 #endif
@@ -2,17 +2,128 @@
 #define _MILU_POOLBANK_H
 
 #include <stdint.h>
+#include <pthread.h>
 #include "pool/pool.h"
 
 
+/*
+ * Segment number (address >> POOL_SEG_SHIFT) to pool, a 3 level radix
+ * tree over 48 bit addresses. Nodes are only ever added, lookups don't lock.
+ */
+#define BANK_MAP_L1_BITS 11
+#define BANK_MAP_L2_BITS 11
+#define BANK_MAP_L3_BITS 10
+#define BANK_MAP_BITS (BANK_MAP_L1_BITS + BANK_MAP_L2_BITS + BANK_MAP_L3_BITS)
+
+struct bank_map_leaf {
+    struct pool * pool[1 << BANK_MAP_L3_BITS];
+};
+
+struct bank_map_mid {
+    struct bank_map_leaf * leaf[1 << BANK_MAP_L2_BITS];
+};
+
+/*
+ * Pools with free objects have their bit set in _avail, words of _avail
+ * with any bit set have theirs in _avail_sum: a get finds a pool with
+ * room in two bit scans. Bits are hints, a pool found empty gets its bit
+ * cleared and the get moves on.
+ */
+#define BANK_MAX_POOLS (64 * 64)
+
+/*
+ * Pool directory: chunk k holds slots 2^k - 1 to 2^(k+1) - 2. Chunks are
+ * allocated as the bank grows and never move, so slots can be read
+ * without locking while pools are added.
+ */
+#define BANK_DIR_CHUNKS 13
+
+/*
+ * A growing bank adds a pool when it runs out, each one twice the size of
+ * the previous, up to POOL_MAX_OBJS objects or BANK_MAX_POOL_BYTES,
+ * whichever comes first (never below the bank's first pools though).
+ */
+#ifndef BANK_MAX_POOL_BYTES
+#define BANK_MAX_POOL_BYTES (64UL << 20)
+#endif
+
+/*
+ * Banks of POOL_MMAP pools give the pages of pools that are all free and
+ * gave nothing out for _idle_ns back to the OS, on bank_trim(). Purged pools keep their
+ * address range and are brought back before the bank grows.
+ * bank_trim_tick() runs it on a clock rather than on a call count, so
+ * that a trickle of calls after a spike is enough to purge.
+ */
+#define BANK_IDLE_MS 1000
+
 struct bank {
     uint16_t _max_pools;
     uint16_t _allocd_pools;
     uint16_t _poolsz;
+    int8_t   _growing;
+    uint8_t  _pool_flags;
+    uint32_t _nextsz;   //objects in the next pool added.
+    uint32_t _npurged;
     size_t   _objsz;
+    uint64_t _idle_ns;
+    uint64_t _last_trim; //coarse clock, see bank_trim_tick()
+
+    pthread_mutex_t _grow_mutex;
+    struct pool ** _dir[BANK_DIR_CHUNKS];
+    struct bank_map_mid * _map[1 << BANK_MAP_L1_BITS];
+
+    uint64_t _avail_sum;
+    uint64_t _avail[BANK_MAX_POOLS / 64];
+};
+
+/* pool in slot @idx of @b, which must be below _allocd_pools */
+static inline struct pool * bank_pool(struct bank * b, uint32_t idx) {
+    uint32_t k = 31 - __builtin_clz(idx + 1);
+
+    return __atomic_load_n(&b->_dir[k][idx + 1 - (1U << k)], __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Per-thread cache in front of a bank. Gets and puts hit the magazine
+ * alone, the bank is only touched every BANK_MAG_BATCH objects, and then
+ * in a batch. The owner provides the storage (e.g. __thread) and flushes
+ * it when the thread goes away.
+ */
+#define BANK_MAG_BATCH 16
+
+struct bank_magazine {
+    uint32_t n;
+    void * obj[2 * BANK_MAG_BATCH];
+};
+
+/*
+ * Per-CPU caches in front of a bank, for processes with many more threads
+ * than CPUs: what's cached is bounded by the CPU count rather than the
+ * thread count. With rseq (x86_64, registered by libc) get and put are
+ * restartable sequences on the current CPU's cache, no atomics at all.
+ * Otherwise (BANK_PCPU_LOCK) each cache has a lock and the CPU comes
+ * from sched_getcpu(). That lock is a test-and-set spin that yields the
+ * CPU while it's held, not a lock-free stack: a thread preempted while
+ * holding it stalls the others on that CPU's cache for a time slice,
+ * and gets and puts pay an atomic exchange each. Threads without a
+ * usable CPU id go to the bank.
+ */
+#define BANK_PCPU_ANY  0    //rseq if available, locks otherwise
+#define BANK_PCPU_RSEQ 1
+#define BANK_PCPU_LOCK 2
 
+struct bank_pcpu_cache {
+    uint32_t n;
+    uint32_t lock;
+    void * obj[2 * BANK_MAG_BATCH];
+} __attribute__((aligned(64)));
 
-    struct pool **bank;
+struct bank_pcpu {
+    struct bank * b;
+    uint32_t ncpus;
+    uint8_t mode;
+    struct bank_pcpu_cache * caches;
+    void * _raw;
 };
 
 typedef void * (* bank_allocator)(size_t size);
@@ -22,14 +133,84 @@ struct bank * create_bank( uint16_t n_pools
                          , uint16_t poolsize
                          , size_t   objsize );
 
+/* @flags: POOL_MMAP, POOL_HUGEPAGE for all the bank's pools */
+struct bank * create_bank_flags( uint16_t n_pools
+                               , int8_t   growing
+                               , uint16_t poolsize
+                               , size_t   objsize
+                               , uint8_t  flags );
+
 int destroy_bank(struct bank * b);
 
+/* purges mmap'ed pools idle for long enough, returns how many. cheap to
+ * call often, it doesn't wait for a bank being grown or trimmed. */
+int bank_trim(struct bank * b);
+
+void bank_set_idle(struct bank * b, uint32_t idle_ms);
+
+int _bank_trim_tick(struct bank * b);
+
+/* bank_trim() if half the idle time went by since the last one, returns
+ * how many pools were purged. meant for get/put paths: a flag test for
+ * banks without POOL_MMAP, a coarse clock read otherwise. */
+static inline int bank_trim_tick(struct bank * b) {
+    if(!(b->_pool_flags & POOL_MMAP))
+        return 0;
+    return _bank_trim_tick(b);
+}
+
 int add_pool(struct bank * b);
 
 void * bank_get_ptr(struct bank * b);
 
 int bank_put_ptr(struct bank * b, void * p);
 
+/* pool in @b that @p came from, NULL if none. O(1). */
+struct pool * bank_pool_of(struct bank * b, void * p);
+
+/* up to @n objects, as few pools as possible touched. returns how many. */
+uint32_t bank_get_batch(struct bank * b, void ** objs, uint32_t n);
+
+/* returns how many of @objs weren't from @b */
+uint32_t bank_put_batch(struct bank * b, void ** objs, uint32_t n);
+
+void * bank_mag_refill(struct bank * b, struct bank_magazine * m);
+
+void bank_mag_drain(struct bank * b, struct bank_magazine * m);
+
+/* everything in @m back to @b */
+void bank_mag_flush(struct bank * b, struct bank_magazine * m);
+
+static inline void * bank_mag_get(struct bank * b, struct bank_magazine * m) {
+    if(m->n)
+        return m->obj[--m->n];
+    return bank_mag_refill(b, m);
+}
+
+/* -1 if @p isn't from @b */
+static inline int bank_mag_put(struct bank * b, struct bank_magazine * m, void * p) {
+    struct pool * pool = bank_pool_of(b, p);
+
+    if(!pool || !pool_idx_of(pool, p))
+        return -1;
+    if(m->n == 2 * BANK_MAG_BATCH)
+        bank_mag_drain(b, m);
+    m->obj[m->n++] = p;
+    return 0;
+}
+
+/* caches for every configured CPU in front of @b. NULL if @mode can't be
+ * had (e.g. BANK_PCPU_RSEQ without rseq). */
+struct bank_pcpu * create_bank_pcpu(struct bank * b, uint8_t mode);
+
+/* cached objects back to the bank, no one may be using @c anymore */
+void destroy_bank_pcpu(struct bank_pcpu * c);
+
+void * bank_pcpu_get(struct bank_pcpu * c);
+
+/* -1 if @p isn't from the bank */
+int bank_pcpu_put(struct bank_pcpu * c, void * p);
+
 void custom_b_allocator(bank_allocator allocator);
 
 #endif
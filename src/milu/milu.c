@@ -6,9 +6,11 @@
 //for backtraces: http://www.gnu.org/software/libc/manual/html_node/Backtraces.html
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <execinfo.h> 
 #include <inttypes.h> 
 #include <pthread.h>
+#include <unistd.h>
 
 #include "milu.h"
 #include "hashtbl/hashtbl.h"
@@ -27,17 +29,89 @@
  *
  * */
 
-struct memstats stats; //this should be thread-safe.
+struct memstats stats; //updated with atomic ops, threads share it.
 static volatile uint8_t milu_enabled = 0; //handle with care. 
+static volatile uint8_t milu_initialized = 0;
 
 pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Set while a thread runs milu code: whatever the tables, the pools,
+ * backtrace() or dlsym() allocate on our behalf goes straight to libc and
+ * isn't tracked. initial-exec TLS doesn't allocate on first access.
+ */
+static __thread uint8_t _in_milu __attribute__((tls_model("initial-exec")));
+
+#ifdef _POOLING
+/*
+ * Each thread takes its memallocs from its own magazine, refilled from
+ * and flushed to _milu_pools in batches, so threads don't meet on the
+ * bank for every allocation. The key is there for its destructor, which
+ * gives an exiting thread's magazine back. Past that point the thread
+ * goes to the bank directly.
+ */
+#define _MAG_UNUSED 0
+#define _MAG_KEYED  1
+#define _MAG_GONE   2
+static __thread struct bank_magazine _milu_mag __attribute__((tls_model("initial-exec")));
+static __thread uint8_t _milu_mag_state __attribute__((tls_model("initial-exec")));
+static pthread_key_t _milu_mag_key;
+#endif
+
+/*
+ * dlsym() may calloc() before we know where the real allocator is. Those
+ * requests are served from here and never given back.
+ */
+#define _BOOT_HEAP_SZ 4096
+static char _boot_heap[_BOOT_HEAP_SZ] __attribute__((aligned(16)));
+static size_t _boot_used = 0;
+
+static malloc_fn_t real_malloc = NULL;
+static realloc_fn_t real_realloc = NULL;
+static calloc_fn_t real_calloc = NULL;
+static free_fn_t real_free = NULL;
+
+static inline int _boot_ptr(const void * ptr)
+{
+    return ((const char *)ptr >= _boot_heap &&
+            (const char *)ptr < _boot_heap + _BOOT_HEAP_SZ);
+}
+
+static void * _boot_alloc(size_t size)
+{
+    size_t off = __sync_fetch_and_add(&_boot_used, (size + 15) & ~(size_t)15);
+
+    if(off + size > _BOOT_HEAP_SZ)
+        return NULL;
+    return &_boot_heap[off];
+}
+
+static void _resolve(void)
+{
+    static __thread uint8_t resolving __attribute__((tls_model("initial-exec")));
+    uint8_t in_milu = _in_milu;
+
+    //dlsym() calling back into us.
+    if(resolving)
+        return;
+
+    resolving = 1;
+    _in_milu = 1;
+    real_calloc = (calloc_fn_t) dlsym(RTLD_NEXT, "calloc");
+    real_malloc = (malloc_fn_t) dlsym(RTLD_NEXT, "malloc");
+    real_realloc = (realloc_fn_t) dlsym(RTLD_NEXT, "realloc");
+    real_free = (free_fn_t) dlsym(RTLD_NEXT, "free");
+    _in_milu = in_milu;
+    resolving = 0;
+}
+
 static inline void * _malloc(size_t size)
 {
-    static malloc_fn_t real_malloc = NULL;
     if(unlikely(!real_malloc))
     {
-        real_malloc = (malloc_fn_t) dlsym(RTLD_NEXT, "malloc");
+        _resolve();
+        if(!real_malloc)
+            return _boot_alloc(size);
     }
 
     return real_malloc(size);
@@ -45,10 +119,22 @@ static inline void * _malloc(size_t size)
 
 static inline void * _realloc(void * ptr, size_t size)
 {
-    static realloc_fn_t real_realloc = NULL;
+    void * nptr = NULL;
+
     if(unlikely(!real_realloc))
     {
-        real_realloc = (const realloc_fn_t) dlsym(RTLD_NEXT, "realloc");
+        _resolve();
+        if(!real_realloc)
+            return NULL;
+    }
+
+    if(unlikely(_boot_ptr(ptr)))
+    {
+        size_t left = (size_t)(_boot_heap + _BOOT_HEAP_SZ - (char *)ptr);
+
+        if((nptr = real_malloc(size)))
+            memcpy(nptr, ptr, size < left ? size : left);
+        return nptr;
     }
 
     return real_realloc(ptr, size);
@@ -56,10 +142,12 @@ static inline void * _realloc(void * ptr, size_t size)
 
 static inline void * _calloc(size_t nmemb, size_t size)
 {
-    static calloc_fn_t real_calloc = NULL;
     if(unlikely(!real_calloc))
     {
-        real_calloc = (const calloc_fn_t) dlsym(RTLD_NEXT, "realloc");
+        _resolve();
+        //the boot heap is zeroed and never reused.
+        if(!real_calloc)
+            return _boot_alloc(nmemb * size);
     }
 
     return real_calloc(nmemb, size);
@@ -67,45 +155,204 @@ static inline void * _calloc(size_t nmemb, size_t size)
 
 static inline void _free(void * ptr)
 {
-    static free_fn_t real_free = NULL;
+    if(unlikely(_boot_ptr(ptr)))
+        return;
+
     if(unlikely(!real_free))
     {
-        real_free = (const free_fn_t) dlsym(RTLD_NEXT, "free");
+        _resolve();
+        if(!real_free)
+            return;
     }
 
     real_free(ptr);
     return;
 }
 
+/* MILU_SHARDS if set and sane, MILU_DEF_SHARDS otherwise */
+static unsigned int _milu_shards(void)
+{
+    const char * env = getenv("MILU_SHARDS");
+    unsigned long n = MILU_DEF_SHARDS;
+    unsigned int shards = 1;
+
+    if(env && *env)
+    {
+        n = strtoul(env, NULL, 10);
+        if(!n || n > MILU_MAX_SHARDS)
+            n = MILU_DEF_SHARDS;
+    }
+
+    while(shards < n)
+        shards <<= 1;
+    return shards;
+}
+
 static inline int _init_htable(void)
 {
+    unsigned int i = 0;
+    const char * env = getenv("MILU_STATS");
+    const char * nobt = getenv("MILU_NOBT");
+
+    _milu_nshards = _milu_shards();
+    _milu_stats = (env && *env && *env != '0');
+    _milu_nobt = (nobt && *nobt && *nobt != '0');
+#ifdef _PTRTBL
+    if(!_milu_ptable)
+    {
+        _milu_ptable = (struct ptr_table *)_malloc(
+                _milu_nshards * sizeof(struct ptr_table));
+        if(!_milu_ptable)
+        {
+            return -1;
+        }
+    }
+
+    //the tables grow from within malloc(), keep them off the tracked heap.
+    custom_pt_allocator(_malloc, _free);
+    for( i=0 ; i<_milu_nshards ; i++ )
+    {
+        if(ptr_table_init( &_milu_ptable[i], _DEF_HSIZE / _milu_nshards ))
+            return -1;
+    }
+#elif defined(_INTTBL)
+    if(!_milu_itable)
+    {
+        _milu_itable = (struct int_table *)_malloc(
+                _milu_nshards * sizeof(struct int_table));
+        if(!_milu_itable)
+        {
+            return -1;
+        }
+    }
+
+    //the tables grow from within malloc(), keep them off the tracked heap.
+    custom_it_allocator(_malloc, _free);
+    for( i=0 ; i<_milu_nshards ; i++ )
+    {
+        if(int_table_init( &_milu_itable[i], _DEF_HSIZE / _milu_nshards ))
+            return -1;
+    }
+#else
     if(!_milu_htable)
     {
-        _milu_htable = (struct hash_table *)_malloc(sizeof(struct hash_table));
+        _milu_htable = (struct hash_table *)_malloc(
+                _milu_nshards * sizeof(struct hash_table));
         if(!_milu_htable)
         {
             return -1;
         }
     }
 
-    hash_table_init(
-            _milu_htable, _DEF_HSIZE, hash64_cmp, milu_hash_ptr );
+    //the tables grow from within malloc(), keep them off the tracked heap.
+    custom_h_allocator(_malloc, _free);
+    for( i=0 ; i<_milu_nshards ; i++ )
+    {
+        if(hash_table_init( &_milu_htable[i], _DEF_HSIZE / _milu_nshards,
+                    hash64_cmp, milu_hash_ptr ))
+            return -1;
+        if(_milu_stats && hash_table_stats_enable( &_milu_htable[i] ))
+            return -1;
+    }
+#endif
     return 0;
 }
 
+/* start tracking @ptr, described by @mem */
+static inline void _track_alloc(struct memalloc * mem, void * ptr)
+{
+    unsigned int shard = milu_shard_of(ptr, _milu_nshards);
+
+#ifdef _PTRTBL
+    ptr_table_insert_safe( &_milu_ptable[shard], (uintptr_t)ptr, mem );
+#elif defined(_INTTBL)
+    int_table_insert_safe( &_milu_itable[shard], &mem->ientry, (uintptr_t)ptr );
+#else
+    hash_table_insert_safe_i( &_milu_htable[shard], &mem->hentry,
+            (const uintptr_t)ptr, sizeof(uintptr_t) );
+#endif
+}
+
+/* stop tracking @ptr, returns its memalloc or NULL if it wasn't tracked */
+static inline struct memalloc * _untrack_alloc(void * ptr)
+{
+    unsigned int shard = milu_shard_of(ptr, _milu_nshards);
+#ifdef _PTRTBL
+    return (struct memalloc *)ptr_table_del_safe(
+            &_milu_ptable[shard], (uintptr_t)ptr );
+#elif defined(_INTTBL)
+    struct int_entry * entry = NULL;
+
+    entry = int_table_del_safe( &_milu_itable[shard], (uintptr_t)ptr );
+    if( unlikely(!entry) )
+    {
+        return NULL;
+    }
+    return list_entry( entry, struct memalloc, ientry );
+#else
+    struct hash_entry * entry = NULL;
+
+    entry = hash_table_del_key_safe_i( &_milu_htable[shard],
+            (const uintptr_t)ptr, sizeof(uintptr_t) );
+    if( unlikely(!entry) )
+    {
+        return NULL;
+    }
+    return hash_entry( entry, struct memalloc, hentry );
+#endif
+}
+
 #ifdef _POOLING
+static void _milu_mag_release(void * mag)
+{
+    bank_mag_flush(_milu_pools, (struct bank_magazine *)mag);
+    _milu_mag_state = _MAG_GONE;
+}
+
+/* this thread's magazine, NULL once the thread is on its way out */
+static inline struct bank_magazine * _milu_magazine(void)
+{
+    if(likely(_milu_mag_state == _MAG_KEYED))
+        return &_milu_mag;
+    if(_milu_mag_state == _MAG_GONE)
+        return NULL;
+
+    if(pthread_setspecific(_milu_mag_key, &_milu_mag))
+        return NULL;
+    _milu_mag_state = _MAG_KEYED;
+    return &_milu_mag;
+}
+
 static inline int _init_pools(void)
 {
+    const char * env = getenv("MILU_PERCPU");
+    const char * mmap_env = getenv("MILU_MMAP");
+    uint8_t flags = 0;
+
     if(!_milu_pools)
     {
+        //MILU_MMAP=1: pools on their own (huge page) mappings, so the ones
+        //left idle can hand their pages back, see bank_trim().
+        if(mmap_env && *mmap_env && *mmap_env != '0')
+            flags = POOL_MMAP | POOL_HUGEPAGE;
         //must use custom allocator (wrapper for real malloc with no accounting).
         custom_b_allocator(_malloc);
-        _milu_pools = create_bank(1, 1, POOLSIZE, sizeof(struct memalloc));;
+        _milu_pools = create_bank_flags(1, 1, POOLSIZE,
+                sizeof(struct memalloc), flags);
         if(!_milu_pools)
         {
             //we could potentially go on and just not use pooling....
             return -1;
         }
+        //no per-CPU caches to be had, magazines it is.
+        if(env && *env && *env != '0')
+            _milu_pcpu = create_bank_pcpu(_milu_pools, BANK_PCPU_ANY);
+        if(!_milu_pcpu && pthread_key_create(&_milu_mag_key, _milu_mag_release))
+        {
+            destroy_bank(_milu_pools);
+            _milu_pools = NULL;
+            return -1;
+        }
     }
 
     return 0;
@@ -141,80 +388,129 @@ void record_free(size_t size, void* ptr)
 
 static inline uint8_t init_milu(void)
 {
-    uint8_t enable = 0;
-    /* init the hashtablie just once.
-     * reads on volatile uint8 are atomic? Assuming so.
-     * We check again on milu_enabled in case another thread
-     * initialized and enabled milu.
+    /* init the hashtable and the pools just once, init_mutex held.
      *
      * If we fail to init the hashtable, milu remains disabled.
      * */
-    if( !milu_enabled && !_init_htable() && !_init_pools() ){
-        enable = 0;
-    }
-    else {
-        enable = 1;
-    }
-    return enable;
+    return (!_init_htable() && !_init_pools());
 }
 
-void * malloc(size_t size)
+/* first call into milu: set things up, or find out we can't. */
+static void _milu_init(void)
 {
-    void * ptr = NULL;
-    uintptr_t call = 0;
-
-    struct memalloc * mem = NULL;
-
-    //we want to avoid locking in the main critical path.
-    if(unlikely(!milu_enabled))
+    pthread_mutex_lock( &init_mutex );
+    if(!milu_initialized)
     {
-        pthread_mutex_lock( &init_mutex );
         milu_enabled = init_milu();
-        pthread_mutex_unlock( &init_mutex );
+        milu_initialized = 1;
     }
+    pthread_mutex_unlock( &init_mutex );
+}
 
-    ptr = _malloc(size);
-    if(!ptr)
+/* memalloc describing @size bytes at @ptr, allocated from @call */
+static struct memalloc * _new_memalloc(void * ptr, size_t size, uintptr_t call)
+{
+    struct memalloc * mem = NULL;
+#ifdef _POOLING
+    struct bank_magazine * mag = NULL;
+
+    if(_milu_pcpu)
+        mem = (struct memalloc *)bank_pcpu_get(_milu_pcpu);
+    else if(likely((mag = _milu_magazine()) != NULL))
+        mem = (struct memalloc *)bank_mag_get(_milu_pools, mag);
+    else
+        mem = (struct memalloc *)bank_get_ptr(_milu_pools);
+    bank_trim_tick(_milu_pools);
+#endif
+    //pools ran out (or aren't used), fall back to the real thing.
+    if(!mem && !(mem = (struct memalloc *)_malloc(sizeof(struct memalloc))))
     {
         return NULL;
     }
 
-    if(likely(milu_enabled))
-    {
-        call = calladdr();
+    //initialize struct fields.
+    mem->ptr = ptr; //kinda useless, only first ptr stored.... hmmmmm :S
+    mem->calladdr = call;
+    //The same calling code will usually allocate the same size. *But not necessarily*
+    //Not for precise accounting (Don't want to use up too many resources for accounting).
+    mem->size = size;
+    if(unlikely(_milu_nobt)) {
+        mem->bt = NULL;
+        mem->bt_size = 0;
+    }
+    else
+        mem->bt_size = get_backtrace(mem->bt);
+
+    return mem;
+}
+
+static void _release_memalloc(struct memalloc * mem)
+{
+    int ret = -1;
 #ifdef _POOLING
-        if(!(mem = (struct memalloc *)bank_get_ptr(_milu_pools))) {
-            //ERROR
-        }
-#else
-        //create a memalloc struct, init, and put in hashtable
-        if(!(mem = _malloc(sizeof(struct memalloc))))
-        {
-            //ERROR
-        }
+    struct bank_magazine * mag = NULL;
 #endif
 
+    _free(mem->bt);
+#ifdef _POOLING
+    if(_milu_pcpu)
+        ret = bank_pcpu_put(_milu_pcpu, (void *)mem);
+    else if(likely((mag = _milu_magazine()) != NULL))
+        ret = bank_mag_put(_milu_pools, mag, (void *)mem);
+    else
+        ret = bank_put_ptr(_milu_pools, (void *)mem);
+    //idle pools go back on a clock, whatever the traffic.
+    bank_trim_tick(_milu_pools);
+#endif
+    if(ret)
+        _free(mem);
+}
 
-        //initialize struct fields.
-        mem->ptr = ptr; //kinda useless, only first ptr stored.... hmmmmm :S
-        mem->calladdr = call;
-        //The same calling code will usually allocate the same size. *But not necessarily*
-        //Not for precise accounting (Don't want to use up too many resources for accounting).
-        mem->size = size; 
-        mem->bt_size = get_backtrace(mem->bt);
-        hash_table_insert_safe_i( _milu_htable, &mem->hentry, 
-                (const uintptr_t)ptr, sizeof(uintptr_t) );
+/* track a fresh allocation of @size bytes at @ptr */
+static inline void _record_alloc(void * ptr, size_t size, uintptr_t call)
+{
+    struct memalloc * mem = NULL;
+
+    if(!(mem = _new_memalloc(ptr, size, call)))
+        return;
+    _track_alloc( mem, ptr );
 
 #ifdef _VERBOSE
-        record_malloc(ptr, size);
+    record_malloc(size, ptr);
 #endif
 
-        stats.alloc++;
-        stats.active_alloc++;
-        stats.reserved += size;
-        stats.active_reserved += size;
+    __sync_fetch_and_add(&stats.alloc, 1);
+    __sync_fetch_and_add(&stats.active_alloc, 1);
+    __sync_fetch_and_add(&stats.reserved, size);
+    __sync_fetch_and_add(&stats.active_reserved, size);
+}
+
+void * malloc(size_t size)
+{
+    void * ptr = NULL;
+    uintptr_t call = 0;
+
+    //milu allocating for itself.
+    if(unlikely(_in_milu))
+    {
+        return _malloc(size);
+    }
+
+    _in_milu = 1;
+    //we want to avoid locking in the main critical path.
+    if(unlikely(!milu_initialized))
+    {
+        _milu_init();
     }
 
+    ptr = _malloc(size);
+    if(likely(ptr && milu_enabled))
+    {
+        call = calladdr();
+        _record_alloc( ptr, size, call );
+    }
+    _in_milu = 0;
+
     /* whatever we got to do with the ptr */
     return ptr;
 }
@@ -224,58 +520,27 @@ void * calloc(size_t nmemb, size_t size)
     void * ptr = NULL;
     uintptr_t call = 0;
 
-    struct memalloc * mem = NULL;
-
-    //we want to avoid locking in the main critical path.
-    if(unlikely(!milu_enabled))
+    //milu (or dlsym) allocating for itself.
+    if(unlikely(_in_milu))
     {
-        pthread_mutex_lock( &init_mutex );
-        milu_enabled = init_milu();
-        pthread_mutex_unlock( &init_mutex );
+        return _calloc(nmemb, size);
     }
 
-
-    ptr = _calloc(nmemb, size);
-    if(!ptr)
+    _in_milu = 1;
+    //we want to avoid locking in the main critical path.
+    if(unlikely(!milu_initialized))
     {
-        return NULL;
+        _milu_init();
     }
 
-    if(likely(milu_enabled))
+    ptr = _calloc(nmemb, size);
+    if(likely(ptr && milu_enabled))
     {
         call = calladdr();
-
-#ifdef _POOLING
-        if(!(mem = (struct memalloc *)bank_get_ptr(_milu_pools))) {
-            //ERROR
-        }
-#else
-        //create a memalloc struct, init, and put in hashtable
-        if(!(mem = _malloc(sizeof(struct memalloc))))
-        {
-            //ERROR
-        }
-#endif
-
-        //initialize struct fields.
-        mem->ptr = ptr;
-        mem->calladdr = call;
-        //The same calling code will usually allocate the same size. *But not necessarily*
-        //Not for precise accounting (Don't want to use up too many resources for accounting).
-        mem->size = size*nmemb; 
-        mem->bt_size = get_backtrace(mem->bt);
-        hash_table_insert_safe_i( _milu_htable, &mem->hentry, 
-                (const uintptr_t)ptr, sizeof(uintptr_t) );
-
-#ifdef _VERBOSE
-        record_malloc(ptr, size*nmemb);
-#endif
-
-        stats.alloc++;
-        stats.active_alloc++;
-        stats.reserved += size*nmemb;
-        stats.active_reserved += size*nmemb;
+        _record_alloc( ptr, size*nmemb, call );
     }
+    _in_milu = 0;
+
     /* whatever we got to do with the ptr */
     return ptr;
 }
@@ -285,187 +550,352 @@ void * realloc(void * ptr, size_t size)
     void * nptr = NULL;
     uintptr_t call = 0;
 
-    struct memalloc * mem = NULL, * mem_old = NULL;
-    struct hash_entry * entry = NULL;
+    struct memalloc * mem_old = NULL;
 
+    //milu allocating for itself.
+    if(unlikely(_in_milu))
+    {
+        return _realloc(ptr, size);
+    }
+
+    _in_milu = 1;
     //we want to avoid locking in the main critical path.
-    if(unlikely(!milu_enabled))
+    if(unlikely(!milu_initialized))
     {
-        pthread_mutex_lock( &init_mutex );
-        milu_enabled = init_milu();
-        pthread_mutex_unlock( &init_mutex );
+        _milu_init();
+    }
+
+    /*
+     * Stop tracking the old pointer first: once realloc() lets go of it,
+     * another thread may get the same address back from malloc().
+     */
+    if(likely(milu_enabled) && ptr)
+    {
+        mem_old = _untrack_alloc( ptr );
     }
 
     nptr = _realloc(ptr, size);
-    if(!nptr)
+    if(!nptr && size)
     {
+        //realloc() failed, @ptr is still good.
+        if(mem_old)
+        {
+            _track_alloc( mem_old, ptr );
+        }
+        _in_milu = 0;
         return NULL;
     }
 
-
     if(likely(milu_enabled))
     {
         call = calladdr();
 
-        //look for the entry...
-        entry = hash_table_del_key_safe_i( _milu_htable, 
-                (const uintptr_t)ptr, sizeof(uintptr_t) );
-        if( likely(!!entry) )
-        {
-            mem_old = hash_entry(entry, struct memalloc, hentry);
-        }
-
-#ifdef _POOLING
-        if(!(mem = (struct memalloc *)bank_get_ptr(_milu_pools))) {
-            //ERROR
-        }
-#else
-        //create a memalloc struct, init, and put in hashtable
-        if(!(mem = (struct memalloc *) _malloc(sizeof(struct memalloc))))
-        {
-            //ERROR
-        }
-#endif
-
-        //initialize struct fields.
-        mem->ptr = nptr; 
-        mem->calladdr = call;
-        mem->size = size; 
-        mem->bt_size = get_backtrace(mem->bt);
-        hash_table_insert_safe_i( _milu_htable, &mem->hentry,
-                (const uintptr_t)nptr, sizeof(uintptr_t) );
-
 #ifdef _VERBOSE
         if(mem_old)
         {
             record_free( mem_old->size, mem_old->ptr);
         }
-        record_malloc(nptr, size);
 #endif
 
         //alloc is not increased because this is a REALLOC.
-        //we need to get the old_size from the hash table...
         if(mem_old)
         {
-            stats.reserved -= mem_old->size;
-            stats.active_reserved -= mem_old->size;
+            __sync_fetch_and_sub(&stats.reserved, mem_old->size);
+            __sync_fetch_and_sub(&stats.active_reserved, mem_old->size);
+            __sync_fetch_and_sub(&stats.active_alloc, 1);
+            if(nptr)
+            {
+                __sync_fetch_and_sub(&stats.alloc, 1);
+            }
 
             //cleanup
-            _free(mem_old->bt);
-            _free(mem_old);
+            _release_memalloc(mem_old);
         }
-        stats.reserved += size;
-        stats.active_reserved += size;
 
-        // we need to update ptr and size in hashtable...
+        if(nptr)
+        {
+            _record_alloc( nptr, size, call );
+        }
     }
+    _in_milu = 0;
+
     return nptr;
 }
 
 void free(void * ptr)
 {
-    struct hash_entry * entry = NULL;
     struct memalloc * mem = NULL;
 
-    //we want to avoid locking in the main critical path.
-    if(unlikely(!milu_enabled))
+    if(unlikely(!ptr || _boot_ptr(ptr)))
     {
-        pthread_mutex_lock( &init_mutex );
-        milu_enabled = init_milu();
-        pthread_mutex_unlock( &init_mutex );
+        return;
     }
 
+    //milu freeing its own stuff, or nothing was ever tracked.
+    if(unlikely(_in_milu || !milu_enabled))
+    {
+        _free(ptr);
+        return;
+    }
 
-    if(likely(milu_enabled))
+    _in_milu = 1;
+
+    //here we do things differently... to protect against double free's or
+    //unallocated memory frees we first look for the ptr in the hashtable..
+    //Pointers we never saw (allocated before milu was up, or on its behalf)
+    //simply go back to libc.
+    mem = _untrack_alloc( ptr );
+    if( likely(!!mem) )
+    {
+        __sync_fetch_and_sub(&stats.active_alloc, 1);
+        __sync_fetch_and_sub(&stats.active_reserved, mem->size);
+
+#ifdef _VERBOSE
+        record_free(mem->size, ptr);
+#endif
+        _release_memalloc(mem);
+    }
+
+    _free(ptr); //this will fail here if we get a bad ptr. "No problem".
+    _in_milu = 0;
+    return;
+}
+
+static void _report_alloc(struct memalloc * mem)
+{
+    uint32_t i = 0;
+
+    fprintf( stdout, "Allocation made at %" PRIuPTR " for %ld bytes\n", mem->calladdr, mem->size );
+    fprintf( stdout, "Unallocation ptr to heap address: %p\n", mem->ptr );
+    for( i=0 ; i<mem->bt_size ; i++)
     {
-        //here we do things differently... to protect against double free's or
-        //unallocated memory frees we first look for the ptr in the hashtable..
+        fprintf( stdout, "[FRAME %d] %s\n", i, mem->bt[i] );
+    }
+
+    fprintf( stdout, "\n\n");
+}
+
+#if !defined(_PTRTBL) && !defined(_INTTBL)
+/* tracking table stats, all shards together (MILU_STATS) */
+static void _report_stats(void)
+{
+    struct hash_table_stats st, all;
+    unsigned int s = 0, b = 0;
+    unsigned int hot_shard = 0;
 
-        //look for the entry...
-        entry = hash_table_del_key_safe_i( _milu_htable, 
-                (const uintptr_t)ptr, sizeof(uintptr_t) );
-        if( unlikely(!entry) )
+    memset( &all, 0, sizeof(all) );
+    for( s=0 ; s<_milu_nshards ; s++ )
+    {
+        hash_table_get_stats( &_milu_htable[s], &st );
+        for( b=0 ; b<HASH_STATS_CHAIN_BINS ; b++ )
+            all.chains[b] += st.chains[b];
+        if(st.max_chain > all.max_chain)
+            all.max_chain = st.max_chain;
+        all.lookups += st.lookups;
+        all.probes += st.probes;
+        if(st.max_probes > all.max_probes)
+            all.max_probes = st.max_probes;
+        all.resizes += st.resizes;
+        all.resize_ns += st.resize_ns;
+        all.lock_acquires += st.lock_acquires;
+        all.lock_contended += st.lock_contended;
+        if(st.hot_contended > all.hot_contended)
         {
-            mem_report();
-            //clean up hashtable, milu...
-            milu_cleanup();
+            all.hot_contended = st.hot_contended;
+            all.hot_stripe = st.hot_stripe;
+            hot_shard = s;
         }
-        else
-        {
-            mem = hash_entry( entry, struct memalloc, hentry );
-            stats.active_alloc--;
-            stats.active_reserved -= mem->size;
+    }
 
-#ifdef _VERBOSE
-            record_free(mem->size, ptr);
+    fprintf( stdout, "Chain lengths:" );
+    for( b=0 ; b<HASH_STATS_CHAIN_BINS ; b++ )
+    {
+        if(all.chains[b])
+            fprintf( stdout, " %u%s:%zu", b,
+                    (b == HASH_STATS_CHAIN_BINS - 1 ? "+" : ""), all.chains[b] );
+    }
+    fprintf( stdout, " (longest %zu)\n", all.max_chain );
+    fprintf( stdout, "Lookups: %" PRIu64 ", %.2f probes avg, %" PRIu64 " max\n",
+            all.lookups,
+            (all.lookups ? (double)all.probes / all.lookups : 0.0),
+            all.max_probes );
+    fprintf( stdout, "Resizes: %" PRIu64 ", %.3f ms\n",
+            all.resizes, all.resize_ns / 1e6 );
+    fprintf( stdout, "Lock contention: %" PRIu64 " of %" PRIu64
+            " (hottest: shard %u stripe %u, %u)\n",
+            all.lock_contended, all.lock_acquires,
+            hot_shard, all.hot_stripe, all.hot_contended );
+}
 #endif
-        }
 
+/* how full each tracking table is */
+static void _report_shards(void)
+{
+    unsigned int s = 0;
+#ifdef _PTRTBL
+    struct ptr_table * t = NULL;
+
+    for( s=0 ; s<_milu_nshards ; s++ )
+    {
+        t = &_milu_ptable[s];
+        fprintf( stdout, "Shard %u: %zu entries, %zu slots\n",
+                s, t->_nentries, t->capacity );
+    }
+#elif defined(_INTTBL)
+    struct int_table * t = NULL;
+    struct hash_table_mem hmem;
+    size_t mem = 0;
 
-        if (likely(!!mem)) {
-            _free(mem->bt);
-#ifdef _PPOLING
-            bank_put_ptr(_milu_pools, (void *)mem);
+    for( s=0 ; s<_milu_nshards ; s++ )
+    {
+        t = &_milu_itable[s];
+        int_table_mem_usage( t, &hmem );
+        mem += hmem.buckets + hmem.locks;
+        fprintf( stdout, "Shard %u: %zu entries, %zu/%zu buckets used\n",
+                s, t->_nentries, t->_used_buckets, t->buckets );
+    }
+    fprintf( stdout, "Tracking Table Memory: %zu\n", mem );
 #else
-            _free(mem);
-#endif
-        }
+    struct hash_table * t = NULL;
+    struct hash_table_mem hmem;
+    size_t mem = 0, saved = 0;
+
+    for( s=0 ; s<_milu_nshards ; s++ )
+    {
+        t = &_milu_htable[s];
+        hash_table_mem_usage( t, &hmem );
+        mem += hmem.buckets + hmem.locks;
+        saved += hmem.saved;
+        fprintf( stdout, "Shard %u: %zu entries, %zu/%zu buckets used\n",
+                s, t->_nentries, t->_used_buckets, t->buckets );
     }
+    fprintf( stdout, "Tracking Table Memory: %zu (%zu saved on bucket locks)\n",
+            mem, saved );
+    if(_milu_stats)
+        _report_stats();
+#endif
+}
 
-    _free(ptr); //this will fail here if we get a bad ptr. "No problem".
-    return;
+#if !defined(_PTRTBL) && !defined(_INTTBL)
+static unsigned int _milu_walkers(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(n < 1)
+        return 1;
+    return (n > MILU_MAX_WALKERS ? MILU_MAX_WALKERS : (unsigned int)n);
 }
 
+/*
+ * hash_table_parallel_for_each() callback. Walkers are threads of our
+ * own, whatever they allocate mustn't end up in the table being walked.
+ */
+static void _cleanup_entry(struct hash_entry * entry, void * arg)
+{
+    struct memalloc * mem = hash_entry( entry, struct memalloc, hentry );
+
+    _in_milu = 1;
+    hash_table_del_hash_entry( (struct hash_table *)arg, entry );
+    _release_memalloc(mem);
+}
+#endif
+
 void mem_report(void)
 {
-    uint32_t i = 0;
-    struct memalloc * mem = NULL;
+    unsigned int s = 0;
+#ifdef _PTRTBL
+    size_t i = 0;
+    struct ptr_slot * slot = NULL;
+#elif defined(_INTTBL)
+    size_t i = 0;
+    struct int_entry * entry = NULL;
+    struct int_entry * next = NULL;
+#else
+    struct hash_table_iter it;
     struct hash_entry * entry = NULL;
-    struct list_head * lh = NULL;
-    struct list_head * laux = NULL;
+#endif
 
     fprintf( stdout, "Total Allocations:%" PRIu64 "\n", stats.alloc );
     fprintf( stdout, "Unfreed Allocations:%" PRIu64 "\n", stats.active_alloc );
     fprintf( stdout, "Total Memory Reserved: %" PRIu64 "\n", stats.reserved );
     fprintf( stdout, "Total Unfreed Memory: %" PRIu64 "\n", stats.active_reserved );
+    _report_shards();
 
     //Traverse hash table showing existing leaks.
     fprintf( stdout, "\n\nMemory Leaks Found: SUMMARY\n\n" );
-    hash_table_for_each_safe( entry, _milu_htable, lh, laux, i ) {
-        mem = hash_entry( entry, struct memalloc, hentry );
-
-        fprintf( stdout, "Allocation made at %" PRIuPTR " for %ld bytes\n", mem->calladdr, mem->size );
-        fprintf( stdout, "Unallocation ptr to heap address: %p\n", mem->ptr );
-        for( i=0 ; i<mem->bt_size ; i++)
-        {
-            fprintf( stdout, "[FRAME %d] %s\n", i, mem->bt[i] );
+    for( s=0 ; s<_milu_nshards ; s++ )
+    {
+#ifdef _PTRTBL
+        ptr_table_for_each( slot, &_milu_ptable[s], i ) {
+            _report_alloc( (struct memalloc *)slot->val );
         }
-
-        fprintf( stdout, "\n\n");
+#elif defined(_INTTBL)
+        int_table_finish_resize( &_milu_itable[s] );
+        int_table_for_each_safe( entry, &_milu_itable[s], next, i ) {
+            _report_alloc( list_entry( entry, struct memalloc, ientry ) );
+        }
+#else
+        //one walker: the leaks come out in bucket order, run after run.
+        hash_table_finish_resize( &_milu_htable[s] );
+        hash_table_for_each( entry, &_milu_htable[s], it ) {
+            _report_alloc( hash_entry( entry, struct memalloc, hentry ) );
+        }
+#endif
     }
 }
 
 
 void milu_cleanup(void)
 {
-    uint32_t i = 0;
+    unsigned int s = 0;
+#ifdef _PTRTBL
     struct memalloc * mem = NULL;
-    struct hash_entry * entry = NULL;
-    struct list_head  * lh = NULL;
-    struct list_head  * laux = NULL;
+    size_t i = 0;
+    struct ptr_slot * slot = NULL;
+#elif defined(_INTTBL)
+    struct memalloc * mem = NULL;
+    size_t i = 0;
+    struct int_entry * entry = NULL;
+    struct int_entry * next = NULL;
+#else
+    unsigned int walkers = _milu_walkers();
+#endif
 
 
     //clean this mess up ;)
-    hash_table_for_each_safe( entry, _milu_htable, lh, laux, i ) {
-        mem = hash_entry( entry, struct memalloc, hentry );
-        hash_table_del_hash_entry( _milu_htable, entry );
-        _free(mem->bt);
-        _free(mem);
+    for( s=0 ; s<_milu_nshards ; s++ )
+    {
+#ifdef _PTRTBL
+        ptr_table_for_each( slot, &_milu_ptable[s], i ) {
+            mem = (struct memalloc *)slot->val;
+            slot->key = 0;
+            slot->val = NULL;
+            _release_memalloc(mem);
+        }
+        _milu_ptable[s]._nentries = 0;
+#elif defined(_INTTBL)
+        int_table_finish_resize( &_milu_itable[s] );
+        int_table_for_each_safe( entry, &_milu_itable[s], next, i ) {
+            mem = list_entry( entry, struct memalloc, ientry );
+            int_table_del( &_milu_itable[s], entry->key );
+            _release_memalloc(mem);
+        }
+#else
+        hash_table_finish_resize( &_milu_htable[s] );
+        hash_table_parallel_for_each( &_milu_htable[s], walkers,
+                _cleanup_entry, &_milu_htable[s] );
+#endif
     }
 }
 
 void __attribute__ ((destructor)) memchk_stats(void) 
 {
+    //nothing was ever tracked.
+    if(!milu_enabled)
+        return;
+
+    _in_milu = 1;
     mem_report();
     milu_cleanup();
+    _in_milu = 0;
 }
@@ -0,0 +1,207 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "hash/hash.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define _HASH_HAVE_CRC32C 1
+#endif
+
+static const uint64_t _str_secret[4] = {
+    0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+    0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+/* high and low halves of the 128 bit product, xored */
+static inline uint64_t _str_mix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+/* unaligned little endian reads, memcpy() compiles to a plain load */
+static inline uint64_t _str_r8(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t _str_r4(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* 1 to 3 bytes: first, middle and last */
+static inline uint64_t _str_r3(const uint8_t *p, size_t k)
+{
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+/* up to 16 bytes into @a and @b, overlapping reads instead of a loop */
+static inline void _str_short(const uint8_t *p, size_t len,
+        uint64_t *a, uint64_t *b)
+{
+    if(len >= 4)
+    {
+        *a = (_str_r4(p) << 32) | _str_r4(p + ((len >> 3) << 2));
+        *b = (_str_r4(p + len - 4) << 32) | _str_r4(p + len - 4 - ((len >> 3) << 2));
+    } else if(len) {
+        *a = _str_r3(p, len);
+        *b = 0;
+    } else {
+        *a = *b = 0;
+    }
+}
+
+static inline size_t _str_final(uint64_t a, uint64_t b, uint64_t seed,
+        size_t len)
+{
+    __uint128_t r;
+
+    a ^= _str_secret[1];
+    b ^= seed;
+    r = (__uint128_t)a * b;
+    return (size_t)_str_mix((uint64_t)r ^ _str_secret[0] ^ len,
+            (uint64_t)(r >> 64) ^ _str_secret[1]);
+}
+
+size_t hash_str_portable(const void *key, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    uint64_t seed = _str_mix(_str_secret[0], _str_secret[1]);
+    uint64_t see1, see2, a, b;
+    size_t i = len;
+
+    if(len <= 16)
+    {
+        _str_short(p, len, &a, &b);
+        return _str_final(a, b, seed, len);
+    }
+
+    //three independent lanes hide the multiply latency.
+    if(i > 48)
+    {
+        see1 = see2 = seed;
+        do {
+            seed = _str_mix(_str_r8(p) ^ _str_secret[1], _str_r8(p + 8) ^ seed);
+            see1 = _str_mix(_str_r8(p + 16) ^ _str_secret[2], _str_r8(p + 24) ^ see1);
+            see2 = _str_mix(_str_r8(p + 32) ^ _str_secret[3], _str_r8(p + 40) ^ see2);
+            p += 48;
+            i -= 48;
+        } while(i > 48);
+        seed ^= see1 ^ see2;
+    }
+    while(i > 16)
+    {
+        seed = _str_mix(_str_r8(p) ^ _str_secret[1], _str_r8(p + 8) ^ seed);
+        p += 16;
+        i -= 16;
+    }
+
+    //the last 16 bytes, overlapping what came before if need be.
+    return _str_final(_str_r8(p + i - 16), _str_r8(p + i - 8), seed, len);
+}
+
+#ifdef _HASH_HAVE_CRC32C
+__attribute__((target("sse4.2")))
+static size_t _hash_str_crc32c(const void *key, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)key;
+    uint64_t c[4] = { _str_secret[0], _str_secret[1],
+        _str_secret[2], _str_secret[3] };
+    size_t i = len;
+    unsigned int k = 0;
+
+    if(len <= 16)
+        return hash_str_portable(key, len);
+
+    //crc32 has a latency of 3 and a throughput of 1: keep 4 in flight.
+    while(i > 32)
+    {
+        c[0] = _mm_crc32_u64(c[0], _str_r8(p));
+        c[1] = _mm_crc32_u64(c[1], _str_r8(p + 8));
+        c[2] = _mm_crc32_u64(c[2], _str_r8(p + 16));
+        c[3] = _mm_crc32_u64(c[3], _str_r8(p + 24));
+        p += 32;
+        i -= 32;
+    }
+    while(i > 8)
+    {
+        c[k] = _mm_crc32_u64(c[k], _str_r8(p));
+        k = (k + 1) & 3;
+        p += 8;
+        i -= 8;
+    }
+    //the last 8 bytes, overlapping what came before if need be.
+    c[k] = _mm_crc32_u64(c[k], _str_r8(p + i - 8));
+
+    return (size_t)_str_mix((c[0] << 32 | c[1]) ^ _str_secret[0] ^ len,
+            (c[2] << 32 | c[3]) ^ _str_secret[1]);
+}
+
+static int _crc32c_supported(void)
+{
+    //may run before constructors (e.g. from within malloc()).
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#endif
+
+size_t hash_str_crc32c(const void *key, size_t len)
+{
+#ifdef _HASH_HAVE_CRC32C
+    static int supported = -1;
+    int s = __atomic_load_n(&supported, __ATOMIC_RELAXED);
+
+    //racing threads all store the same answer.
+    if(s < 0)
+    {
+        s = _crc32c_supported();
+        __atomic_store_n(&supported, s, __ATOMIC_RELAXED);
+    }
+    if(s)
+        return _hash_str_crc32c(key, len);
+#endif
+    return hash_str_portable(key, len);
+}
+
+static size_t _hash_str_pick(const void *key, size_t len);
+
+/* set on the first call, every thread ends up with the same pick */
+static size_t (* _hash_str)(const void *, size_t) = _hash_str_pick;
+
+static size_t _hash_str_pick(const void *key, size_t len)
+{
+    size_t (* fn)(const void *, size_t) = hash_str_portable;
+
+#if defined(_HASH_HAVE_CRC32C) && defined(HASH_STR_CRC32C)
+    if(_crc32c_supported())
+        fn = _hash_str_crc32c;
+#endif
+    __atomic_store_n(&_hash_str, fn, __ATOMIC_RELAXED);
+
+    return fn(key, len);
+}
+
+size_t hash_str(const void *key, size_t len)
+{
+    return __atomic_load_n(&_hash_str, __ATOMIC_RELAXED)(key, len);
+}
+
+int hash_str_accelerated(void)
+{
+    if(__atomic_load_n(&_hash_str, __ATOMIC_RELAXED) == _hash_str_pick)
+        hash_str("", 0);
+#ifdef _HASH_HAVE_CRC32C
+    return (__atomic_load_n(&_hash_str, __ATOMIC_RELAXED) == _hash_str_crc32c);
+#else
+    return 0;
+#endif
+}
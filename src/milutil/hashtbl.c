@@ -1,16 +1,823 @@
 #include <stdlib.h>
+#include <sched.h>
+#include <time.h>
 
 #include "hashtbl/hashtbl.h"
 
-static int hash_table_resize(struct hash_table *h);
+/*
+ * The bucket array a resize swaps in is left uninitialized: new buckets
+ * 2i and 2i+1 are set up when old bucket i is moved, and nobody gets to
+ * them before that (see hash_table_lock_hv()).
+ */
+
+static hash_table_allocator _h_allocator = malloc;
+static hash_table_deallocator _h_deallocator = free;
+
+#ifndef _HASH_BATCH
+#define _HASH_BATCH 16 /* keys in flight in the batch calls */
+#endif
+
+#ifndef _HASH_LOCKLESS_TRIES
+#define _HASH_LOCKLESS_TRIES 8 /* lockless lookup attempts before locking */
+#endif
+
+/* see hash_table_stats_enable(), updated atomically */
+struct hash_table_counters {
+    uint64_t lookups;
+    uint64_t probes;
+    uint64_t max_probes;
+    uint64_t resizes;
+    uint64_t resize_ns;
+    uint64_t resize_start;
+    uint64_t lock_acquires;
+    uint64_t lock_contended;
+};
+
+static inline uint64_t hash_table_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* a key search looked at @probes entries */
+static void hash_table_note_probes(struct hash_table_counters *c,
+        uint64_t probes)
+{
+    uint64_t max = __atomic_load_n(&c->max_probes, __ATOMIC_RELAXED);
+
+    __sync_fetch_and_add(&c->lookups, 1);
+    __sync_fetch_and_add(&c->probes, probes);
+    while(probes > max && !__atomic_compare_exchange_n(&c->max_probes,
+                &max, probes, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* stripe locks count the times they had to wait, with stats on */
+static inline void hash_stripe_lock(const struct hash_table *h,
+        struct hash_lock_stripe *s)
+{
+    if(h->_stats)
+    {
+        __sync_fetch_and_add(&h->_stats->lock_acquires, 1);
+        if(!pthread_mutex_trylock(&s->lock))
+            return;
+        __sync_fetch_and_add(&h->_stats->lock_contended, 1);
+        __sync_fetch_and_add(&s->contended, 1);
+    }
+    pthread_mutex_lock(&s->lock);
+}
+
+/* reader slot of the calling thread, handed out on first use */
+static unsigned int _reader_next;
+static __thread unsigned int _reader_slot __attribute__((tls_model("initial-exec")));
+
+/* the bucket arrays an operation works on, see hash_table_view_safe() */
+struct hash_table_view {
+    unsigned int gen;
+    struct list_head *table;
+    unsigned int bits;
+    struct list_head *old_table;
+    unsigned int old_bits;
+};
+
+static struct list_head *hash_bucket_array_alloc(unsigned int bits, int init)
+{
+    struct list_head *table;
+    size_t n = (size_t)1 << bits;
+    size_t i;
+
+    if(!(table = (struct list_head *)_h_allocator(n * sizeof(struct list_head))))
+        return NULL;
+
+    for( i=0 ; init && i<n ; i++ )
+        INIT_LIST_HEAD(&table[i]);
+
+    return table;
+}
+
+static int hash_table_alloc_stripes(struct hash_table *h, unsigned int sbits)
+{
+    size_t n = (size_t)1 << sbits;
+    size_t i;
+
+    //the allocator hook is malloc-like, align the stripes by hand.
+    if(!(h->_stripes_mem = _h_allocator((n + 1) * sizeof(struct hash_lock_stripe) +
+                    HASH_TABLE_READER_SLOTS * sizeof(struct hash_reader_slot))))
+        return -1;
+
+    h->_stripes = (struct hash_lock_stripe *)
+        (((uintptr_t)h->_stripes_mem + HASH_TABLE_CACHELINE - 1) &
+         ~(uintptr_t)(HASH_TABLE_CACHELINE - 1));
+    h->_readers = (struct hash_reader_slot *)(h->_stripes + n);
+    h->_sbits = sbits;
+    for( i=0 ; i<n ; i++ )
+    {
+        pthread_mutex_init(&h->_stripes[i].lock, NULL);
+        h->_stripes[i].seq = 0;
+        h->_stripes[i].contended = 0;
+    }
+    for( i=0 ; i<HASH_TABLE_READER_SLOTS ; i++ )
+        h->_readers[i].active = 0;
+
+    return 0;
+}
+
+int hash_table_init_stripes(struct hash_table *h, unsigned int b,
+        keycmp_ptr keycmp, __hash hash_fn, unsigned int stripes)
+{
+    unsigned int bits = 0;
+    unsigned int sbits = 1;
+    size_t hashtblsz = 0;
+
+    pthread_mutex_init(&(h->lock), NULL);
+
+    /* Lets decide the REAL hash table size: next power of two */
+    hashtblsz = (size_t) roundf((float)b/_LOAD_FACTOR);
+    bits = HASH_TABLE_MIN_BITS;
+    while( bits < HASH_TABLE_MAX_BITS && ((size_t)1 << bits) < hashtblsz )
+        bits++;
+
+    //stripes follow the top bits of the bucket index, can't have more.
+    while( sbits < bits && ((size_t)1 << sbits) < stripes )
+        sbits++;
+
+    h->table = NULL;
+    h->buckets = 0;
+    h->_hbits = bits;
+    h->_stripes = NULL;
+    h->_readers = NULL;
+    h->_stripes_mem = NULL;
+    h->_sbits = 0;
+    h->_used_buckets = 0;
+    h->_nentries = 0;
+    h->_factor = _LOAD_FACTOR; //hard coded for now.
+    h->_resize_threshold = b;
+    h->_shrink_factor = _SHRINK_FACTOR;
+    h->_shrink_threshold = 0; //never below the size we start at
+    h->_min_hbits = bits;
+
+    h->_old_table = NULL;
+    h->_old_buckets = 0;
+    h->_old_hbits = 0;
+    h->_migrate = 0;
+    h->_migrated = 0;
+    h->_seq = 0;
+    h->_keys = NULL;
+    h->_stats = NULL;
+
+    h->keycmp = (keycmp ? keycmp : memcmp);
+
+    if (hash_fn)
+        h->my_hash_fn = hash_fn;
+    else
+        return -1;
+
+    if (hash_table_alloc_stripes(h, sbits))
+        return -1;
+
+    if ((h->table = hash_bucket_array_alloc(bits, 1)) == NULL)
+        return -1;
+    h->buckets = (size_t)1 << bits;
+
+    return 0;
+}
+
+int hash_table_init(struct hash_table *h, unsigned int b,
+        keycmp_ptr keycmp, __hash hash_fn)
+{
+    return hash_table_init_stripes(h, b, keycmp, hash_fn,
+            HASH_TABLE_LOCK_STRIPES);
+}
+
+void hash_table_finit(struct hash_table *h)
+{
+    struct hash_key_chunk *c;
+    size_t i;
+
+    //new buckets are only set up as the old ones move. the resize under
+    //way is finished, no shrink is started for an array about to go.
+    h->_shrink_threshold = 0;
+    if (h->_old_table)
+        hash_table_finish_resize(h);
+
+    if (h->table)
+        _h_deallocator(h->table);
+
+    if (h->_stripes_mem)
+    {
+        for( i=0 ; i < ((size_t)1 << h->_sbits) ; i++ )
+            pthread_mutex_destroy(&h->_stripes[i].lock);
+        _h_deallocator(h->_stripes_mem);
+    }
+
+    while ((c = h->_keys))
+    {
+        h->_keys = c->next;
+        _h_deallocator(c);
+    }
+
+    if (h->_stats)
+        _h_deallocator(h->_stats);
+    h->_stats = NULL;
+
+    h->table = NULL;
+    h->_stripes = NULL;
+    h->_readers = NULL;
+    h->_stripes_mem = NULL;
+    h->buckets = 0;
+}
+
+void hash_table_mem_usage(struct hash_table *h, struct hash_table_mem *m)
+{
+    struct hash_key_chunk *c;
+    size_t buckets;
+    unsigned int seq;
+
+    do {
+        seq = hash_table_read_begin(h);
+        buckets = h->buckets + h->_old_buckets;
+    } while(hash_table_read_retry(h, seq));
+
+    m->buckets = buckets * sizeof(struct list_head);
+    m->locks = ((size_t)1 << h->_sbits) * sizeof(struct hash_lock_stripe) +
+        HASH_TABLE_READER_SLOTS * sizeof(struct hash_reader_slot);
+    m->bucket_locks = buckets * sizeof(pthread_mutex_t);
+    m->saved = (m->bucket_locks > m->locks ? m->bucket_locks - m->locks : 0);
+
+    m->keys = 0;
+    pthread_mutex_lock(&h->lock);
+    for( c=h->_keys ; c ; c=c->next )
+        m->keys += sizeof(struct hash_key_chunk) + c->size;
+    pthread_mutex_unlock(&h->lock);
+}
+
+/* hash_table_key_alloc()
+ * @h: &struct hash_table
+ * @len: bytes needed
+ * Description: carves room for a key from the arena of @h, lock free
+ *              unless the current chunk is full. keys longer than a
+ *              quarter chunk get a chunk of their own.
+ * Returns: the room, NULL if the allocator failed.
+ */
+static void *hash_table_key_alloc(struct hash_table *h, size_t len)
+{
+    struct hash_key_chunk *c, *n;
+    size_t off;
+
+    for(;;)
+    {
+        c = *(struct hash_key_chunk * volatile *)&h->_keys;
+        if(c && len <= HASH_KEY_CHUNK / 4)
+        {
+            off = __sync_fetch_and_add(&c->used, len);
+            if(off + len <= c->size)
+                return &c->data[off];
+        }
+
+        pthread_mutex_lock(&h->lock);
+        if(len > HASH_KEY_CHUNK / 4)
+        {
+            //behind the current chunk, it may still have room.
+            if((n = (struct hash_key_chunk *)_h_allocator(sizeof(*n) + len)))
+            {
+                n->size = n->used = len;
+                if(h->_keys)
+                {
+                    n->next = h->_keys->next;
+                    h->_keys->next = n;
+                } else {
+                    n->next = NULL;
+                    h->_keys = n;
+                }
+            }
+            pthread_mutex_unlock(&h->lock);
+            return (n ? n->data : NULL);
+        }
+        if(c == h->_keys)
+        {
+            if(!(n = (struct hash_key_chunk *)_h_allocator(sizeof(*n) +
+                            HASH_KEY_CHUNK)))
+            {
+                pthread_mutex_unlock(&h->lock);
+                return NULL;
+            }
+            n->size = HASH_KEY_CHUNK;
+            n->used = 0;
+            n->next = c;
+            __sync_synchronize();
+            h->_keys = n;
+        }
+        pthread_mutex_unlock(&h->lock);
+    }
+}
+
+/* sets @e up with a copy of string @key, see struct hash_entry */
+static inline void hash_table_entry_init_s(struct hash_table *h,
+        struct hash_entry *e, const char *key, size_t len)
+{
+    if(!key || !(e->key = hash_table_key_alloc(h, len)))
+    {
+        hash_entry_init(e, (const void *)key, len, 1);
+        return;
+    }
+
+    INIT_LIST_HEAD(&(e->list));
+    e->_skey = HASH_KEY_ARENA;
+    memcpy(e->key, key, len);
+    e->klen = len;
+}
+
+static inline void __hash_table_view(const struct hash_table *h,
+        struct hash_table_view *v)
+{
+    v->gen = h->_seq;
+    v->table = h->table;
+    v->bits = h->_hbits;
+    v->old_table = h->_old_table;
+    v->old_bits = h->_old_hbits;
+}
+
+/* lockless snapshot, see hash_table_read_begin() */
+static inline void hash_table_view_safe(struct hash_table *h,
+        struct hash_table_view *v)
+{
+    unsigned int seq;
+
+    do {
+        seq = hash_table_read_begin(h);
+        __hash_table_view(h, v);
+        v->gen = seq;
+    } while(hash_table_read_retry(h, seq));
+}
+
+/* true if no resize started or finished since @v was taken */
+static inline int hash_table_view_valid(struct hash_table *h,
+        const struct hash_table_view *v)
+{
+    return (__atomic_load_n(&h->_seq, __ATOMIC_ACQUIRE) == v->gen);
+}
+
+/* bucket array updates, t->lock held */
+static inline void hash_table_write_begin(struct hash_table *h)
+{
+    __atomic_store_n(&h->_seq, h->_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void hash_table_write_end(struct hash_table *h)
+{
+    __atomic_store_n(&h->_seq, h->_seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Chains under a stripe only change between hash_stripe_write_begin() and
+ * hash_stripe_write_end(), with the stripe locked. Lockless readers check
+ * the count did not move while they walked, same as with t->_seq.
+ */
+static inline void hash_stripe_write_begin(struct hash_lock_stripe *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void hash_stripe_write_end(struct hash_lock_stripe *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline unsigned int hash_stripe_read_begin(const struct hash_lock_stripe *s)
+{
+    unsigned int seq;
+
+    while((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1)
+        hash_table_cpu_relax();
+    return seq;
+}
+
+static inline int hash_stripe_read_retry(const struct hash_lock_stripe *s,
+        unsigned int seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq);
+}
+
+static inline struct hash_reader_slot *hash_table_reader(struct hash_table *h)
+{
+    if(!_reader_slot)
+        _reader_slot = __sync_add_and_fetch(&_reader_next, 1);
+    return &h->_readers[_reader_slot & (HASH_TABLE_READER_SLOTS - 1)];
+}
+
+/*
+ * Locks stripe @s. Retries until it was taken under the table layout in
+ * @v, that layout can't go away while we hold it (see
+ * hash_table_migrate_done()).
+ */
+static struct hash_lock_stripe *hash_table_lock_stripe(struct hash_table *h,
+        unsigned int s, struct hash_table_view *v)
+{
+    struct hash_lock_stripe *stripe = &h->_stripes[s];
+
+    for(;;)
+    {
+        hash_table_view_safe(h, v);
+
+        hash_stripe_lock(h, stripe);
+        if(hash_table_view_valid(h, v))
+            break;
+        pthread_mutex_unlock(&stripe->lock);
+    }
+
+    return stripe;
+}
+
+/*
+ * The bucket folded hash @hv lives in under @v, its stripe held: while
+ * resizing, the old bucket until it has been moved, the current one after
+ * that. @current is cleared for an old bucket.
+ */
+static inline struct list_head *hash_table_view_head(
+        const struct hash_table_view *v, uint32_t hv, int *current)
+{
+    struct list_head *head;
+
+    *current = 1;
+    if(v->old_table)
+    {
+        head = &v->old_table[hash_table_bucket_of_fold(hv, v->old_bits)];
+        if(!hash_bucket_moved(head))
+        {
+            *current = 0;
+            return head;
+        }
+    }
+    return &v->table[hash_table_bucket_of_fold(hv, v->bits)];
+}
+
+/*
+ * Locks the stripe @hv falls in and finds its bucket, see above.
+ * Returns the stripe to unlock.
+ */
+static struct hash_lock_stripe *hash_table_lock_hv(struct hash_table *h,
+        uint32_t hv, struct hash_table_view *v, struct list_head **head,
+        int *current)
+{
+    struct hash_lock_stripe *stripe;
+
+    stripe = hash_table_lock_stripe(h, hash_table_bucket_of_fold(hv, h->_sbits), v);
+    *head = hash_table_view_head(v, hv, current);
+
+    return stripe;
+}
+
+/*
+ * Bucket @head must be locked (or the table private) while linking/unlinking.
+ * Counters are shared by all buckets, hence the atomic updates.
+ * _used_buckets only counts buckets of the current array.
+ */
+static inline void __hash_table_link(struct hash_table *h,
+        struct hash_entry *e, struct list_head *head, int current)
+{
+    if(current && list_empty(head))
+        __sync_fetch_and_add(&h->_used_buckets, 1);
+    list_add(&(e->list), head);
+    __sync_fetch_and_add(&h->_nentries, 1);
+}
+
+static inline void __hash_table_unlink(struct hash_table *h,
+        struct hash_entry *e, int current)
+{
+    //last entry in the bucket: next and prev are the bucket head.
+    if(current && e->list.next == e->list.prev)
+        __sync_fetch_and_sub(&h->_used_buckets, 1);
+    list_del_init(&(e->list));
+    __sync_fetch_and_sub(&h->_nentries, 1);
+}
+
+/* entries whose folded hash @hv differs can't match, skip keycmp for them */
+static inline struct hash_entry *__hash_table_find(const struct hash_table *h,
+        struct list_head *head, uint32_t hv, const void *key, size_t len)
+{
+    struct hash_entry *tmp;
+    struct list_head *pos;
+    uint64_t probes = 0;
+
+    list_for_each(pos, head)
+    {
+        tmp = list_entry(pos, struct hash_entry, list);
+        probes++;
+
+        if ((tmp->_hash == hv) && (tmp->klen == len)
+                && (h->keycmp(tmp->key, key, tmp->klen) == 0))
+        {
+            if(h->_stats)
+                hash_table_note_probes(h->_stats, probes);
+            return tmp;
+        }
+    }
+    if(h->_stats)
+        hash_table_note_probes(h->_stats, probes);
+    return NULL;
+}
+
+/*
+ * Claims the next old bucket to move for the resize @v belongs to (the
+ * next new bucket to fill when shrinking). A claim holds the resize open:
+ * it can't finish (nor another one start) until the claimed bucket is
+ * moved.
+ */
+static inline size_t hash_table_migrate_units(const struct hash_table_view *v)
+{
+    return (size_t)1 << (v->bits < v->old_bits ? v->bits : v->old_bits);
+}
+
+static inline int hash_table_migrate_claim(struct hash_table *h,
+        const struct hash_table_view *v, size_t *i)
+{
+    uint64_t m = __atomic_load_n(&h->_migrate, __ATOMIC_ACQUIRE);
+    size_t units = hash_table_migrate_units(v);
+
+    do {
+        if((unsigned int)(m >> 32) != v->gen ||
+                (size_t)(m & 0xffffffffULL) >= units)
+            return 0;
+    } while(!__atomic_compare_exchange_n(&h->_migrate, &m, m + 1, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    *i = (size_t)(m & 0xffffffffULL);
+    return 1;
+}
+
+/*
+ * Moves old bucket @i into new buckets 2i and 2i+1. They share its stripe,
+ * and nobody looks at them until the old bucket is marked moved.
+ */
+static void __hash_table_migrate_bucket(struct hash_table *h,
+        const struct hash_table_view *v, size_t i)
+{
+    struct hash_lock_stripe *stripe = &h->_stripes[i >> (v->old_bits - h->_sbits)];
+    struct hash_entry *e;
+    struct list_head *pos, *n;
+    unsigned int b;
+
+    hash_stripe_lock(h, stripe);
+    hash_stripe_write_begin(stripe);
+
+    INIT_LIST_HEAD(&v->table[2*i]);
+    INIT_LIST_HEAD(&v->table[2*i+1]);
+
+    list_for_each_safe(pos, n, &v->old_table[i])
+    {
+        e = list_entry(pos, struct hash_entry, list);
+        b = hash_table_bucket_of_fold(e->_hash, v->bits);
+
+        list_del(pos);
+        if(list_empty(&v->table[b]))
+            __sync_fetch_and_add(&h->_used_buckets, 1);
+        list_add(pos, &v->table[b]);
+    }
+
+    hash_bucket_mark_moved(&v->old_table[i]);
+    hash_stripe_write_end(stripe);
+    pthread_mutex_unlock(&stripe->lock);
+}
+
+/*
+ * Shrinking: moves old buckets 2i and 2i+1 into new bucket @i. The three
+ * share a stripe, and nobody looks at the new one until both old ones
+ * are marked moved.
+ */
+static void __hash_table_merge_buckets(struct hash_table *h,
+        const struct hash_table_view *v, size_t i)
+{
+    struct hash_lock_stripe *stripe = &h->_stripes[i >> (v->bits - h->_sbits)];
+    struct list_head *head = &v->table[i];
+
+    hash_stripe_lock(h, stripe);
+    hash_stripe_write_begin(stripe);
+
+    INIT_LIST_HEAD(head);
+    list_splice_init(&v->old_table[2*i], head);
+    list_splice_init(&v->old_table[2*i+1], head);
+    if(!list_empty(head))
+        __sync_fetch_and_add(&h->_used_buckets, 1);
+
+    hash_bucket_mark_moved(&v->old_table[2*i]);
+    hash_bucket_mark_moved(&v->old_table[2*i+1]);
+    hash_stripe_write_end(stripe);
+    pthread_mutex_unlock(&stripe->lock);
+}
+
+/*
+ * The last old bucket has been moved: drop the old array. Once the layout
+ * changed, taking each stripe once waits out whoever still holds one
+ * under the old layout, and an idle reader slot means no lockless lookup
+ * that started before is still around. After that nobody can look at the
+ * old array.
+ */
+static void hash_table_migrate_done(struct hash_table *h)
+{
+    struct list_head *old;
+    size_t i;
+
+    hash_table_lock(h);
+    old = h->_old_table;
+    if(h->_stats)
+        __sync_fetch_and_add(&h->_stats->resize_ns,
+                hash_table_now_ns() - h->_stats->resize_start);
+    hash_table_write_begin(h);
+    h->_old_table = NULL;
+    h->_old_buckets = 0;
+    hash_table_write_end(h);
+    hash_table_unlock(h);
+
+    for( i=0 ; i < ((size_t)1 << h->_sbits) ; i++ )
+    {
+        pthread_mutex_lock(&h->_stripes[i].lock);
+        pthread_mutex_unlock(&h->_stripes[i].lock);
+    }
+
+    //pairs with the increment in hash_table_lookup_key_lockless()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for( i=0 ; i<HASH_TABLE_READER_SLOTS ; i++ )
+    {
+        while(__atomic_load_n(&h->_readers[i].active, __ATOMIC_ACQUIRE))
+            sched_yield();
+    }
+
+    _h_deallocator(old);
+}
+
+static inline void hash_table_shrink(struct hash_table *h);
+
+/* moves up to @nbuckets buckets (claims), returns how many were moved */
+static size_t hash_table_migrate(struct hash_table *h,
+        const struct hash_table_view *v, size_t nbuckets)
+{
+    size_t done = 0;
+    size_t i;
+
+    if(!v->old_table)
+        return 0;
+
+    //merges mostly find empty buckets, they're cheap: do more of them.
+    if(v->bits < v->old_bits && nbuckets < (size_t)-1 / _HASH_MERGE_RATIO)
+        nbuckets *= _HASH_MERGE_RATIO;
+
+    while(done < nbuckets && hash_table_migrate_claim(h, v, &i))
+    {
+        if(v->bits > v->old_bits)
+            __hash_table_migrate_bucket(h, v, i);
+        else
+            __hash_table_merge_buckets(h, v, i);
+        done++;
+    }
+
+    if(done && __sync_add_and_fetch(&h->_migrated, done) ==
+            hash_table_migrate_units(v))
+    {
+        hash_table_migrate_done(h);
+        //still mostly empty: keep going down.
+        hash_table_shrink(h);
+    }
+
+    return done;
+}
+
+/* what _nentries has to drop under before a 2^@bits table halves */
+static inline size_t hash_table_shrink_threshold(const struct hash_table *h,
+        unsigned int bits)
+{
+    if(bits <= h->_min_hbits)
+        return 0;
+    return (size_t)((float)((size_t)1 << bits) * h->_shrink_factor);
+}
+
+/*
+ * Starts a resize: swaps in a bucket array twice (@grow) or half the size
+ * and leaves the current one to be drained by hash_table_migrate(). The
+ * table lock is only held for the swap.
+ */
+static int hash_table_resize(struct hash_table *h, int grow)
+{
+    struct list_head *table;
+    unsigned int cur, bits, seq;
+    int busy;
+
+    do {
+        seq = hash_table_read_begin(h);
+        cur = h->_hbits;
+        busy = (h->_old_table != NULL);
+    } while(hash_table_read_retry(h, seq));
+
+    if(busy)
+        return 0;
+    if(grow)
+    {
+        if(h->_nentries < h->_resize_threshold)
+            return 0;
+        if(cur + 1 > HASH_TABLE_MAX_BITS)
+            return -1;
+        bits = cur + 1;
+    } else {
+        if(h->_nentries >= h->_shrink_threshold || cur <= h->_min_hbits)
+            return 0;
+        bits = cur - 1;
+    }
+    if((table = hash_bucket_array_alloc(bits, 0)) == NULL)
+        return -1;
+
+    hash_table_lock(h);
+    if(h->_old_table || h->_hbits != cur)
+    {
+        //someone beat us to it.
+        hash_table_unlock(h);
+        _h_deallocator(table);
+        return 0;
+    }
+
+    hash_table_write_begin(h);
+    h->_old_table = h->table;
+    h->_old_buckets = h->buckets;
+    h->_old_hbits = h->_hbits;
+
+    h->table = table;
+    h->buckets = (size_t)1 << bits;
+    h->_hbits = bits;
+
+    h->_used_buckets = 0;
+    h->_migrated = 0;
+    if(grow)
+        h->_resize_threshold *= 2;
+    else
+        h->_resize_threshold /= 2;
+    h->_shrink_threshold = hash_table_shrink_threshold(h, bits);
+    if(h->_stats)
+    {
+        __sync_fetch_and_add(&h->_stats->resizes, 1);
+        h->_stats->resize_start = hash_table_now_ns();
+    }
+    //claims are tagged with the layout they belong to, _seq once we're done.
+    __atomic_store_n(&h->_migrate,
+            (uint64_t)(h->_seq + 1) << 32, __ATOMIC_RELEASE);
+    hash_table_write_end(h);
+    hash_table_unlock(h);
+
+    return 0;
+}
+
+static inline int hash_table_grow(struct hash_table *h)
+{
+    return hash_table_resize(h, 1);
+}
+
+/* deletes call this, the table halves once it's mostly empty */
+static inline void hash_table_shrink(struct hash_table *h)
+{
+    if(h->_nentries < h->_shrink_threshold)
+        hash_table_resize(h, 0);
+}
+
+int hash_table_set_shrink(struct hash_table *h, float factor)
+{
+    if(factor < 0.0f || factor >= h->_factor / 2)
+        return -1;
+
+    hash_table_lock(h);
+    h->_shrink_factor = factor;
+    h->_shrink_threshold = hash_table_shrink_threshold(h, h->_hbits);
+    hash_table_unlock(h);
+
+    return 0;
+}
+
+void hash_table_finish_resize(struct hash_table *h)
+{
+    struct hash_table_view v;
+
+    for(;;)
+    {
+        hash_table_view_safe(h, &v);
+        if(!v.old_table)
+            return;
+
+        //nothing left to claim: others are still moving their buckets.
+        if(!hash_table_migrate(h, &v, (size_t)-1) && hash_table_view_valid(h, &v))
+            sched_yield();
+    }
+}
 
 static inline void hash_table_insert(struct hash_table *h,
 		       struct hash_entry *e )
 {
-	unsigned int n;
+	struct list_head *head;
+	int current;
 
-	n = hash_table_hash_code(h, e->key, e->klen);
-	list_add(&(e->list), &(h->table[n].list));
+	e->_hash = hash_table_key_fold(h, e->key, e->klen);
+	head = hash_table_head(h, e->_hash, &current);
+	__hash_table_link(h, e, head, current);
 }
 
 /* insert_hash_table(_i)
@@ -35,40 +842,54 @@ void hash_table_insert_s(struct hash_table *h,
                          struct hash_entry *e,
                          const char * key, size_t len)
 {
-    hash_entry_init(e, (const void *)key, len, 1);
+    hash_table_entry_init_s(h, e, key, len);
     hash_table_insert(h, e);
 }
 
+void hash_table_insert_str(struct hash_table *h,
+                           struct hash_str_entry *se,
+                           const char * key, size_t len)
+{
+    if(len > HASH_ENTRY_INLINE_KEY)
+        hash_table_entry_init_s(h, &se->e, key, len);
+    else
+        hash_str_entry_init(se, key, len);
+    hash_table_insert(h, &se->e);
+}
+
+void hash_table_insert_hashed(struct hash_table *h, struct hash_entry *e,
+        uint32_t hv)
+{
+    struct hash_table_view v;
+    struct list_head *head;
+    struct hash_lock_stripe *stripe;
+    int current;
+
+    e->_hash = hv;
+    if(h->_nentries >= h->_resize_threshold)
+        hash_table_grow(h);
+
+    stripe = hash_table_lock_hv(h, hv, &v, &head, &current);
+    hash_stripe_write_begin(stripe);
+    __hash_table_link(h, e, head, current);
+    hash_stripe_write_end(stripe);
+    pthread_mutex_unlock(&stripe->lock);
+
+    hash_table_migrate(h, &v, _HASH_MIGRATE_STEP);
+}
+
 /* insert_hash_table_safe()
  * @h: &struct hash_table hash table to insert hash_entry into
  * @e: &struct hash_entry
  * @key: use key to insert the hash_entry
  * @len: length of the key
  * Description: inserts @e into @h using @e->key as key. thread-safe.
+ *              Moves a few buckets along if @h is resizing.
  */
 static inline void hash_table_insert_safe(struct hash_table *h,
         struct hash_entry *e)
 {
-    unsigned int n;
-    short resized = 0;
-
-    n = hash_table_hash_code_safe(h, e->key, e->klen);
-
-    if(h->_used_buckets >= h->_resize_threshold)
-    {
-        if(!hash_table_resize(h))
-            resized = 1;
-    }
-
-    if(resized)
-    {
-        n = hash_table_hash_code_safe(h, e->key, e->klen);
-    }
-    hash_table_bucket_lock(h, n);
-    if(list_empty(&h->table[n].list))
-        h->_used_buckets++;
-    list_add(&(e->list), &(h->table[n].list));
-    hash_table_bucket_unlock(h, n);
+    hash_table_insert_hashed(h, e, hash_table_key_fold(h, e->key, e->klen));
 }
 
 void hash_table_insert_safe_i(struct hash_table *h,
@@ -83,37 +904,41 @@ void hash_table_insert_safe_s(struct hash_table *h,
         struct hash_entry *e,
         const char * key, size_t len)
 {
-    hash_entry_init(e, (const void *)key, len, 1);
+    hash_table_entry_init_s(h, e, key, len);
     hash_table_insert_safe(h, e);
 }
 
+void hash_table_insert_safe_str(struct hash_table *h,
+        struct hash_str_entry *se,
+        const char * key, size_t len)
+{
+    if(len > HASH_ENTRY_INLINE_KEY)
+        hash_table_entry_init_s(h, &se->e, key, len);
+    else
+        hash_str_entry_init(se, key, len);
+    hash_table_insert_safe(h, &se->e);
+}
+
 /* hash_table_lookup_key()
  * @h: hash table to look into
  * @key: the key to look for
  * @len: length of the key
- * Description: looks up the hash table for the presence of key. 
+ * Description: looks up the hash table for the presence of key.
  * Returns: returns a pointer to the hash_entry that matches the key. otherise returns NULL.
  * Notes: in the presence of duplicate keys the function returns the first hash_entry found.
- * 		  function is not safe from delections. 
- * 		  function is not thread safe. 
+ * 		  function is not safe from delections.
+ * 		  function is not thread safe.
  */
 static struct hash_entry *hash_table_lookup_key(const struct hash_table *h,
 					 const void *key,
 					 size_t len)
 {
-	unsigned int hcode = hash_table_hash_code(h, key, len);
-	struct hash_entry *tmp;
-	struct list_head *pos;
+	int current;
 
-	list_for_each(pos, &(h->table[hcode].list))
-	{
-		tmp = list_entry(pos, struct hash_entry, list);
+	uint32_t hv = hash_table_key_fold(h, key, len);
 
-		if ((tmp->klen == len)
-		    && (h->keycmp(tmp->key, key, tmp->klen) == 0))
-			return tmp;
-	}
-	return NULL;
+	return __hash_table_find(h, hash_table_head(h, hv, &current),
+			hv, key, len);
 }
 
 struct hash_entry *hash_table_lookup_key_i(const struct hash_table *h,
@@ -134,33 +959,27 @@ struct hash_entry *hash_table_lookup_key_s(const struct hash_table *h,
  * @h: hash table to look into
  * @str: the key to look for
  * @len: length of the key
- * Description: looks up the hash table for the presence of key. 
+ * Description: looks up the hash table for the presence of key.
  * Returns: returns a pointer to the hash_entry that matches the key. otherise returns NULL.
  * Notes: in the presence of duplicate keys the function returns the first hash_entry found.
- * 		  function is not safe from delections. 
+ * 		  function is not safe from delections.
  */
 static struct hash_entry *hash_table_lookup_key_safe(struct hash_table *h,
 					      const void *key,
 					      size_t len)
 {
+	struct hash_table_view v;
+	struct list_head *head;
+	struct hash_entry *e;
+	struct hash_lock_stripe *stripe;
+	uint32_t hv = hash_table_key_fold(h, key, len);
+	int current;
 
-	unsigned int hcode = hash_table_hash_code_safe(h, key, len);
-	struct hash_entry *tmp;
-	struct list_head *pos;
-
-	hash_table_bucket_lock(h, hcode);
-
-	list_for_each(pos, &(h->table[hcode].list)) {
-		tmp = list_entry(pos, struct hash_entry, list);
-
-		if (h->keycmp(tmp->key, key, tmp->klen) == 0) {
-			hash_table_bucket_unlock(h, hcode);
-			return tmp;
-		}
-	}
+	stripe = hash_table_lock_hv(h, hv, &v, &head, &current);
+	e = __hash_table_find(h, head, hv, key, len);
+	pthread_mutex_unlock(&stripe->lock);
 
-	hash_table_bucket_unlock(h, hcode);
-	return NULL;
+	return e;
 }
 
 struct hash_entry *hash_table_lookup_key_safe_i(struct hash_table *h,
@@ -179,20 +998,151 @@ struct hash_entry *hash_table_lookup_key_safe_s(struct hash_table *h,
     return hash_table_lookup_key_safe(h, (const void *)key, len);
 }
 
-static struct hash_entry *hash_table_del_key(struct hash_table *h, 
+/*
+ * Walks the chain at @head as of stripe count @seq. Every pointer is
+ * checked against the count before it is followed: an entry unlinked
+ * under our feet points to itself, and may be gone altogether.
+ * Returns 0 if a writer got in the way, the result is in @found otherwise.
+ */
+static inline int __hash_table_find_lockless(const struct hash_table *h,
+        const struct hash_lock_stripe *s, unsigned int seq,
+        struct list_head *head, struct list_head *first, uint32_t hv,
+        const void *key, size_t len, struct hash_entry **found)
+{
+    struct hash_entry *tmp, *match = NULL;
+    struct list_head *pos;
+    void *k;
+    size_t klen;
+    uint32_t ehv;
+    uint64_t probes = 0;
+
+    pos = first;
+    while(pos != head)
+    {
+        tmp = list_entry(pos, struct hash_entry, list);
+        probes++;
+        k = __atomic_load_n(&tmp->key, __ATOMIC_RELAXED);
+        klen = __atomic_load_n(&tmp->klen, __ATOMIC_RELAXED);
+        ehv = __atomic_load_n(&tmp->_hash, __ATOMIC_RELAXED);
+        pos = __atomic_load_n(&pos->next, __ATOMIC_RELAXED);
+
+        if(hash_stripe_read_retry(s, seq))
+            return 0;
+        if(ehv == hv && klen == len && h->keycmp(k, key, klen) == 0)
+        {
+            match = tmp;
+            break;
+        }
+    }
+
+    *found = match;
+    if(hash_stripe_read_retry(s, seq))
+        return 0;
+    if(h->_stats)
+        hash_table_note_probes(h->_stats, probes);
+    return 1;
+}
+
+/* hash_table_lookup_key_lockless()
+ * @h: hash table to look into
+ * @key: the key to look for
+ * @len: length of the key
+ * Description: lookup that doesn't write to the bucket stripe. The reader
+ *              slot keeps the bucket arrays we may be looking at around.
+ */
+static int __hash_table_lookup_lockless(struct hash_table *h, uint32_t hv,
+        const void *key, size_t len, struct hash_entry **found)
+{
+    struct hash_table_view v;
+    struct hash_lock_stripe *s;
+    struct list_head *head, *first;
+    struct hash_entry *e = NULL;
+    unsigned int seq, tries;
+    int done = 0;
+
+    s = &h->_stripes[hash_table_bucket_of_fold(hv, h->_sbits)];
+
+    for( tries=0 ; !done && tries<_HASH_LOCKLESS_TRIES ; tries++ )
+    {
+        //moves and the moved flag are under the stripe count too.
+        seq = hash_stripe_read_begin(s);
+        hash_table_view_safe(h, &v);
+
+        //a moved old bucket reads as a NULL next, see hash_bucket_moved().
+        first = NULL;
+        if(v.old_table)
+        {
+            head = &v.old_table[hash_table_bucket_of_fold(hv, v.old_bits)];
+            first = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+        }
+        if(!first)
+        {
+            head = &v.table[hash_table_bucket_of_fold(hv, v.bits)];
+            first = __atomic_load_n(&head->next, __ATOMIC_RELAXED);
+        }
+
+        done = __hash_table_find_lockless(h, s, seq, head, first, hv,
+                key, len, &e);
+    }
+
+    *found = e;
+    return done;
+}
+
+static struct hash_entry *hash_table_lookup_key_lockless(struct hash_table *h,
+        const void *key, size_t len)
+{
+    struct hash_reader_slot *r = hash_table_reader(h);
+    struct hash_entry *e;
+    int done;
+
+    __atomic_add_fetch(&r->active, 1, __ATOMIC_SEQ_CST);
+    done = __hash_table_lookup_lockless(h, hash_table_key_fold(h, key, len),
+            key, len, &e);
+    __atomic_sub_fetch(&r->active, 1, __ATOMIC_RELEASE);
+
+    return (done ? e : hash_table_lookup_key_safe(h, key, len));
+}
+
+struct hash_entry *hash_table_lookup_key_lockless_i(struct hash_table *h,
+					 const uintptr_t key,
+					 size_t len)
+{
+    if(len > sizeof(uintptr_t))
+        return NULL;
+    return hash_table_lookup_key_lockless(h, (const void *)key, len);
+}
+
+struct hash_entry *hash_table_lookup_key_lockless_s(struct hash_table *h,
+					 const char * key,
+					 size_t len)
+{
+    return hash_table_lookup_key_lockless(h, (const void *)key, len);
+}
+
+/*
+ * Deleting never moves buckets around here: the unsafe variants are what
+ * hash_table_for_each_safe() users call while walking the table.
+ */
+static struct hash_entry *hash_table_del_key(struct hash_table *h,
                                       const void *key,
 				      size_t len)
 {
+	struct list_head *head;
 	struct hash_entry *e;
+	int current;
 
-	if ((e = hash_table_lookup_key(h, key, len)) == NULL)
+	uint32_t hv = hash_table_key_fold(h, key, len);
+
+	head = hash_table_head(h, hv, &current);
+	if ((e = __hash_table_find(h, head, hv, key, len)) == NULL)
 		return NULL;
 
-	list_del_init(&(e->list));
+	__hash_table_unlink(h, e, current);
 	return e;
 }
 
-struct hash_entry *hash_table_del_key_i(struct hash_table *h, 
+struct hash_entry *hash_table_del_key_i(struct hash_table *h,
                                       const uintptr_t key,
 				      size_t len)
 {
@@ -202,32 +1152,82 @@ struct hash_entry *hash_table_del_key_i(struct hash_table *h,
     return hash_table_del_key(h, (const void *)key, len);
 }
 
-struct hash_entry *hash_table_del_key_s(struct hash_table *h, 
+struct hash_entry *hash_table_del_key_s(struct hash_table *h,
                                       const char *key,
 				      size_t len)
 {
     return hash_table_del_key(h, (const void *)key, len);
 }
 
+/* locked delete of @key, folded to @hv. @v is left for hash_table_migrate() */
+static struct hash_entry *__hash_table_del_hv(struct hash_table *h,
+        uint32_t hv, const void *key, size_t len, struct hash_table_view *v)
+{
+	struct list_head *head;
+	struct hash_entry *e;
+	struct hash_lock_stripe *stripe;
+	int current;
+
+	stripe = hash_table_lock_hv(h, hv, v, &head, &current);
+	if ((e = __hash_table_find(h, head, hv, key, len)) != NULL)
+	{
+		hash_stripe_write_begin(stripe);
+		__hash_table_unlink(h, e, current);
+		hash_stripe_write_end(stripe);
+	}
+	pthread_mutex_unlock(&stripe->lock);
+
+	return e;
+}
+
 static struct hash_entry *hash_table_del_key_safe(struct hash_table *h,
-					   const void *key, 
+					   const void *key,
                                            size_t len)
 {
+	return hash_table_del_hashed(h, hash_table_key_fold(h, key, len),
+			key, len);
+}
+
+struct hash_entry *hash_table_del_hashed(struct hash_table *h, uint32_t hv,
+        const void *key, size_t len)
+{
+	struct hash_table_view v;
 	struct hash_entry *e;
-	unsigned int n = hash_table_hash_code(h, key, len);
 
-	hash_table_bucket_lock(h, n);
-	if ((e = hash_table_lookup_key(h, key, len)) != NULL) {
-		list_del_init(&(e->list));
-		hash_table_bucket_unlock(h, n);
-		return e;
-	}
+	hash_table_shrink(h);
+	e = __hash_table_del_hv(h, hv, key, len, &v);
+
+	hash_table_migrate(h, &v, _HASH_MIGRATE_STEP);
+	return e;
+}
+
+void hash_table_unlink(struct hash_table *h, struct hash_entry *e)
+{
+	int current;
 
-	hash_table_bucket_unlock(h, n);
-	return NULL;
+	//only for _used_buckets: is @e in the old array?
+	hash_table_head(h, e->_hash, &current);
+	__hash_table_unlink(h, e, current);
 }
 
-struct hash_entry *hash_table_del_key_safe_i(struct hash_table *h, 
+void hash_table_unlink_safe(struct hash_table *h, struct hash_entry *e)
+{
+	struct hash_table_view v;
+	struct list_head *head;
+	struct hash_lock_stripe *stripe;
+	int current;
+
+	hash_table_shrink(h);
+	stripe = hash_table_lock_hv(h, e->_hash, &v, &head, &current);
+	hash_stripe_write_begin(stripe);
+	__hash_table_unlink(h, e, current);
+	hash_stripe_write_end(stripe);
+	pthread_mutex_unlock(&stripe->lock);
+
+	hash_table_migrate(h, &v, _HASH_MIGRATE_STEP);
+}
+
+struct hash_entry *hash_table_del_key_safe_i(struct hash_table *h,
                                       const uintptr_t key,
 				      size_t len)
 {
@@ -237,66 +1237,438 @@ struct hash_entry *hash_table_del_key_safe_i(struct hash_table *h,
     return hash_table_del_key_safe(h, (const void *)key, len);
 }
 
-struct hash_entry *hash_table_del_key_safe_s(struct hash_table *h, 
+struct hash_entry *hash_table_del_key_safe_s(struct hash_table *h,
                                       const char *key,
 				      size_t len)
 {
     return hash_table_del_key_safe(h, (const void *)key, len);
 }
 
-static int hash_table_resize(struct hash_table *h)
+/*
+ * Bulk updates are sorted by folded hash: entries under the same stripe
+ * end up next to each other (the stripe is the top bits of it), and so
+ * are their buckets. Returns (hash << 32 | index) for each of the @n
+ * entries/keys, in order, NULL if we couldn't get the memory.
+ */
+static int hash_table_cmp_order(const void *a, const void *b)
 {
-    int ret;
-    unsigned int i;
-    //need these to iterate hashtable
-    struct hash_table aux_htbl;
-    struct hash_entry * hentry, * hentry_aux;
-    struct list_head  * lh = NULL;
-    struct list_head  * laux = NULL;
-    unsigned int hti;
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
 
-    hash_table_lock(h);
-    ret = hash_table_init( &aux_htbl,
-            h->_resize_threshold*2,
-            h->keycmp,
-            h->my_hash_fn);
+    return (x > y) - (x < y);
+}
 
-    if(ret)
+static uint64_t *hash_table_bulk_order(const uint32_t *hv, size_t n)
+{
+    uint64_t *order;
+    size_t i;
+
+    if(n > 0xffffffffULL ||
+            !(order = (uint64_t *)_h_allocator(n * sizeof(uint64_t))))
+        return NULL;
+
+    for( i=0 ; i<n ; i++ )
+        order[i] = ((uint64_t)hv[i] << 32) | i;
+    qsort(order, n, sizeof(uint64_t), hash_table_cmp_order);
+
+    return order;
+}
+
+static inline unsigned int hash_table_order_stripe(const struct hash_table *h,
+        uint64_t o)
+{
+    return hash_table_bucket_of_fold((uint32_t)(o >> 32), h->_sbits);
+}
+
+void hash_table_insert_bulk_i(struct hash_table *h, struct hash_entry **entries,
+        const uintptr_t *keys, size_t len, size_t n)
+{
+    struct hash_table_view v;
+    struct hash_lock_stripe *stripe;
+    struct list_head *head;
+    struct hash_entry *e;
+    uint64_t *order = NULL;
+    uint32_t *hv;
+    size_t i, j;
+    unsigned int s;
+    int current;
+
+    if(len > sizeof(uintptr_t))
+        return;
+
+    for( i=0 ; i<n ; i++ )
     {
-        hash_table_unlock(h);
-        return ret;
+        hash_entry_init(entries[i], (const void *)keys[i], len, 0);
+        entries[i]->_hash = hash_table_key_fold(h, entries[i]->key, len);
     }
 
-    hash_table_for_each_safe( hentry, h, lh, laux, hti )
+    //sort a scratch copy of the hashes, go one by one if we can't.
+    if(!n)
+        return;
+
+    if((hv = (uint32_t *)_h_allocator(n * sizeof(uint32_t))))
+    {
+        for( i=0 ; i<n ; i++ )
+            hv[i] = entries[i]->_hash;
+        order = hash_table_bulk_order(hv, n);
+        _h_deallocator(hv);
+    }
+    if(!order)
     {
-        hentry_aux = hash_table_del_hash_entry_safe( h, hentry );
+        for( i=0 ; i<n ; i++ )
+            hash_table_insert_safe(h, entries[i]);
+        return;
+    }
 
-        if(hentry_aux)
+    for( i=0 ; i<n ; i=j )
+    {
+        if(h->_nentries >= h->_resize_threshold)
+            hash_table_grow(h);
+
+        s = hash_table_order_stripe(h, order[i]);
+        stripe = hash_table_lock_stripe(h, s, &v);
+        hash_stripe_write_begin(stripe);
+        for( j=i ; j<n && hash_table_order_stripe(h, order[j]) == s ; j++ )
         {
-            hash_table_insert( &aux_htbl, hentry_aux); 
+            e = entries[order[j] & 0xffffffffULL];
+            head = hash_table_view_head(&v, e->_hash, &current);
+            __hash_table_link(h, e, head, current);
         }
+        hash_stripe_write_end(stripe);
+        pthread_mutex_unlock(&stripe->lock);
+
+        hash_table_migrate(h, &v, (j - i) * _HASH_MIGRATE_STEP);
     }
 
-    //we've reused hentries so no need to free those!
-    free(h->table);
-    for( i = 0 ; i < h->buckets ; i++ )
+    _h_deallocator(order);
+}
+
+size_t hash_table_del_bulk_i(struct hash_table *h, const uintptr_t *keys,
+        size_t len, struct hash_entry **out, size_t n)
+{
+    struct hash_table_view v;
+    struct hash_lock_stripe *stripe;
+    struct list_head *head;
+    struct hash_entry *e;
+    uint64_t *order = NULL;
+    uint32_t *hv;
+    size_t i, j, k, found = 0;
+    unsigned int s;
+    int current;
+
+    if(!n || len > sizeof(uintptr_t))
+        return 0;
+
+    if((hv = (uint32_t *)_h_allocator(n * sizeof(uint32_t))))
+    {
+        for( i=0 ; i<n ; i++ )
+            hv[i] = hash_table_key_fold(h, (const void *)keys[i], len);
+        order = hash_table_bulk_order(hv, n);
+        _h_deallocator(hv);
+    }
+    if(!order)
+        return hash_table_del_batch_i(h, keys, len, out, n);
+
+    for( i=0 ; i<n ; i=j )
+    {
+        s = hash_table_order_stripe(h, order[i]);
+        stripe = hash_table_lock_stripe(h, s, &v);
+        hash_stripe_write_begin(stripe);
+        for( j=i ; j<n && hash_table_order_stripe(h, order[j]) == s ; j++ )
+        {
+            k = order[j] & 0xffffffffULL;
+            head = hash_table_view_head(&v, (uint32_t)(order[j] >> 32), &current);
+            if((e = __hash_table_find(h, head, (uint32_t)(order[j] >> 32),
+                            (const void *)keys[k], len)) != NULL)
+            {
+                __hash_table_unlink(h, e, current);
+                found++;
+            }
+            out[k] = e;
+        }
+        hash_stripe_write_end(stripe);
+        pthread_mutex_unlock(&stripe->lock);
+
+        hash_table_migrate(h, &v, (j - i) * _HASH_MIGRATE_STEP);
+    }
+
+    _h_deallocator(order);
+    hash_table_shrink(h);
+    return found;
+}
+
+/*
+ * Batches: fold every key and prefetch its stripe and bucket heads first,
+ * then prefetch the first entry of each chain, then walk them. The cache
+ * misses of a batch overlap instead of being paid one key at a time.
+ * Callers hold their reader slot, the heads may be in the old array.
+ */
+static void hash_table_prefetch_batch(struct hash_table *h,
+        const uintptr_t *keys, size_t len, uint32_t *hv, size_t n)
+{
+    struct hash_table_view v;
+    struct list_head *head, *first;
+    size_t i;
+
+    hash_table_view_safe(h, &v);
+
+    for( i=0 ; i<n ; i++ )
+    {
+        hv[i] = hash_table_key_fold(h, (const void *)keys[i], len);
+        prefetch(&h->_stripes[hash_table_bucket_of_fold(hv[i], h->_sbits)]);
+        if(v.old_table)
+            prefetch(&v.old_table[hash_table_bucket_of_fold(hv[i], v.old_bits)]);
+        prefetch(&v.table[hash_table_bucket_of_fold(hv[i], v.bits)]);
+    }
+
+    //only a hint: a stale or half set up head just prefetches the wrong line.
+    for( i=0 ; i<n ; i++ )
+    {
+        first = NULL;
+        if(v.old_table)
+        {
+            head = &v.old_table[hash_table_bucket_of_fold(hv[i], v.old_bits)];
+            first = __atomic_load_n(&head->next, __ATOMIC_RELAXED);
+        }
+        if(!first)
+        {
+            head = &v.table[hash_table_bucket_of_fold(hv[i], v.bits)];
+            first = __atomic_load_n(&head->next, __ATOMIC_RELAXED);
+        }
+        prefetch(first);
+    }
+}
+
+size_t hash_table_lookup_batch_i(struct hash_table *h, const uintptr_t *keys,
+        size_t len, struct hash_entry **out, size_t n)
+{
+    struct hash_reader_slot *r = hash_table_reader(h);
+    uint32_t hv[_HASH_BATCH];
+    size_t i, j, m, found = 0;
+
+    if(len > sizeof(uintptr_t))
+        return 0;
+
+    for( i=0 ; i<n ; i+=m )
+    {
+        m = (n - i < _HASH_BATCH ? n - i : _HASH_BATCH);
+
+        __atomic_add_fetch(&r->active, 1, __ATOMIC_SEQ_CST);
+        hash_table_prefetch_batch(h, &keys[i], len, hv, m);
+        for( j=0 ; j<m ; j++ )
+        {
+            if(!__hash_table_lookup_lockless(h, hv[j],
+                        (const void *)keys[i+j], len, &out[i+j]))
+                out[i+j] = hash_table_lookup_key_safe(h,
+                        (const void *)keys[i+j], len);
+            if(out[i+j])
+                found++;
+        }
+        __atomic_sub_fetch(&r->active, 1, __ATOMIC_RELEASE);
+    }
+
+    return found;
+}
+
+size_t hash_table_del_batch_i(struct hash_table *h, const uintptr_t *keys,
+        size_t len, struct hash_entry **out, size_t n)
+{
+    struct hash_reader_slot *r = hash_table_reader(h);
+    struct hash_table_view v;
+    uint32_t hv[_HASH_BATCH];
+    size_t i, j, m, found = 0;
+
+    if(len > sizeof(uintptr_t))
+        return 0;
+
+    for( i=0 ; i<n ; i+=m )
     {
-        pthread_mutex_destroy(&h->bucket_locks[i]);
+        m = (n - i < _HASH_BATCH ? n - i : _HASH_BATCH);
+
+        //the old array can't be freed under the prefetches.
+        __atomic_add_fetch(&r->active, 1, __ATOMIC_SEQ_CST);
+        hash_table_prefetch_batch(h, &keys[i], len, hv, m);
+        __atomic_sub_fetch(&r->active, 1, __ATOMIC_RELEASE);
+        for( j=0 ; j<m ; j++ )
+        {
+            out[i+j] = __hash_table_del_hv(h, hv[j],
+                    (const void *)keys[i+j], len, &v);
+            if(out[i+j])
+                found++;
+        }
+
+        //as much help with resizing as m single deletes would give.
+        hash_table_migrate(h, &v, m * _HASH_MIGRATE_STEP);
+        hash_table_shrink(h);
     }
-    free(h->bucket_locks);
 
-    h->bucket_locks = aux_htbl.bucket_locks;
-    h->table = aux_htbl.table;
-    h->buckets = aux_htbl.buckets;
-    h->_used_buckets = aux_htbl._used_buckets;
-    h->_resize_threshold = aux_htbl._resize_threshold;
-    h->_factor = aux_htbl._factor;
+    return found;
+}
+
+int hash_table_stats_enable(struct hash_table *h)
+{
+    struct hash_table_counters *c;
+
+    if(h->_stats)
+        return 0;
+    if(!(c = (struct hash_table_counters *)_h_allocator(sizeof(*c))))
+        return -1;
+    memset(c, 0, sizeof(*c));
 
+    hash_table_lock(h);
+    if(h->_stats)
+        _h_deallocator(c);
+    else
+        __atomic_store_n(&h->_stats, c, __ATOMIC_RELEASE);
     hash_table_unlock(h);
 
-    /*
-     * we intentionally don't call hash_table_finit on aux_htbl.
-     * Those resources are then used by the resized table.
-     */
     return 0;
 }
+
+static inline void hash_table_stats_chain(struct hash_table_stats *st,
+        const struct list_head *head)
+{
+    const struct list_head *pos;
+    size_t len = 0;
+
+    for( pos=head->next ; pos!=head ; pos=pos->next )
+        len++;
+
+    st->chains[len < HASH_STATS_CHAIN_BINS ? len : HASH_STATS_CHAIN_BINS - 1]++;
+    if(len > st->max_chain)
+        st->max_chain = len;
+}
+
+/*
+ * Walks the buckets of each stripe with it held. While resizing, a bucket
+ * is either in the old array or set up in the new one, see
+ * hash_table_view_head().
+ */
+void hash_table_get_stats(struct hash_table *h, struct hash_table_stats *st)
+{
+    struct hash_table_counters *c = __atomic_load_n(&h->_stats, __ATOMIC_ACQUIRE);
+    struct hash_table_view v;
+    struct hash_lock_stripe *stripe;
+    size_t b, first, last, old;
+    unsigned int s;
+
+    memset(st, 0, sizeof(*st));
+
+    //before our own stripe locks add up.
+    if(c)
+    {
+        st->lookups = c->lookups;
+        st->probes = c->probes;
+        st->max_probes = c->max_probes;
+        st->resizes = c->resizes;
+        st->resize_ns = c->resize_ns;
+        st->lock_acquires = c->lock_acquires;
+        st->lock_contended = c->lock_contended;
+    }
+
+    for( s=0 ; s < (1U << h->_sbits) ; s++ )
+    {
+        stripe = hash_table_lock_stripe(h, s, &v);
+
+        if(v.old_table)
+        {
+            first = (size_t)s << (v.old_bits - h->_sbits);
+            last = first + ((size_t)1 << (v.old_bits - h->_sbits));
+            for( b=first ; b<last ; b++ )
+            {
+                if(!hash_bucket_moved(&v.old_table[b]))
+                    hash_table_stats_chain(st, &v.old_table[b]);
+            }
+        }
+
+        first = (size_t)s << (v.bits - h->_sbits);
+        last = first + ((size_t)1 << (v.bits - h->_sbits));
+        for( b=first ; b<last ; b++ )
+        {
+            if(v.old_table)
+            {
+                old = (v.bits > v.old_bits ? b >> 1 : b << 1);
+                if(!hash_bucket_moved(&v.old_table[old]))
+                    continue;
+            }
+            hash_table_stats_chain(st, &v.table[b]);
+        }
+
+        if(stripe->contended > st->hot_contended)
+        {
+            st->hot_contended = stripe->contended;
+            st->hot_stripe = s;
+        }
+        pthread_mutex_unlock(&stripe->lock);
+    }
+}
+
+struct hash_table_walk {
+    struct hash_table *h;
+    hash_table_walk_fn fn;
+    void *arg;
+    size_t next; /* next bucket to hand out */
+};
+
+static void *hash_table_walker(void *arg)
+{
+    struct hash_table_walk *w = (struct hash_table_walk *)arg;
+    struct hash_table_iter it;
+    struct hash_entry *e;
+    size_t begin;
+
+    while((begin = __sync_fetch_and_add(&w->next, HASH_TABLE_WALK_CHUNK)) <
+            w->h->buckets)
+    {
+        hash_table_iter_init_range(&it, w->h, begin,
+                begin + HASH_TABLE_WALK_CHUNK);
+        while((e = hash_table_iter_next(&it)))
+            w->fn(e, w->arg);
+    }
+
+    return NULL;
+}
+
+unsigned int hash_table_parallel_for_each(struct hash_table *h,
+        unsigned int nthreads, hash_table_walk_fn fn, void *arg)
+{
+    pthread_t tids[HASH_TABLE_MAX_WALKERS];
+    struct hash_table_walk w;
+    unsigned int i, n = 0;
+    size_t chunks = (h->buckets + HASH_TABLE_WALK_CHUNK - 1) / HASH_TABLE_WALK_CHUNK;
+
+    w.h = h;
+    w.fn = fn;
+    w.arg = arg;
+    w.next = 0;
+
+    if(nthreads > HASH_TABLE_MAX_WALKERS)
+        nthreads = HASH_TABLE_MAX_WALKERS;
+    if(nthreads > chunks)
+        nthreads = (unsigned int)chunks;
+
+    //we're a walker too. if a thread can't be had, the others do its share.
+    for( i=1 ; i<nthreads ; i++ )
+    {
+        if(pthread_create(&tids[n], NULL, hash_table_walker, &w))
+            break;
+        n++;
+    }
+    hash_table_walker(&w);
+
+    for( i=0 ; i<n ; i++ )
+        pthread_join(tids[i], NULL);
+
+    return n + 1;
+}
+
+void custom_h_allocator(hash_table_allocator allocator,
+        hash_table_deallocator deallocator)
+{
+    if(!allocator || !deallocator)
+        return;
+    _h_allocator = allocator;
+    _h_deallocator = deallocator;
+
+    return;
+}
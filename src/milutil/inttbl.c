@@ -0,0 +1,495 @@
+#include <stdlib.h>
+#include <sched.h>
+
+#include "hashtbl/inttbl.h"
+
+/*
+ * Same layout rules as hashtbl.c: t->_seq is odd while the bucket arrays
+ * are swapped (under t->lock), operations lock the stripe of their key and
+ * check the layout didn't change meanwhile. New buckets 2i and 2i+1 are
+ * set up when old bucket i moves.
+ */
+
+static int_table_allocator _it_allocator = malloc;
+static int_table_deallocator _it_deallocator = free;
+
+struct int_table_view {
+    unsigned int gen;
+    struct int_entry **table;
+    unsigned int bits;
+    struct int_entry **old_table;
+    unsigned int old_bits;
+};
+
+static struct int_entry **int_bucket_array_alloc(unsigned int bits, int init)
+{
+    struct int_entry **table;
+    size_t n = (size_t)1 << bits;
+
+    if(!(table = (struct int_entry **)_it_allocator(n * sizeof(struct int_entry *))))
+        return NULL;
+    if(init)
+        memset(table, 0, n * sizeof(struct int_entry *));
+
+    return table;
+}
+
+int int_table_init(struct int_table *t, size_t n)
+{
+    unsigned int bits = INT_TABLE_MIN_BITS;
+    unsigned int sbits = 1;
+    size_t nstripes, i;
+
+    pthread_mutex_init(&(t->lock), NULL);
+
+    //same load factor as struct hash_table.
+    while(bits < INT_TABLE_MAX_BITS && ((size_t)1 << bits) * 3 / 4 < n)
+        bits++;
+    while(sbits < bits && ((size_t)1 << sbits) < INT_TABLE_LOCK_STRIPES)
+        sbits++;
+
+    t->table = NULL;
+    t->buckets = 0;
+    t->_hbits = bits;
+    t->_sbits = sbits;
+    t->_resize_threshold = n;
+    t->_used_buckets = 0;
+    t->_nentries = 0;
+
+    t->_old_table = NULL;
+    t->_old_buckets = 0;
+    t->_old_hbits = 0;
+    t->_migrate = 0;
+    t->_migrated = 0;
+    t->_seq = 0;
+
+    nstripes = (size_t)1 << sbits;
+    if(!(t->_stripes_mem = _it_allocator((nstripes + 1) * sizeof(struct hash_lock_stripe))))
+        return -1;
+    t->_stripes = (struct hash_lock_stripe *)
+        (((uintptr_t)t->_stripes_mem + HASH_TABLE_CACHELINE - 1) &
+         ~(uintptr_t)(HASH_TABLE_CACHELINE - 1));
+    for( i=0 ; i<nstripes ; i++ )
+    {
+        pthread_mutex_init(&t->_stripes[i].lock, NULL);
+        t->_stripes[i].seq = 0;
+    }
+
+    if(!(t->table = int_bucket_array_alloc(bits, 1)))
+        return -1;
+    t->buckets = (size_t)1 << bits;
+
+    return 0;
+}
+
+void int_table_finit(struct int_table *t)
+{
+    size_t i;
+
+    if(t->_old_table)
+        int_table_finish_resize(t);
+
+    if(t->table)
+        _it_deallocator(t->table);
+
+    if(t->_stripes_mem)
+    {
+        for( i=0 ; i < ((size_t)1 << t->_sbits) ; i++ )
+            pthread_mutex_destroy(&t->_stripes[i].lock);
+        _it_deallocator(t->_stripes_mem);
+    }
+
+    t->table = NULL;
+    t->_stripes = NULL;
+    t->_stripes_mem = NULL;
+    t->buckets = 0;
+    pthread_mutex_destroy(&(t->lock));
+}
+
+static inline unsigned int int_table_read_begin(const struct int_table *t)
+{
+    unsigned int seq;
+
+    while((seq = __atomic_load_n(&t->_seq, __ATOMIC_ACQUIRE)) & 1)
+        hash_table_cpu_relax();
+    return seq;
+}
+
+static inline int int_table_read_retry(const struct int_table *t,
+        unsigned int seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (__atomic_load_n(&t->_seq, __ATOMIC_RELAXED) != seq);
+}
+
+static inline void int_table_write_begin(struct int_table *t)
+{
+    __atomic_store_n(&t->_seq, t->_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void int_table_write_end(struct int_table *t)
+{
+    __atomic_store_n(&t->_seq, t->_seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline void int_table_view_safe(struct int_table *t,
+        struct int_table_view *v)
+{
+    unsigned int seq;
+
+    do {
+        seq = int_table_read_begin(t);
+        v->gen = seq;
+        v->table = t->table;
+        v->bits = t->_hbits;
+        v->old_table = t->_old_table;
+        v->old_bits = t->_old_hbits;
+    } while(int_table_read_retry(t, seq));
+}
+
+void int_table_mem_usage(struct int_table *t, struct hash_table_mem *m)
+{
+    size_t buckets;
+    unsigned int seq;
+
+    do {
+        seq = int_table_read_begin(t);
+        buckets = t->buckets + t->_old_buckets;
+    } while(int_table_read_retry(t, seq));
+
+    m->buckets = buckets * sizeof(struct int_entry *);
+    m->locks = ((size_t)1 << t->_sbits) * sizeof(struct hash_lock_stripe);
+    m->bucket_locks = buckets * sizeof(pthread_mutex_t);
+    m->saved = (m->bucket_locks > m->locks ? m->bucket_locks - m->locks : 0);
+    m->keys = 0;
+}
+
+/*
+ * Bucket @key lives in, in the old array until that bucket moved. @current
+ * is cleared for an old bucket.
+ */
+static inline struct int_entry **__int_table_head(struct int_entry **table,
+        unsigned int bits, struct int_entry **old_table, unsigned int old_bits,
+        uintptr_t key, int *current)
+{
+    struct int_entry **head;
+
+    *current = 1;
+    if(old_table)
+    {
+        head = &old_table[int_table_bucket_of(key, old_bits)];
+        if(*head != INT_TABLE_MOVED)
+        {
+            *current = 0;
+            return head;
+        }
+    }
+    return &table[int_table_bucket_of(key, bits)];
+}
+
+/* locks the stripe of @key under a stable layout, see hash_table_lock_hv() */
+static struct hash_lock_stripe *int_table_lock_key(struct int_table *t,
+        uintptr_t key, struct int_table_view *v, struct int_entry ***head,
+        int *current)
+{
+    struct hash_lock_stripe *stripe = &t->_stripes[int_table_bucket_of(key, t->_sbits)];
+
+    for(;;)
+    {
+        int_table_view_safe(t, v);
+
+        pthread_mutex_lock(&stripe->lock);
+        if(__atomic_load_n(&t->_seq, __ATOMIC_ACQUIRE) == v->gen)
+            break;
+        pthread_mutex_unlock(&stripe->lock);
+    }
+
+    *head = __int_table_head(v->table, v->bits, v->old_table, v->old_bits,
+            key, current);
+    return stripe;
+}
+
+static inline void __int_table_link(struct int_table *t, struct int_entry *e,
+        struct int_entry **head, int current)
+{
+    if(current && !*head)
+        __sync_fetch_and_add(&t->_used_buckets, 1);
+    e->next = *head;
+    *head = e;
+    __sync_fetch_and_add(&t->_nentries, 1);
+}
+
+static inline struct int_entry *__int_table_find(struct int_entry **head,
+        uintptr_t key)
+{
+    struct int_entry *e;
+
+    for( e=*head ; e ; e=e->next )
+    {
+        if(e->key == key)
+            return e;
+    }
+    return NULL;
+}
+
+static inline struct int_entry *__int_table_unlink(struct int_table *t,
+        struct int_entry **head, uintptr_t key, int current)
+{
+    struct int_entry **pp, *e;
+
+    for( pp=head ; (e=*pp) ; pp=&e->next )
+    {
+        if(e->key != key)
+            continue;
+
+        *pp = e->next;
+        e->next = NULL;
+        if(current && !*head)
+            __sync_fetch_and_sub(&t->_used_buckets, 1);
+        __sync_fetch_and_sub(&t->_nentries, 1);
+        return e;
+    }
+    return NULL;
+}
+
+static inline int int_table_migrate_claim(struct int_table *t,
+        const struct int_table_view *v, size_t *i)
+{
+    uint64_t m = __atomic_load_n(&t->_migrate, __ATOMIC_ACQUIRE);
+    size_t old_buckets = (size_t)1 << v->old_bits;
+
+    do {
+        if((unsigned int)(m >> 32) != v->gen ||
+                (size_t)(m & 0xffffffffULL) >= old_buckets)
+            return 0;
+    } while(!__atomic_compare_exchange_n(&t->_migrate, &m, m + 1, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    *i = (size_t)(m & 0xffffffffULL);
+    return 1;
+}
+
+/* moves old bucket @i into new buckets 2i and 2i+1, they share its stripe */
+static void __int_table_migrate_bucket(struct int_table *t,
+        const struct int_table_view *v, size_t i)
+{
+    struct hash_lock_stripe *stripe = &t->_stripes[i >> (v->old_bits - t->_sbits)];
+    struct int_entry *e, *n;
+    struct int_entry **head;
+
+    pthread_mutex_lock(&stripe->lock);
+
+    v->table[2*i] = NULL;
+    v->table[2*i+1] = NULL;
+
+    for( e=v->old_table[i] ; e ; e=n )
+    {
+        n = e->next;
+        head = &v->table[int_table_bucket_of(e->key, v->bits)];
+        if(!*head)
+            __sync_fetch_and_add(&t->_used_buckets, 1);
+        e->next = *head;
+        *head = e;
+    }
+
+    v->old_table[i] = INT_TABLE_MOVED;
+    pthread_mutex_unlock(&stripe->lock);
+}
+
+/* all old buckets moved: drop the old array, see hash_table_migrate_done() */
+static void int_table_migrate_done(struct int_table *t)
+{
+    struct int_entry **old;
+    size_t i;
+
+    int_table_lock(t);
+    old = t->_old_table;
+    int_table_write_begin(t);
+    t->_old_table = NULL;
+    t->_old_buckets = 0;
+    int_table_write_end(t);
+    int_table_unlock(t);
+
+    for( i=0 ; i < ((size_t)1 << t->_sbits) ; i++ )
+    {
+        pthread_mutex_lock(&t->_stripes[i].lock);
+        pthread_mutex_unlock(&t->_stripes[i].lock);
+    }
+
+    _it_deallocator(old);
+}
+
+static size_t int_table_migrate(struct int_table *t,
+        const struct int_table_view *v, size_t nbuckets)
+{
+    size_t done = 0;
+    size_t i;
+
+    if(!v->old_table)
+        return 0;
+
+    while(done < nbuckets && int_table_migrate_claim(t, v, &i))
+    {
+        __int_table_migrate_bucket(t, v, i);
+        done++;
+    }
+
+    if(done && __sync_add_and_fetch(&t->_migrated, done) ==
+            ((size_t)1 << v->old_bits))
+        int_table_migrate_done(t);
+
+    return done;
+}
+
+/* swaps in a bucket array twice the size, see hash_table_grow() */
+static int int_table_grow(struct int_table *t)
+{
+    struct int_entry **table;
+    unsigned int bits, seq;
+    int busy;
+
+    do {
+        seq = int_table_read_begin(t);
+        bits = t->_hbits + 1;
+        busy = (t->_old_table != NULL);
+    } while(int_table_read_retry(t, seq));
+
+    if(busy || t->_nentries < t->_resize_threshold)
+        return 0;
+    if(bits > INT_TABLE_MAX_BITS)
+        return -1;
+    if((table = int_bucket_array_alloc(bits, 0)) == NULL)
+        return -1;
+
+    int_table_lock(t);
+    if(t->_old_table || t->_hbits + 1 != bits)
+    {
+        int_table_unlock(t);
+        _it_deallocator(table);
+        return 0;
+    }
+
+    int_table_write_begin(t);
+    t->_old_table = t->table;
+    t->_old_buckets = t->buckets;
+    t->_old_hbits = t->_hbits;
+
+    t->table = table;
+    t->buckets = (size_t)1 << bits;
+    t->_hbits = bits;
+
+    t->_used_buckets = 0;
+    t->_migrated = 0;
+    t->_resize_threshold *= 2;
+    __atomic_store_n(&t->_migrate,
+            (uint64_t)(t->_seq + 1) << 32, __ATOMIC_RELEASE);
+    int_table_write_end(t);
+    int_table_unlock(t);
+
+    return 0;
+}
+
+void int_table_finish_resize(struct int_table *t)
+{
+    struct int_table_view v;
+
+    for(;;)
+    {
+        int_table_view_safe(t, &v);
+        if(!v.old_table)
+            return;
+
+        if(!int_table_migrate(t, &v, (size_t)-1) &&
+                __atomic_load_n(&t->_seq, __ATOMIC_ACQUIRE) == v.gen)
+            sched_yield();
+    }
+}
+
+void int_table_insert(struct int_table *t, struct int_entry *e, uintptr_t key)
+{
+    struct int_entry **head;
+    int current;
+
+    e->key = key;
+    head = __int_table_head(t->table, t->_hbits, t->_old_table, t->_old_hbits,
+            key, &current);
+    __int_table_link(t, e, head, current);
+}
+
+struct int_entry *int_table_lookup(const struct int_table *t, uintptr_t key)
+{
+    int current;
+
+    return __int_table_find(__int_table_head(t->table, t->_hbits,
+                t->_old_table, t->_old_hbits, key, &current), key);
+}
+
+struct int_entry *int_table_del(struct int_table *t, uintptr_t key)
+{
+    struct int_entry **head;
+    int current;
+
+    head = __int_table_head(t->table, t->_hbits, t->_old_table, t->_old_hbits,
+            key, &current);
+    return __int_table_unlink(t, head, key, current);
+}
+
+void int_table_insert_safe(struct int_table *t, struct int_entry *e,
+        uintptr_t key)
+{
+    struct int_table_view v;
+    struct hash_lock_stripe *stripe;
+    struct int_entry **head;
+    int current;
+
+    if(t->_nentries >= t->_resize_threshold)
+        int_table_grow(t);
+
+    e->key = key;
+    stripe = int_table_lock_key(t, key, &v, &head, &current);
+    __int_table_link(t, e, head, current);
+    pthread_mutex_unlock(&stripe->lock);
+
+    int_table_migrate(t, &v, _HASH_MIGRATE_STEP);
+}
+
+struct int_entry *int_table_lookup_safe(struct int_table *t, uintptr_t key)
+{
+    struct int_table_view v;
+    struct hash_lock_stripe *stripe;
+    struct int_entry **head, *e;
+    int current;
+
+    stripe = int_table_lock_key(t, key, &v, &head, &current);
+    e = __int_table_find(head, key);
+    pthread_mutex_unlock(&stripe->lock);
+
+    return e;
+}
+
+struct int_entry *int_table_del_safe(struct int_table *t, uintptr_t key)
+{
+    struct int_table_view v;
+    struct hash_lock_stripe *stripe;
+    struct int_entry **head, *e;
+    int current;
+
+    stripe = int_table_lock_key(t, key, &v, &head, &current);
+    e = __int_table_unlink(t, head, key, current);
+    pthread_mutex_unlock(&stripe->lock);
+
+    int_table_migrate(t, &v, _HASH_MIGRATE_STEP);
+    return e;
+}
+
+void custom_it_allocator(int_table_allocator allocator,
+        int_table_deallocator deallocator)
+{
+    if(!allocator || !deallocator)
+        return;
+    _it_allocator = allocator;
+    _it_deallocator = deallocator;
+
+    return;
+}
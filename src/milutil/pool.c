@@ -1,113 +1,301 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include "pool/pool.h"
 
 static pool_allocator _p_allocator = malloc;
 
-struct pool * create_pool(uint16_t p_sz, size_t o_sz) {
-    struct pool * p = NULL;
-    struct pool_entry * e = NULL;
+/* free list link stored in a free object, unaligned objects are fine */
+static inline uint32_t _pool_next(struct pool * p, uint32_t idx) {
+    uint32_t next;
+
+    memcpy(&next, p->_pool_mem + (size_t)(idx - 1) * p->_obj_sz, sizeof(next));
+    return next;
+}
+
+static inline void _pool_set_next(struct pool * p, uint32_t idx, uint32_t next) {
+    memcpy(p->_pool_mem + (size_t)(idx - 1) * p->_obj_sz, &next, sizeof(next));
+}
+
+/* all objects free, handed out in address order */
+static void _pool_fill(struct pool * p) {
+    uint64_t head = __atomic_load_n(&p->_head, __ATOMIC_RELAXED);
+
+    //last one ends the list.
+    for(uint32_t i=1 ; i<=p->_nobjs ; i++) {
+        _pool_set_next(p, i, (i < p->_nobjs) ? i + 1 : 0);
+    }
+    __atomic_store_n(&p->_head, POOL_HEAD(POOL_HEAD_TAG(head) + 1, 1),
+            __ATOMIC_RELEASE);
+}
+
+/* @len bytes of fresh mappings, aligned to a segment (or a huge page) */
+static char * _pool_map(struct pool * p, size_t len) {
+    size_t align = (p->_flags & POOL_HUGEPAGE) ? POOL_HUGEPAGE_SIZE : POOL_SEG_SIZE;
+    size_t rlen = (len + align - 1) & ~(align - 1);
+    size_t head;
+    char * raw = NULL;
     char * mem = NULL;
 
-    if(!(p = _p_allocator(sizeof(struct pool)))){
+    raw = mmap(NULL, rlen + align, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED) {
         return NULL;
     }
 
-    INIT_QUEUE(&p->pool_q);
-    INIT_QUEUE(&p->avail_q);
+    //keep the aligned part only.
+    mem = (char *)(((uintptr_t)raw + align - 1) & ~(align - 1));
+    head = mem - raw;
+    if(head)
+        munmap(raw, head);
+    if(align - head)
+        munmap(mem + rlen, align - head);
 
-    p->_nobjs = p_sz;
-    p->_obj_sz = o_sz;
+    //a hint, the pool works the same without.
+    if(p->_flags & POOL_HUGEPAGE)
+        madvise(mem, rlen, MADV_HUGEPAGE);
+
+    p->_raw_mem = mem;
+    p->_raw_len = rlen;
+    return mem;
+}
+
+struct pool * create_pool_flags(uint32_t p_sz, size_t o_sz, uint8_t flags) {
+    struct pool * p = NULL;
+    char * mem = NULL;
 
-    if(!(mem = _p_allocator(p_sz * o_sz))) {
-        free(p);
+    if(!p_sz || p_sz > POOL_MAX_OBJS || o_sz < POOL_MIN_OBJSZ) {
         return NULL;
     }
-    p->_pool_mem = mem;
-    p->_start_addr = (uintptr_t)mem;
 
-    if(!(e = _p_allocator( p_sz * sizeof(struct pool_entry)))) {
-        free(p->_pool_mem);
-        free(p);
+    if(!(p = _p_allocator(sizeof(struct pool)))){
         return NULL;
     }
-    p->_entries = e;
+    memset(p, 0, sizeof(struct pool));
 
-    for(int i=0 ; i<p_sz ; i++) {
-        e->ptr = mem;
-        put_fifo(&p->pool_q, &e->q_e);
-        mem += o_sz;
-        e++;
+    p->_nobjs = p_sz;
+    p->_obj_sz = o_sz;
+    p->_flags = flags & (POOL_MMAP | POOL_HUGEPAGE);
+    if(p->_flags & POOL_HUGEPAGE)
+        p->_flags |= POOL_MMAP;
+
+    if(p->_flags & POOL_MMAP) {
+        if(!(mem = _pool_map(p, (size_t)p_sz * o_sz))) {
+            free(p);
+            return NULL;
+        }
+    } else {
+        if(!(mem = _p_allocator((size_t)p_sz * o_sz + POOL_SEG_SIZE))) {
+            free(p);
+            return NULL;
+        }
+        p->_raw_mem = mem;
+        p->_raw_len = (size_t)p_sz * o_sz + POOL_SEG_SIZE;
+        mem = (char *)(((uintptr_t)mem + POOL_SEG_SIZE - 1) & ~(POOL_SEG_SIZE - 1));
     }
-    p->_end_addr = (uintptr_t)mem;
-    p->_n_q = o_sz;
+    p->_pool_mem = mem;
+    p->_start_addr = (uintptr_t)mem;
+    p->_end_addr = (uintptr_t)(mem + (size_t)p_sz * o_sz);
+
+    _pool_fill(p);
 
     return p;
 }
 
+struct pool * create_pool(uint32_t p_sz, size_t o_sz) {
+    return create_pool_flags(p_sz, o_sz, 0);
+}
+
 int destroy_pool(struct pool * p) {
     if(!p)
         return -1;
 
-    if(!p->_pool_mem)
+    if(!p->_raw_mem)
         return -1;
-    free(p->_pool_mem);
-
-    if(!p->_entries)
-        return -1;
-    free(p->_entries);
+    if(p->_flags & POOL_MMAP)
+        munmap(p->_raw_mem, p->_raw_len);
+    else
+        free(p->_raw_mem);
 
     free(p);
     return 0;
 }
 
+/*
+ * The next link is read from an object another thread may have popped
+ * (and be writing to) in the meantime. That read stays inside _pool_mem,
+ * and the tag makes the CAS fail, so the garbage is never used.
+ * */
 void * pool_get_ptr(struct pool * p) {
-    struct list_head * lh = NULL;
-    void * ptr = NULL;
+    uint64_t head, next;
+    uint32_t idx;
 
     if(!p) {
         return NULL;
     }
 
-    lh = get_fifo(&p->pool_q);
-    if(lh) {
-        struct pool_entry * p_e;
+    head = __atomic_load_n(&p->_head, __ATOMIC_ACQUIRE);
+    do {
+        idx = POOL_HEAD_IDX(head);
+        if(!idx)
+            return NULL;
+        next = POOL_HEAD(POOL_HEAD_TAG(head) + 1, _pool_next(p, idx));
+    } while(!__atomic_compare_exchange_n(&p->_head, &head, next, 1,
+                __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
 
-        p_e = list_entry(lh, struct pool_entry, q_e);
-        ptr = p_e->ptr; 
-        put_fifo( &p->avail_q, lh );
-        p->_n_q--;
+    return p->_pool_mem + (size_t)(idx - 1) * p->_obj_sz;
+}
+
+/*
+ * Pops up to @n objects into @objs with one CAS, returns how many. The
+ * links past the head may be garbage until the CAS says otherwise, so
+ * they are range checked before being followed.
+ * */
+uint32_t pool_get_batch(struct pool * p, void ** objs, uint32_t n) {
+    uint64_t head, next;
+    uint32_t idx, got;
+
+    if(!p || !n) {
+        return 0;
     }
-    return ptr;
+
+    head = __atomic_load_n(&p->_head, __ATOMIC_ACQUIRE);
+    do {
+        idx = POOL_HEAD_IDX(head);
+        for(got=0 ; idx && idx <= p->_nobjs && got<n ; got++) {
+            objs[got] = p->_pool_mem + (size_t)(idx - 1) * p->_obj_sz;
+            idx = _pool_next(p, idx);
+        }
+        //a stale link sent us off the pool: the CAS below fails anyway.
+        if(idx > p->_nobjs)
+            idx = 0;
+        if(!got)
+            return 0;
+        next = POOL_HEAD(POOL_HEAD_TAG(head) + 1, idx);
+    } while(!__atomic_compare_exchange_n(&p->_head, &head, next, 1,
+                __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    return got;
 }
 
-int pool_put_ptr(struct pool * p, void * ptr) {
+/* links @first..@last (already chained) in front of the free list */
+static inline void _pool_push(struct pool * p, uint32_t first, uint32_t last) {
+    uint64_t head, next;
 
-    struct list_head * lh = NULL;
-    struct pool_entry * p_e = NULL;
-    uintptr_t addr = (uintptr_t)ptr;
+    //pushes don't need a new tag: only pops can bring an old head back.
+    head = __atomic_load_n(&p->_head, __ATOMIC_RELAXED);
+    do {
+        _pool_set_next(p, last, POOL_HEAD_IDX(head));
+        next = POOL_HEAD(POOL_HEAD_TAG(head), first);
+    } while(!__atomic_compare_exchange_n(&p->_head, &head, next, 1,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+int pool_put_ptr(struct pool * p, void * ptr) {
+    uint32_t idx;
 
     if(!p) {
         return -1;
     }
 
-    //pointer doesn't belong in this pool
-    if (addr < p->_start_addr || addr >= p->_end_addr) {
+    if(!(idx = pool_idx_of(p, ptr))) {
         return -1; //will need to come up with error codes.
     }
 
-    lh = get_fifo(&p->avail_q);
-    if(!lh) {
-        //this would be weird.
+    _pool_push(p, idx, idx);
+    return 0;
+}
+
+/* pushes all of @objs with one CAS. all or nothing: -1 if any of them
+ * isn't @p's. */
+int pool_put_batch(struct pool * p, void ** objs, uint32_t n) {
+    uint32_t first, prev, idx;
+
+    if(!p) {
+        return -1;
+    }
+    if(!n) {
+        return 0;
+    }
+
+    for(uint32_t i=0 ; i<n ; i++) {
+        if(!pool_idx_of(p, objs[i]))
+            return -1;
+    }
+
+    //chain them up privately first, the list sees them all at once.
+    first = prev = pool_idx_of(p, objs[0]);
+    for(uint32_t i=1 ; i<n ; i++) {
+        idx = pool_idx_of(p, objs[i]);
+        _pool_set_next(p, prev, idx);
+        prev = idx;
+    }
+
+    _pool_push(p, first, prev);
+    return 0;
+}
+
+uint32_t pool_nfree(struct pool * p) {
+    uint32_t idx, n = 0;
+
+    if(!p) {
+        return 0;
+    }
+
+    idx = POOL_HEAD_IDX(__atomic_load_n(&p->_head, __ATOMIC_ACQUIRE));
+    for( ; idx && idx <= p->_nobjs && n<p->_nobjs ; idx=_pool_next(p, idx))
+        n++;
+    return n;
+}
+
+/*
+ * The whole free list is taken first, so no get can succeed while we look.
+ * If it's short of _nobjs someone holds objects: it goes back as it was.
+ * Otherwise the pool is ours alone, its pages can go. Stale readers of
+ * the links read zeroes and fail their CAS like before.
+ * */
+int pool_purge(struct pool * p) {
+    uint64_t head;
+    uint32_t first, last, idx;
+    uint32_t n = 0;
+
+    if(!p || !(p->_flags & POOL_MMAP) || (p->_flags & POOL_PURGED)) {
+        return -1;
+    }
+    head = __atomic_load_n(&p->_head, __ATOMIC_ACQUIRE);
+    do {
+        if(!POOL_HEAD_IDX(head))
+            return -1;
+    } while(!__atomic_compare_exchange_n(&p->_head, &head,
+                POOL_HEAD(POOL_HEAD_TAG(head) + 1, 0), 1,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    first = last = POOL_HEAD_IDX(head);
+    for(idx=first ; idx && n<=p->_nobjs ; idx=_pool_next(p, idx)) {
+        last = idx;
+        n++;
+    }
+    if(n != p->_nobjs) {
+        _pool_push(p, first, last);
         return -1;
     }
 
-    p_e = list_entry(lh, struct pool_entry, q_e);
-    p_e->ptr = ptr;
-    put_fifo(&p->pool_q, lh);
-    p->_n_q++;
+    madvise(p->_raw_mem, p->_raw_len, MADV_DONTNEED);
+    p->_flags |= POOL_PURGED;
+    return 0;
+}
+
+int pool_revive(struct pool * p) {
+    if(!p || !(p->_flags & POOL_PURGED)) {
+        return -1;
+    }
 
+    //the pages come back zeroed as they're touched.
+    p->_flags &= ~POOL_PURGED;
+    p->_idle_since = 0;
+    _pool_fill(p);
     return 0;
 }
 
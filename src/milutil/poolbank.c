@@ -1,15 +1,184 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define _BANK_HAVE_RSEQ 1
+#endif
+#endif
 
 #include "pool/poolbank.h"
 #include "pool/pool.h"
 
 static bank_allocator _b_allocator = malloc;
 
+static void * _bank_zalloc(size_t sz) {
+    void * n = _b_allocator(sz);
+
+    if(n)
+        memset(n, 0, sz);
+    return n;
+}
+
+/* the leaf holding @seg, made on the way if missing */
+static struct bank_map_leaf * _bank_map_leaf(struct bank * b, uintptr_t seg) {
+    size_t i1 = seg >> (BANK_MAP_L2_BITS + BANK_MAP_L3_BITS);
+    size_t i2 = (seg >> BANK_MAP_L3_BITS) & ((1 << BANK_MAP_L2_BITS) - 1);
+    struct bank_map_mid * mid = NULL;
+    struct bank_map_leaf * leaf = NULL;
+
+    if(!(mid = b->_map[i1])) {
+        if(!(mid = _bank_zalloc(sizeof(struct bank_map_mid))))
+            return NULL;
+        __atomic_store_n(&b->_map[i1], mid, __ATOMIC_RELEASE);
+    }
+    if(!(leaf = mid->leaf[i2])) {
+        if(!(leaf = _bank_zalloc(sizeof(struct bank_map_leaf))))
+            return NULL;
+        __atomic_store_n(&mid->leaf[i2], leaf, __ATOMIC_RELEASE);
+    }
+    return leaf;
+}
+
+/*
+ * Points every segment @p spans at @p. All the nodes are made before the
+ * first slot is set: a failure leaves no slot pointing at a pool the
+ * caller is about to destroy.
+ * */
+static int _bank_map_add(struct bank * b, struct pool * p) {
+    uintptr_t first = p->_start_addr >> POOL_SEG_SHIFT;
+    uintptr_t last = (p->_end_addr - 1) >> POOL_SEG_SHIFT;
+    uintptr_t seg;
+
+    if(last >> BANK_MAP_BITS) {
+        return -1;
+    }
+
+    for(seg = first ; seg<=last ; seg++) {
+        if(!_bank_map_leaf(b, seg))
+            return -1;
+    }
+    for(seg = first ; seg<=last ; seg++) {
+        __atomic_store_n(&_bank_map_leaf(b, seg)->pool[seg & ((1 << BANK_MAP_L3_BITS) - 1)],
+                p, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static void _bank_map_free(struct bank * b) {
+    for(int i=0 ; i<(1 << BANK_MAP_L1_BITS) ; i++) {
+        if(!b->_map[i])
+            continue;
+        for(int j=0 ; j<(1 << BANK_MAP_L2_BITS) ; j++) {
+            free(b->_map[i]->leaf[j]);
+        }
+        free(b->_map[i]);
+        b->_map[i] = NULL;
+    }
+}
+
+/*
+ * The bits are set and cleared with full barriers in between the pool
+ * and the bitmap accesses: a put that skips a bit someone is clearing is
+ * seen by the clearer's recheck, so a pool with room never stays hidden.
+ * */
+static void _bank_mark_avail(struct bank * b, uint32_t idx) {
+    uint64_t bit = 1ULL << (idx & 63);
+    uint64_t wbit = 1ULL << (idx >> 6);
+
+    if(!(__atomic_load_n(&b->_avail[idx >> 6], __ATOMIC_SEQ_CST) & bit))
+        __atomic_fetch_or(&b->_avail[idx >> 6], bit, __ATOMIC_SEQ_CST);
+    if(!(__atomic_load_n(&b->_avail_sum, __ATOMIC_SEQ_CST) & wbit))
+        __atomic_fetch_or(&b->_avail_sum, wbit, __ATOMIC_SEQ_CST);
+}
+
+static void _bank_clear_avail(struct bank * b, uint32_t idx) {
+    __atomic_fetch_and(&b->_avail[idx >> 6], ~(1ULL << (idx & 63)),
+            __ATOMIC_SEQ_CST);
+    if(!pool_empty(bank_pool(b, idx)))
+        _bank_mark_avail(b, idx);
+}
+
+static void _bank_clear_sum(struct bank * b, uint32_t w) {
+    __atomic_fetch_and(&b->_avail_sum, ~(1ULL << w), __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&b->_avail[w], __ATOMIC_SEQ_CST))
+        __atomic_fetch_or(&b->_avail_sum, 1ULL << w, __ATOMIC_SEQ_CST);
+}
+
+/* largest pool a growing bank adds, see BANK_MAX_POOL_BYTES */
+static uint32_t _bank_max_objs(const struct bank * b) {
+    size_t max = BANK_MAX_POOL_BYTES / (b->_objsz ? b->_objsz : 1);
+
+    if(max > POOL_MAX_OBJS)
+        max = POOL_MAX_OBJS;
+    if(max < b->_poolsz)
+        max = b->_poolsz;
+    return (uint32_t)max;
+}
+
+/* a pool of @sz objects for slot @idx of @b, already in the map */
+static struct pool * _bank_new_pool(struct bank * b, uint32_t idx, uint32_t sz) {
+    struct pool * p = create_pool_flags(sz, b->_objsz, b->_pool_flags);
+
+    if(p && _bank_map_add(b, p)) {
+        destroy_pool(p);
+        p = NULL;
+    }
+    if(p)
+        p->_bank_idx = idx;
+    return p;
+}
+
+/*
+ * Fills the next slot, _grow_mutex held (or the bank not shared yet).
+ * The pool is in its slot before _allocd_pools and its bit say so.
+ * */
+static int _bank_add_pool(struct bank * b, uint32_t sz) {
+    uint32_t idx = b->_allocd_pools;
+    uint32_t k = 31 - __builtin_clz(idx + 1);
+    struct pool * p = NULL;
+
+    if((b->_max_pools && (idx == b->_max_pools)) || idx == BANK_MAX_POOLS) {
+        return -1;
+    }
+
+    //chunk k has 2^k slots, the total doubles with each chunk.
+    if(!b->_dir[k]) {
+        if(!(b->_dir[k] = _bank_zalloc((1U << k) * sizeof(struct pool *))))
+            return -1;
+    }
+
+    if(!(p = _bank_new_pool(b, idx, sz))) {
+        return -1;
+    }
+
+    __atomic_store_n(&b->_dir[k][idx + 1 - (1U << k)], p, __ATOMIC_RELEASE);
+    __atomic_store_n(&b->_allocd_pools, idx + 1, __ATOMIC_RELEASE);
+    _bank_mark_avail(b, idx);
+
+    return 0;
+}
+
 struct bank * create_bank( uint16_t n_pools
                          , int8_t   growing
                          , uint16_t poolsize
                          , size_t   objsize ){
+    return create_bank_flags(n_pools, growing, poolsize, objsize, 0);
+}
+
+struct bank * create_bank_flags( uint16_t n_pools
+                               , int8_t   growing
+                               , uint16_t poolsize
+                               , size_t   objsize
+                               , uint8_t  flags ){
 
     struct bank * b = NULL;
 
@@ -19,29 +188,28 @@ struct bank * create_bank( uint16_t n_pools
     }
     memset(b, 0, sizeof(struct bank));
 
+    if(n_pools > BANK_MAX_POOLS || !poolsize)
+    {
+        free(b);
+        return NULL;
+    }
+
     b->_max_pools = (growing ? 0 : n_pools);
+    b->_growing = growing;
     b->_objsz = objsize;
     b->_poolsz = poolsize;
+    b->_nextsz = 2 * (uint32_t)poolsize;
+    if(b->_nextsz > _bank_max_objs(b))
+        b->_nextsz = _bank_max_objs(b);
+    b->_pool_flags = flags & (POOL_MMAP | POOL_HUGEPAGE);
+    b->_idle_ns = BANK_IDLE_MS * 1000000ULL;
+    pthread_mutex_init(&b->_grow_mutex, NULL);
 
-    if(n_pools > 0)
+    for(int i=0 ; i<n_pools ; i++)
     {
-        if(!(b->bank = _b_allocator(n_pools*sizeof(struct pool *))))
-        {
-                free(b);
-                return NULL;
-        }
-
-        for(int i=0 ; i<n_pools ; i++)
-        {
-            b->bank[i] = create_pool(poolsize, objsize);
-            if(!(b->bank[i])){
-                for(int j = 0 ; j < i ; j++) {
-                    free(b->bank[i]);
-                    free(b);
-                    return NULL;
-                }
-            }
-            b->_allocd_pools++;
+        if(_bank_add_pool(b, poolsize)){
+            destroy_bank(b);
+            return NULL;
         }
     }
     return b;
@@ -58,85 +226,595 @@ int destroy_bank(struct bank * b) {
 
     for(int i=0 ; i<b->_allocd_pools ; i++)
     {
-        ret = destroy_pool(b->bank[i]);
+        ret = destroy_pool(bank_pool(b, i));
         if(ret)
             err++;
 
     }
-    free(b->bank);
+    for(int k=0 ; k<BANK_DIR_CHUNKS ; k++)
+    {
+        free(b->_dir[k]);
+    }
+    _bank_map_free(b);
+    pthread_mutex_destroy(&b->_grow_mutex);
     free(b);
 
     return err;
 }
 
+/* the next pool is twice the last one. O(1) amortized: the directory
+ * doubles by adding a chunk, nothing is copied. */
+static int _bank_grow(struct bank * b) {
+    uint32_t max = _bank_max_objs(b);
+    int ret = 0;
+
+    ret = _bank_add_pool(b, b->_nextsz);
+    if(!ret && b->_nextsz < max)
+        b->_nextsz = (b->_nextsz * 2 < max) ? b->_nextsz * 2 : max;
+
+    return ret;
+}
+
 int add_pool(struct bank * b) {
-    struct pool ** aux_b = NULL;
-    int i=0;
+    int ret = 0;
 
-    if(!b || (b->_max_pools && (b->_allocd_pools == b->_max_pools))) {
+    if(!b) {
         return -1;
     }
 
-    if(!(aux_b = _b_allocator(
-                    (b->_allocd_pools+1)*sizeof(struct pool *)))) {
-        return -1;
+    pthread_mutex_lock(&b->_grow_mutex);
+    ret = _bank_grow(b);
+    pthread_mutex_unlock(&b->_grow_mutex);
+
+    return ret;
+}
+
+/* a purged pool back in service, -1 if there's none */
+static int _bank_revive(struct bank * b) {
+    struct pool * p = NULL;
+
+    for(uint32_t i=0 ; i<b->_allocd_pools ; i++) {
+        p = bank_pool(b, i);
+        if((p->_flags & POOL_PURGED) && !pool_revive(p)) {
+            _bank_mark_avail(b, i);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* brings back a purged pool, or grows @b, unless another thread already
+ * did (or objects came back) while we waited for the lock. */
+static int _bank_refill(struct bank * b) {
+    int ret = 0;
+
+    pthread_mutex_lock(&b->_grow_mutex);
+    if(!__atomic_load_n(&b->_avail_sum, __ATOMIC_SEQ_CST)) {
+        ret = -1;
+        if(b->_npurged && !_bank_revive(b)) {
+            __atomic_store_n(&b->_npurged, b->_npurged - 1, __ATOMIC_RELAXED);
+            ret = 0;
+        } else if(b->_growing) {
+            ret = _bank_grow(b);
+        }
+    }
+    pthread_mutex_unlock(&b->_grow_mutex);
+
+    return ret;
+}
+
+static uint64_t _bank_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Idleness is sampled off the head tag, which every get moves: a pool
+ * whose tag stayed put since a trim at least _idle_ns ago is tried with
+ * pool_purge(), which checks it's all free. Nothing is counted on the
+ * get/put paths for this.
+ * */
+int bank_trim(struct bank * b) {
+    struct pool * p = NULL;
+    uint64_t now;
+    uint32_t tag;
+    int purged = 0;
+
+    if(!b || !(b->_pool_flags & POOL_MMAP)) {
+        return 0;
+    }
+    //someone's growing or trimming already, next time.
+    if(pthread_mutex_trylock(&b->_grow_mutex)) {
+        return 0;
     }
 
-    for(i=0; i<b->_allocd_pools ; i++) {
-        aux_b[i]=b->bank[i];
+    now = _bank_now();
+    for(uint32_t i=0 ; i<b->_allocd_pools ; i++) {
+        p = bank_pool(b, i);
+        if(p->_flags & POOL_PURGED)
+            continue;
+        tag = POOL_HEAD_TAG(__atomic_load_n(&p->_head, __ATOMIC_RELAXED));
+        if(!p->_idle_since || tag != p->_idle_tag) {
+            p->_idle_tag = tag;
+            p->_idle_since = now;
+            continue;
+        }
+        if(now - p->_idle_since < b->_idle_ns)
+            continue;
+        if(!pool_purge(p)) {
+            _bank_clear_avail(b, i);
+            purged++;
+            __atomic_store_n(&b->_npurged, b->_npurged + 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        //objects still out (the purge moved the tag): wait another round.
+        p->_idle_tag = POOL_HEAD_TAG(__atomic_load_n(&p->_head, __ATOMIC_RELAXED));
+        p->_idle_since = now;
     }
+    pthread_mutex_unlock(&b->_grow_mutex);
+
+    return purged;
+}
 
-    aux_b[i] = create_pool(b->_poolsz, b->_objsz);
-    if(!aux_b[i]) {
-        free(aux_b);
+int _bank_trim_tick(struct bank * b) {
+    struct timespec ts;
+    uint64_t now, last;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    now = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    last = __atomic_load_n(&b->_last_trim, __ATOMIC_RELAXED);
+
+    //a pool is purged on the second trim that finds it idle.
+    if(now - last < b->_idle_ns / 2)
+        return 0;
+    //one thread per tick.
+    if(!__atomic_compare_exchange_n(&b->_last_trim, &last, now, 0,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return 0;
+    return bank_trim(b);
+}
+
+void bank_set_idle(struct bank * b, uint32_t idle_ms) {
+    if(!b)
+        return;
+    b->_idle_ns = (uint64_t)idle_ms * 1000000ULL;
+}
+
+/*
+ * Straight to a pool the bitmap says has room. Pools found empty on the
+ * way get their bit cleared, so each exhausted pool is visited once
+ * rather than on every get.
+ *
+ * Takes as many objects per pool as it can, one CAS each. A growing bank
+ * only grows if nothing at all was found.
+ * */
+uint32_t bank_get_batch(struct bank * b, void ** objs, uint32_t n) {
+    uint64_t sum, word;
+    uint32_t w, idx;
+    uint32_t got = 0;
+
+    if(!b) {
+        return 0;
+    }
+
+    while(got < n) {
+        sum = __atomic_load_n(&b->_avail_sum, __ATOMIC_SEQ_CST);
+        if(!sum) {
+            //out of objects: purged pools come back, growing banks add
+            //a pool, and we go again.
+            if(got || (!b->_growing &&
+                        !__atomic_load_n(&b->_npurged, __ATOMIC_RELAXED)) ||
+                    _bank_refill(b))
+                break;
+            continue;
+        }
+
+        w = __builtin_ctzll(sum);
+        word = __atomic_load_n(&b->_avail[w], __ATOMIC_SEQ_CST);
+        if(!word) {
+            _bank_clear_sum(b, w);
+            continue;
+        }
+
+        idx = (w << 6) + __builtin_ctzll(word);
+        got += pool_get_batch(bank_pool(b, idx), objs + got, n - got);
+        if(got < n)
+            _bank_clear_avail(b, idx);
+    }
+
+    return got;
+}
+
+void * bank_get_ptr(struct bank * b) {
+    void * ptr = NULL;
+
+    bank_get_batch(b, &ptr, 1);
+    return ptr;
+}
+
+struct pool * bank_pool_of(struct bank * b, void * p) {
+    uintptr_t seg = (uintptr_t)p >> POOL_SEG_SHIFT;
+    struct bank_map_mid * mid = NULL;
+    struct bank_map_leaf * leaf = NULL;
+
+    if(!b || (seg >> BANK_MAP_BITS)) {
+        return NULL;
+    }
+
+    mid = __atomic_load_n(&b->_map[seg >> (BANK_MAP_L2_BITS + BANK_MAP_L3_BITS)],
+            __ATOMIC_ACQUIRE);
+    if(!mid)
+        return NULL;
+    leaf = __atomic_load_n(&mid->leaf[(seg >> BANK_MAP_L3_BITS) &
+            ((1 << BANK_MAP_L2_BITS) - 1)], __ATOMIC_ACQUIRE);
+    if(!leaf)
+        return NULL;
+    return __atomic_load_n(&leaf->pool[seg & ((1 << BANK_MAP_L3_BITS) - 1)],
+            __ATOMIC_ACQUIRE);
+}
+
+/*
+ * The owning pool comes from the segment map, however many pools there
+ * are. Pointers that aren't ours (e.g. malloc'ed when the pools ran out)
+ * miss the map, or fail the pool's own range check.
+ * */
+int bank_put_ptr(struct bank * b, void * p) {
+    struct pool * pool = bank_pool_of(b, p);
+
+    if(!pool || pool_put_ptr(pool, p)) {
         return -1;
     }
 
-    b->_allocd_pools++;
-    free(b->bank);
-    b->bank = aux_b;
+    //pairs with the recheck in _bank_clear_avail().
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    _bank_mark_avail(b, pool->_bank_idx);
+    return 0;
+}
+
+/*
+ * Runs of objects from the same pool go back with one CAS. Returns how
+ * many of @objs weren't the bank's, those are left alone.
+ * */
+uint32_t bank_put_batch(struct bank * b, void ** objs, uint32_t n) {
+    struct pool * pool = NULL;
+    uint32_t i, run;
+    uint32_t bad = 0;
+
+    for(i=0 ; i<n ; i+=run) {
+        pool = bank_pool_of(b, objs[i]);
+        for(run=1 ; i+run<n && bank_pool_of(b, objs[i + run])==pool ; run++)
+            ;
+        if(!pool) {
+            bad += run;
+            continue;
+        }
+        if(pool_put_batch(pool, objs + i, run)) {
+            //someone else's object in the run, one at a time then.
+            for(uint32_t j=i ; j<i+run ; j++)
+                bad += !!pool_put_ptr(pool, objs[j]);
+        }
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        _bank_mark_avail(b, pool->_bank_idx);
+    }
+    return bad;
+}
+
+void * bank_mag_refill(struct bank * b, struct bank_magazine * m) {
+    m->n = bank_get_batch(b, m->obj, BANK_MAG_BATCH);
+    if(!m->n)
+        return NULL;
+    return m->obj[--m->n];
+}
+
+void bank_mag_drain(struct bank * b, struct bank_magazine * m) {
+    uint32_t keep = m->n - BANK_MAG_BATCH;
+
+    //the oldest ones go, the ones just freed are the cache-hot ones.
+    bank_put_batch(b, m->obj, BANK_MAG_BATCH);
+    memmove(m->obj, m->obj + BANK_MAG_BATCH, keep * sizeof(void *));
+    m->n = keep;
+}
+
+void bank_mag_flush(struct bank * b, struct bank_magazine * m) {
+    if(!b || !m)
+        return;
+    bank_put_batch(b, m->obj, m->n);
+    m->n = 0;
+}
 
+#ifdef _BANK_HAVE_RSEQ
+/*
+ * rseq critical sections, after librseq's x86_64 ones. The kernel
+ * restarts at 4: (the abort handler, with libc's signature in front of
+ * it) if the thread is preempted, migrated or signalled between 1: and
+ * 2:. The one store at 2: commits. Both fail over to the abort label,
+ * the caller reads the CPU again and retries.
+ * */
+#define _RSEQ_CS_DESC \
+    ".pushsection __rseq_cs, \"aw\"\n\t" \
+    ".balign 32\n\t" \
+    "3:\n\t" \
+    ".long 0x0, 0x0\n\t" \
+    ".quad 1f, (2f - 1f), 4f\n\t" \
+    ".popsection\n\t" \
+    "leaq 3b(%%rip), %%rax\n\t" \
+    "movq %%rax, %[rseq_cs]\n\t"
+
+#define _RSEQ_ABORT \
+    ".pushsection __rseq_failure, \"ax\"\n\t" \
+    ".byte 0x0f, 0xb9, 0x3d\n\t" \
+    ".long 0x53053053\n\t" \
+    "4:\n\t" \
+    "jmp %l[abort]\n\t" \
+    ".popsection\n\t"
+
+static inline struct rseq * _bank_rseq(void) {
+    return (struct rseq *)((char *)__builtin_thread_pointer() + __rseq_offset);
+}
+
+static inline int _bank_rseq_usable(void) {
+    return (__rseq_size >= 20 && (int32_t)_bank_rseq()->cpu_id >= 0);
+}
+
+/* 0: popped into @out, 1: cache empty, -1: aborted */
+static inline int _rseq_pop(struct rseq * rs, struct bank_pcpu_cache * cc,
+        uint32_t cpu, void ** out) {
+    __asm__ __volatile__ goto (
+        _RSEQ_CS_DESC
+        "1:\n\t"
+        "cmpl %[cpu], %[cpu_id]\n\t"
+        "jnz 4f\n\t"
+        "movl %[n], %%ecx\n\t"
+        "testl %%ecx, %%ecx\n\t"
+        "jz %l[empty]\n\t"
+        "subl $1, %%ecx\n\t"
+        "movq (%[objs], %%rcx, 8), %%rax\n\t"
+        "movq %%rax, (%[out])\n\t"
+        "movl %%ecx, %[n]\n\t"
+        "2:\n\t"
+        _RSEQ_ABORT
+        :
+        : [cpu_id] "m" (rs->cpu_id), [rseq_cs] "m" (rs->rseq_cs),
+          [cpu] "r" (cpu), [n] "m" (cc->n), [objs] "r" (cc->obj),
+          [out] "r" (out)
+        : "memory", "cc", "rax", "rcx"
+        : empty, abort);
+    return 0;
+empty:
+    return 1;
+abort:
+    return -1;
+}
+
+/* 0: pushed @p, 1: cache full, -1: aborted */
+static inline int _rseq_push(struct rseq * rs, struct bank_pcpu_cache * cc,
+        uint32_t cpu, void * p) {
+    __asm__ __volatile__ goto (
+        _RSEQ_CS_DESC
+        "1:\n\t"
+        "cmpl %[cpu], %[cpu_id]\n\t"
+        "jnz 4f\n\t"
+        "movl %[n], %%ecx\n\t"
+        "cmpl %[cap], %%ecx\n\t"
+        "jae %l[full]\n\t"
+        "movq %[p], (%[objs], %%rcx, 8)\n\t"
+        "addl $1, %%ecx\n\t"
+        "movl %%ecx, %[n]\n\t"
+        "2:\n\t"
+        _RSEQ_ABORT
+        :
+        : [cpu_id] "m" (rs->cpu_id), [rseq_cs] "m" (rs->rseq_cs),
+          [cpu] "r" (cpu), [n] "m" (cc->n), [objs] "r" (cc->obj),
+          [p] "r" (p), [cap] "i" (2 * BANK_MAG_BATCH)
+        : "memory", "cc", "rax", "rcx"
+        : full, abort);
     return 0;
+full:
+    return 1;
+abort:
+    return -1;
+}
+#endif
+
+static inline void _pcpu_lock(struct bank_pcpu_cache * cc) {
+    while(__atomic_exchange_n(&cc->lock, 1, __ATOMIC_ACQUIRE)) {
+        while(__atomic_load_n(&cc->lock, __ATOMIC_RELAXED))
+            sched_yield();
+    }
+}
+
+static inline void _pcpu_unlock(struct bank_pcpu_cache * cc) {
+    __atomic_store_n(&cc->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* the calling CPU's cache: 0 popped, 1 empty, -1 no cache to use */
+static int _pcpu_pop(struct bank_pcpu * c, void ** out) {
+    struct bank_pcpu_cache * cc = NULL;
+    int cpu, ret;
+
+#ifdef _BANK_HAVE_RSEQ
+    if(c->mode == BANK_PCPU_RSEQ) {
+        struct rseq * rs = _bank_rseq();
+
+        if((int32_t)rs->cpu_id < 0)
+            return -1;
+        do {
+            cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+            if((uint32_t)cpu >= c->ncpus)
+                return -1;
+            ret = _rseq_pop(rs, &c->caches[cpu], cpu, out);
+        } while(ret < 0);
+        return ret;
+    }
+#endif
+    cpu = sched_getcpu();
+    if(cpu < 0 || (uint32_t)cpu >= c->ncpus)
+        return -1;
+
+    cc = &c->caches[cpu];
+    _pcpu_lock(cc);
+    ret = 1;
+    if(cc->n) {
+        *out = cc->obj[--cc->n];
+        ret = 0;
+    }
+    _pcpu_unlock(cc);
+    return ret;
+}
+
+/* the calling CPU's cache: 0 pushed, 1 full, -1 no cache to use */
+static int _pcpu_push(struct bank_pcpu * c, void * p) {
+    struct bank_pcpu_cache * cc = NULL;
+    int cpu, ret;
+
+#ifdef _BANK_HAVE_RSEQ
+    if(c->mode == BANK_PCPU_RSEQ) {
+        struct rseq * rs = _bank_rseq();
+
+        if((int32_t)rs->cpu_id < 0)
+            return -1;
+        do {
+            cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+            if((uint32_t)cpu >= c->ncpus)
+                return -1;
+            ret = _rseq_push(rs, &c->caches[cpu], cpu, p);
+        } while(ret < 0);
+        return ret;
+    }
+#endif
+    cpu = sched_getcpu();
+    if(cpu < 0 || (uint32_t)cpu >= c->ncpus)
+        return -1;
+
+    cc = &c->caches[cpu];
+    _pcpu_lock(cc);
+    ret = 1;
+    if(cc->n < 2 * BANK_MAG_BATCH) {
+        cc->obj[cc->n++] = p;
+        ret = 0;
+    }
+    _pcpu_unlock(cc);
+    return ret;
+}
+
+struct bank_pcpu * create_bank_pcpu(struct bank * b, uint8_t mode) {
+    struct bank_pcpu * c = NULL;
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    size_t sz;
+
+    if(!b || ncpus < 1) {
+        return NULL;
+    }
+
+#ifdef _BANK_HAVE_RSEQ
+    if(mode == BANK_PCPU_ANY)
+        mode = _bank_rseq_usable() ? BANK_PCPU_RSEQ : BANK_PCPU_LOCK;
+    if(mode == BANK_PCPU_RSEQ && !_bank_rseq_usable())
+        return NULL;
+#else
+    if(mode == BANK_PCPU_ANY)
+        mode = BANK_PCPU_LOCK;
+    if(mode == BANK_PCPU_RSEQ)
+        return NULL;
+#endif
+
+    if(!(c = _b_allocator(sizeof(struct bank_pcpu)))) {
+        return NULL;
+    }
+    c->b = b;
+    c->ncpus = (uint32_t)ncpus;
+    c->mode = mode;
+
+    //one cache line (or more) per CPU, nothing shared between them.
+    sz = c->ncpus * sizeof(struct bank_pcpu_cache);
+    if(!(c->_raw = _bank_zalloc(sz + 64))) {
+        free(c);
+        return NULL;
+    }
+    c->caches = (struct bank_pcpu_cache *)(((uintptr_t)c->_raw + 63) & ~(uintptr_t)63);
+
+    return c;
+}
+
+void destroy_bank_pcpu(struct bank_pcpu * c) {
+    if(!c)
+        return;
+
+    for(uint32_t i=0 ; i<c->ncpus ; i++) {
+        bank_put_batch(c->b, c->caches[i].obj, c->caches[i].n);
+    }
+    free(c->_raw);
+    free(c);
 }
 
 /*
- * gotta decide about insertion order.
- * For the time being, we try to linear insertion. Not a
- * big deal cause pool banks should contain a small number
- * of pools. Give this some thought though.
+ * An empty cache is refilled with a batch from the bank. Whatever doesn't
+ * fit (we may have moved CPU meanwhile, someone may have filled it) goes
+ * back to the bank.
  * */
-void * bank_get_ptr(struct bank * b) {
+void * bank_pcpu_get(struct bank_pcpu * c) {
+    void * objs[BANK_MAG_BATCH];
     void * ptr = NULL;
+    uint32_t got, i;
 
-    if(!b) {
+    if(!c) {
         return NULL;
     }
 
-    //yes O(n) put n is small.
-    for(int i = 0 ; i<b->_allocd_pools ; i++) {
-        ptr = pool_get_ptr(b->bank[i]);
-        if(ptr)
+    switch(_pcpu_pop(c, &ptr)) {
+        case 0:
+            return ptr;
+        case -1:
+            return bank_get_ptr(c->b);
+    }
+
+    if(!(got = bank_get_batch(c->b, objs, BANK_MAG_BATCH))) {
+        return NULL;
+    }
+    for(i=1 ; i<got ; i++) {
+        if(_pcpu_push(c, objs[i]))
             break;
     }
+    if(i < got)
+        bank_put_batch(c->b, objs + i, got - i);
 
-    return ptr;
+    return objs[0];
 }
 
-int bank_put_ptr(struct bank * b, void * p) {
-    int ret = 0;
+/*
+ * A full cache gives a batch back to the bank first.
+ * */
+int bank_pcpu_put(struct bank_pcpu * c, void * p) {
+    void * objs[BANK_MAG_BATCH];
+    struct pool * pool = NULL;
+    uint32_t n;
 
-    if(!b) {
+    if(!c) {
+        return -1;
+    }
+    pool = bank_pool_of(c->b, p);
+    if(!pool || !pool_idx_of(pool, p)) {
         return -1;
     }
 
-    //yes O(n) put n is small.
-    for(int i = 0 ; i<b->_allocd_pools ; i++) {
-        ret = pool_put_ptr(b->bank[i], p);
-        if(!ret)
+    switch(_pcpu_push(c, p)) {
+        case 0:
+            return 0;
+        case -1:
+            return bank_put_ptr(c->b, p);
+    }
+
+    for(n=0 ; n<BANK_MAG_BATCH ; n++) {
+        if(_pcpu_pop(c, &objs[n]))
             break;
     }
+    bank_put_batch(c->b, objs, n);
 
-    return ret;
+    if(_pcpu_push(c, p))
+        return bank_put_ptr(c->b, p);
+    return 0;
 }
 
 void custom_b_allocator(bank_allocator allocator) {
@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtbl/ptrtbl.h"
+
+static ptr_table_allocator _pt_allocator = malloc;
+static ptr_table_deallocator _pt_deallocator = free;
+
+static inline size_t ptr_table_next(const struct ptr_table *t, size_t i)
+{
+    return (i + 1) & (t->capacity - 1);
+}
+
+/*
+ * Returns the slot holding @key, or the empty slot that ends its probe
+ * sequence.
+ */
+static inline struct ptr_slot *ptr_table_probe(const struct ptr_table *t,
+        uintptr_t key)
+{
+    size_t i = ptr_table_slot_of(t, key);
+
+    while(t->slots[i].key && t->slots[i].key != key)
+        i = ptr_table_next(t, i);
+
+    return &t->slots[i];
+}
+
+static int ptr_table_alloc(struct ptr_table *t, unsigned int bits)
+{
+    size_t cap = (size_t)1 << bits;
+
+    if(!(t->slots = _pt_allocator(cap * sizeof(struct ptr_slot))))
+        return -1;
+    memset(t->slots, 0, cap * sizeof(struct ptr_slot));
+
+    t->capacity = cap;
+    t->_bits = bits;
+    t->_resize_threshold = PTR_TABLE_MAX_LOAD(cap);
+
+    return 0;
+}
+
+int ptr_table_init(struct ptr_table *t, size_t n)
+{
+    unsigned int bits = PTR_TABLE_MIN_BITS;
+
+    pthread_mutex_init(&(t->lock), NULL);
+    t->_nentries = 0;
+
+    while(bits < PTR_TABLE_MAX_BITS && PTR_TABLE_MAX_LOAD((size_t)1 << bits) < n)
+        bits++;
+
+    return ptr_table_alloc(t, bits);
+}
+
+void ptr_table_finit(struct ptr_table *t)
+{
+    if(t->slots)
+        _pt_deallocator(t->slots);
+    t->slots = NULL;
+    t->capacity = 0;
+    t->_nentries = 0;
+    pthread_mutex_destroy(&(t->lock));
+}
+
+/* doubles the slot array and rehashes every key into it. */
+static int ptr_table_resize(struct ptr_table *t)
+{
+    struct ptr_slot *old = t->slots;
+    size_t old_cap = t->capacity;
+    size_t i;
+
+    if(t->_bits >= PTR_TABLE_MAX_BITS)
+        return -1;
+
+    if(ptr_table_alloc(t, t->_bits + 1))
+    {
+        t->slots = old;
+        return -1;
+    }
+
+    for( i=0 ; i<old_cap ; i++ )
+    {
+        if(old[i].key)
+            *ptr_table_probe(t, old[i].key) = old[i];
+    }
+
+    _pt_deallocator(old);
+    return 0;
+}
+
+int ptr_table_insert(struct ptr_table *t, uintptr_t key, void *val)
+{
+    struct ptr_slot *s;
+
+    if(!key)
+        return -1;
+
+    s = ptr_table_probe(t, key);
+    if(s->key)
+    {
+        s->val = val;
+        return 0;
+    }
+
+    if(t->_nentries >= t->_resize_threshold)
+    {
+        //keep going while we fit: a full table would never terminate a probe.
+        if(ptr_table_resize(t) && t->_nentries + 1 >= t->capacity)
+            return -1;
+        s = ptr_table_probe(t, key);
+    }
+
+    s->key = key;
+    s->val = val;
+    t->_nentries++;
+
+    return 0;
+}
+
+void *ptr_table_lookup(const struct ptr_table *t, uintptr_t key)
+{
+    struct ptr_slot *s;
+
+    if(!key)
+        return NULL;
+
+    s = ptr_table_probe(t, key);
+    return (s->key ? s->val : NULL);
+}
+
+void *ptr_table_del(struct ptr_table *t, uintptr_t key)
+{
+    struct ptr_slot *s;
+    size_t i, j, home;
+    void *val;
+
+    if(!key)
+        return NULL;
+
+    s = ptr_table_probe(t, key);
+    if(!s->key)
+        return NULL;
+
+    val = s->val;
+    i = (size_t)(s - t->slots);
+
+    /*
+     * Backward shift: pull later members of the run into the hole unless
+     * their home slot lies cyclically in (i, j], where they'd become
+     * unreachable.
+     */
+    for( j = ptr_table_next(t, i) ; t->slots[j].key ; j = ptr_table_next(t, j) )
+    {
+        home = ptr_table_slot_of(t, t->slots[j].key);
+        if( (j > i && (home <= i || home > j)) ||
+            (j < i && (home <= i && home > j)) )
+        {
+            t->slots[i] = t->slots[j];
+            i = j;
+        }
+    }
+    t->slots[i].key = 0;
+    t->slots[i].val = NULL;
+    t->_nentries--;
+
+    return val;
+}
+
+int ptr_table_insert_safe(struct ptr_table *t, uintptr_t key, void *val)
+{
+    int ret;
+
+    ptr_table_lock(t);
+    ret = ptr_table_insert(t, key, val);
+    ptr_table_unlock(t);
+
+    return ret;
+}
+
+void *ptr_table_lookup_safe(struct ptr_table *t, uintptr_t key)
+{
+    void *val;
+
+    ptr_table_lock(t);
+    val = ptr_table_lookup(t, key);
+    ptr_table_unlock(t);
+
+    return val;
+}
+
+void *ptr_table_del_safe(struct ptr_table *t, uintptr_t key)
+{
+    void *val;
+
+    ptr_table_lock(t);
+    val = ptr_table_del(t, key);
+    ptr_table_unlock(t);
+
+    return val;
+}
+
+void custom_pt_allocator(ptr_table_allocator allocator,
+        ptr_table_deallocator deallocator)
+{
+    if(!allocator || !deallocator)
+        return;
+    _pt_allocator = allocator;
+    _pt_deallocator = deallocator;
+
+    return;
+}
@@ -0,0 +1,350 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "hashtbl/swisstbl.h"
+
+static inline size_t swiss_group_mask(const struct swiss_table *t)
+{
+    return ((size_t)1 << t->_bits) - 1;
+}
+
+/*
+ * Integer keys are stored by value (see hash_entry_init()), compare the
+ * copy in the slot inline; only string keys go through keycmp.
+ */
+static inline int swiss_key_eq(const struct swiss_table *t,
+        const struct swiss_slot *slot, const void *key, size_t len, char skey)
+{
+    if(!skey)
+        return (slot->key == key);
+    return (slot->e->klen == len && t->keycmp(slot->key, key, len) == 0);
+}
+
+static int swiss_table_alloc(struct swiss_table *t, unsigned int bits)
+{
+    size_t cap = (size_t)SWISS_GROUP << bits;
+
+    if(!(t->ctrl = (int8_t *)malloc(cap)))
+        return -1;
+
+    if(!(t->slots = (struct swiss_slot *)malloc(cap * sizeof(struct swiss_slot))))
+    {
+        free(t->ctrl);
+        t->ctrl = NULL;
+        return -1;
+    }
+
+    memset(t->ctrl, SWISS_EMPTY, cap);
+    memset(t->slots, 0, cap * sizeof(struct swiss_slot));
+    t->capacity = cap;
+    t->_bits = bits;
+    t->_nentries = 0;
+    t->_ndeleted = 0;
+
+    return 0;
+}
+
+int swiss_table_init(struct swiss_table *t, unsigned int n,
+        keycmp_ptr keycmp, __hash hash_fn)
+{
+    unsigned int bits = SWISS_MIN_BITS;
+
+    if(!hash_fn)
+        return -1;
+
+    pthread_mutex_init(&(t->lock), NULL);
+    t->my_hash_fn = hash_fn;
+    t->keycmp = (keycmp ? keycmp : memcmp);
+
+    while(bits < SWISS_MAX_BITS &&
+            SWISS_MAX_LOAD((size_t)SWISS_GROUP << bits) < n)
+        bits++;
+
+    return swiss_table_alloc(t, bits);
+}
+
+void swiss_table_finit(struct swiss_table *t)
+{
+    if(t->ctrl)
+        free(t->ctrl);
+    if(t->slots)
+        free(t->slots);
+    t->ctrl = NULL;
+    t->slots = NULL;
+    t->capacity = 0;
+    t->_nentries = 0;
+    t->_ndeleted = 0;
+    pthread_mutex_destroy(&(t->lock));
+}
+
+/* returns the slot holding the key, -1 if there's none */
+static inline ssize_t swiss_table_find(const struct swiss_table *t,
+        const void *key, size_t len, char skey)
+{
+    uint32_t hash = swiss_table_hash(t, key, len);
+    int8_t h2 = swiss_h2(hash);
+    size_t mask = swiss_group_mask(t);
+    size_t g = swiss_h1(t, hash);
+    size_t step = 0;
+
+    for(;;)
+    {
+        const int8_t *ctrl = t->ctrl + g * SWISS_GROUP;
+        uint32_t m = swiss_group_match(ctrl, h2);
+
+        while(m)
+        {
+            size_t s = g * SWISS_GROUP + __builtin_ctz(m);
+
+            if(swiss_key_eq(t, &t->slots[s], key, len, skey))
+                return (ssize_t)s;
+            m &= m - 1;
+        }
+
+        //an empty slot ends the probe sequence.
+        if(swiss_group_match_empty(ctrl) || step == mask)
+            return -1;
+
+        g = (g + ++step) & mask;
+    }
+}
+
+/* puts @e in the first free slot along its probe sequence, no growth */
+static inline void swiss_table_place(struct swiss_table *t,
+        struct hash_entry *e, uint32_t hash)
+{
+    size_t mask = swiss_group_mask(t);
+    size_t g = swiss_h1(t, hash);
+    size_t step = 0;
+    uint32_t m;
+    size_t s;
+
+    while(!(m = swiss_group_match_free(t->ctrl + g * SWISS_GROUP)))
+        g = (g + ++step) & mask;
+
+    s = g * SWISS_GROUP + __builtin_ctz(m);
+    if(t->ctrl[s] == SWISS_DELETED)
+        t->_ndeleted--;
+    t->ctrl[s] = swiss_h2(hash);
+    t->slots[s].key = e->key;
+    t->slots[s].e = e;
+    t->_nentries++;
+}
+
+/*
+ * Rebuilds the table, doubling it if it is more than 7/16 full. Otherwise
+ * the point is just to get rid of tombstones.
+ */
+static int swiss_table_rehash(struct swiss_table *t)
+{
+    int8_t *old_ctrl = t->ctrl;
+    struct swiss_slot *old_slots = t->slots;
+    size_t old_cap = t->capacity;
+    size_t nentries = t->_nentries;
+    size_t ndeleted = t->_ndeleted;
+    unsigned int bits = t->_bits;
+    size_t i;
+
+    if(nentries + 1 > SWISS_MAX_LOAD(old_cap) / 2)
+    {
+        if(bits >= SWISS_MAX_BITS)
+            return -1;
+        bits++;
+    }
+
+    if(swiss_table_alloc(t, bits))
+    {
+        t->ctrl = old_ctrl;
+        t->slots = old_slots;
+        t->capacity = old_cap;
+        t->_nentries = nentries;
+        t->_ndeleted = ndeleted;
+        return -1;
+    }
+
+    for( i=0 ; i<old_cap ; i++ )
+    {
+        struct hash_entry *e = old_slots[i].e;
+
+        if(old_ctrl[i] >= 0)
+            swiss_table_place(t, e, swiss_table_hash(t, e->key, e->klen));
+    }
+
+    free(old_ctrl);
+    free(old_slots);
+    return 0;
+}
+
+static int swiss_table_insert(struct swiss_table *t, struct hash_entry *e)
+{
+    if(t->_nentries + t->_ndeleted + 1 > SWISS_MAX_LOAD(t->capacity))
+    {
+        if(swiss_table_rehash(t))
+            return -1;
+    }
+
+    swiss_table_place(t, e, swiss_table_hash(t, e->key, e->klen));
+    return 0;
+}
+
+static struct hash_entry *swiss_table_del_key(struct swiss_table *t,
+        const void *key, size_t len, char skey)
+{
+    struct hash_entry *e;
+    ssize_t s;
+
+    if((s = swiss_table_find(t, key, len, skey)) < 0)
+        return NULL;
+
+    e = t->slots[s].e;
+    t->slots[s].key = NULL;
+    t->slots[s].e = NULL;
+    t->_nentries--;
+
+    /*
+     * If the group still has an empty slot, probes already stop here and
+     * the slot can go back to empty. Otherwise leave a tombstone so probe
+     * sequences that went through a full group keep going.
+     */
+    if(swiss_group_match_empty(t->ctrl + (s & ~(ssize_t)(SWISS_GROUP-1))))
+    {
+        t->ctrl[s] = SWISS_EMPTY;
+    }
+    else
+    {
+        t->ctrl[s] = SWISS_DELETED;
+        t->_ndeleted++;
+    }
+
+    return e;
+}
+
+int swiss_table_insert_i(struct swiss_table *t, struct hash_entry *e,
+        const uintptr_t key, size_t len)
+{
+    if(hash_entry_init(e, (const void *)key, len, 0))
+        return -1;
+    return swiss_table_insert(t, e);
+}
+
+int swiss_table_insert_s(struct swiss_table *t, struct hash_entry *e,
+        const char *key, size_t len)
+{
+    if(hash_entry_init(e, (const void *)key, len, 1))
+        return -1;
+    return swiss_table_insert(t, e);
+}
+
+struct hash_entry *swiss_table_lookup_key_i(const struct swiss_table *t,
+        const uintptr_t key, size_t len)
+{
+    ssize_t s;
+
+    if(len > sizeof(uintptr_t))
+        return NULL;
+
+    s = swiss_table_find(t, (const void *)key, len, 0);
+    return (s < 0 ? NULL : t->slots[s].e);
+}
+
+struct hash_entry *swiss_table_lookup_key_s(const struct swiss_table *t,
+        const char *key, size_t len)
+{
+    ssize_t s = swiss_table_find(t, (const void *)key, len, 1);
+
+    return (s < 0 ? NULL : t->slots[s].e);
+}
+
+struct hash_entry *swiss_table_del_key_i(struct swiss_table *t,
+        const uintptr_t key, size_t len)
+{
+    if(len > sizeof(uintptr_t))
+        return NULL;
+
+    return swiss_table_del_key(t, (const void *)key, len, 0);
+}
+
+struct hash_entry *swiss_table_del_key_s(struct swiss_table *t,
+        const char *key, size_t len)
+{
+    return swiss_table_del_key(t, (const void *)key, len, 1);
+}
+
+int swiss_table_insert_safe_i(struct swiss_table *t, struct hash_entry *e,
+        const uintptr_t key, size_t len)
+{
+    int ret;
+
+    if(hash_entry_init(e, (const void *)key, len, 0))
+        return -1;
+
+    swiss_table_lock(t);
+    ret = swiss_table_insert(t, e);
+    swiss_table_unlock(t);
+
+    return ret;
+}
+
+int swiss_table_insert_safe_s(struct swiss_table *t, struct hash_entry *e,
+        const char *key, size_t len)
+{
+    int ret;
+
+    if(hash_entry_init(e, (const void *)key, len, 1))
+        return -1;
+
+    swiss_table_lock(t);
+    ret = swiss_table_insert(t, e);
+    swiss_table_unlock(t);
+
+    return ret;
+}
+
+struct hash_entry *swiss_table_lookup_key_safe_i(struct swiss_table *t,
+        const uintptr_t key, size_t len)
+{
+    struct hash_entry *e;
+
+    swiss_table_lock(t);
+    e = swiss_table_lookup_key_i(t, key, len);
+    swiss_table_unlock(t);
+
+    return e;
+}
+
+struct hash_entry *swiss_table_lookup_key_safe_s(struct swiss_table *t,
+        const char *key, size_t len)
+{
+    struct hash_entry *e;
+
+    swiss_table_lock(t);
+    e = swiss_table_lookup_key_s(t, key, len);
+    swiss_table_unlock(t);
+
+    return e;
+}
+
+struct hash_entry *swiss_table_del_key_safe_i(struct swiss_table *t,
+        const uintptr_t key, size_t len)
+{
+    struct hash_entry *e;
+
+    swiss_table_lock(t);
+    e = swiss_table_del_key_i(t, key, len);
+    swiss_table_unlock(t);
+
+    return e;
+}
+
+struct hash_entry *swiss_table_del_key_safe_s(struct swiss_table *t,
+        const char *key, size_t len)
+{
+    struct hash_entry *e;
+
+    swiss_table_lock(t);
+    e = swiss_table_del_key_s(t, key, len);
+    swiss_table_unlock(t);
+
+    return e;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "milu.h"
+#include "hashtbl/hashtbl.h"
+
+/*
+ * One at a time vs batched lookups and deletes on a table much larger
+ * than the caches, keys in random order. Single lookups wait on each
+ * bucket head and chain miss in turn, the batch calls prefetch those for
+ * several keys before walking any chain.
+ *
+ * usage: bench_batch [n_entries]
+ * */
+
+#define DEF_ENTRIES 1000000
+
+struct bench_entry {
+    struct hash_entry hentry;
+    uint64_t pad; /* malloc'ish object size */
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_entry **entries = NULL;
+    struct hash_entry **out = NULL;
+    uintptr_t *keys = NULL;
+    struct hash_table t;
+    uint32_t n = DEF_ENTRIES;
+    uint32_t i, j, half;
+    uintptr_t tmp;
+    size_t found;
+    double start, elapsed;
+
+    if(argc > 1)
+        n = (uint32_t)strtoul(argv[1], NULL, 10);
+    if(n < 2)
+        return 1;
+    half = n / 2;
+
+    if(!(entries = calloc(n, sizeof(struct bench_entry *))) ||
+            !(keys = calloc(n, sizeof(uintptr_t))) ||
+            !(out = calloc(n, sizeof(struct hash_entry *))))
+        return 1;
+
+    if(hash_table_init(&t, 16, hash64_cmp, milu_hash_ptr))
+        return 1;
+
+    for( i=0 ; i<n ; i++ )
+    {
+        if(!(entries[i] = malloc(sizeof(struct bench_entry))))
+            return 1;
+        hash_table_insert_safe_i( &t, &entries[i]->hentry,
+                (const uintptr_t)entries[i], sizeof(uintptr_t) );
+        keys[i] = (uintptr_t)entries[i];
+    }
+    hash_table_finish_resize(&t);
+
+    srand(0xdead);
+    for( i=n-1 ; i>0 ; i-- )
+    {
+        j = (uint32_t)(((uint64_t)rand() * (i + 1)) / ((uint64_t)RAND_MAX + 1));
+        tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+
+    fprintf( stdout, "entries: %u buckets: %zu\n", n, t.buckets );
+
+    start = now_ns();
+    for( i=0, found=0 ; i<n ; i++ )
+        found += !!hash_table_lookup_key_lockless_i( &t, keys[i], sizeof(uintptr_t) );
+    elapsed = now_ns() - start;
+    fprintf( stdout, "lookup single: %.1f ns/op (%zu found)\n", elapsed / n, found );
+
+    start = now_ns();
+    found = hash_table_lookup_batch_i( &t, keys, sizeof(uintptr_t), out, n );
+    elapsed = now_ns() - start;
+    fprintf( stdout, "lookup batch:  %.1f ns/op (%zu found)\n", elapsed / n, found );
+
+    start = now_ns();
+    for( i=0, found=0 ; i<half ; i++ )
+        found += !!hash_table_del_key_safe_i( &t, keys[i], sizeof(uintptr_t) );
+    elapsed = now_ns() - start;
+    fprintf( stdout, "delete single: %.1f ns/op (%zu found)\n", elapsed / half, found );
+
+    start = now_ns();
+    found = hash_table_del_batch_i( &t, &keys[half], sizeof(uintptr_t), out, n - half );
+    elapsed = now_ns() - start;
+    fprintf( stdout, "delete batch:  %.1f ns/op (%zu found)\n",
+            elapsed / (n - half), found );
+
+    hash_table_finit(&t);
+    for( i=0 ; i<n ; i++ )
+        free(entries[i]);
+    free(entries);
+    free(keys);
+    free(out);
+    return 0;
+}
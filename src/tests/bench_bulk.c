@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "milu.h"
+#include "hashtbl/hashtbl.h"
+
+/*
+ * Updates pushed a chunk at a time (buffered tracking, trace replay):
+ * hash_table_insert_safe_i()/hash_table_del_key_safe_i() per entry vs
+ * the bulk calls, which sort a chunk by hash and lock each stripe once.
+ *
+ * usage: bench_bulk [n_entries] [chunk]
+ * */
+
+#define DEF_ENTRIES 1000000
+#define DEF_CHUNK 4096
+
+struct bench_entry {
+    struct hash_entry hentry;
+    uint64_t pad; /* malloc'ish object size */
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_entry *entries = NULL;
+    struct hash_entry **ptrs = NULL;
+    struct hash_entry **out = NULL;
+    uintptr_t *keys = NULL;
+    struct hash_table t;
+    uint32_t n = DEF_ENTRIES;
+    uint32_t chunk = DEF_CHUNK;
+    uint32_t i, j, m;
+    struct hash_entry *tmp;
+    size_t found;
+    double start, elapsed;
+    int bulk;
+
+    if(argc > 1)
+        n = (uint32_t)strtoul(argv[1], NULL, 10);
+    if(argc > 2)
+        chunk = (uint32_t)strtoul(argv[2], NULL, 10);
+    if(!n || !chunk)
+        return 1;
+
+    if(!(entries = calloc(n, sizeof(struct bench_entry))) ||
+            !(ptrs = calloc(n, sizeof(struct hash_entry *))) ||
+            !(keys = calloc(n, sizeof(uintptr_t))) ||
+            !(out = calloc(n, sizeof(struct hash_entry *))))
+        return 1;
+
+    for( i=0 ; i<n ; i++ )
+        ptrs[i] = &entries[i].hentry;
+
+    srand(0xbeef);
+    for( i=n-1 ; i>0 ; i-- )
+    {
+        j = (uint32_t)(((uint64_t)rand() * (i + 1)) / ((uint64_t)RAND_MAX + 1));
+        tmp = ptrs[i];
+        ptrs[i] = ptrs[j];
+        ptrs[j] = tmp;
+    }
+    for( i=0 ; i<n ; i++ )
+        keys[i] = (uintptr_t)ptrs[i];
+
+    fprintf( stdout, "entries: %u chunk: %u\n", n, chunk );
+    for( bulk=0 ; bulk<2 ; bulk++ )
+    {
+        if(hash_table_init(&t, 16, hash64_cmp, milu_hash_ptr))
+            return 1;
+
+        start = now_ns();
+        for( i=0 ; i<n ; i+=m )
+        {
+            m = (n - i < chunk ? n - i : chunk);
+            if(bulk)
+            {
+                hash_table_insert_bulk_i( &t, &ptrs[i], &keys[i],
+                        sizeof(uintptr_t), m );
+                continue;
+            }
+            for( j=0 ; j<m ; j++ )
+                hash_table_insert_safe_i( &t, ptrs[i+j], keys[i+j],
+                        sizeof(uintptr_t) );
+        }
+        elapsed = now_ns() - start;
+        fprintf( stdout, "insert %s: %.1f ns/op\n",
+                bulk ? "bulk  " : "single", elapsed / n );
+
+        start = now_ns();
+        for( i=0, found=0 ; i<n ; i+=m )
+        {
+            m = (n - i < chunk ? n - i : chunk);
+            if(bulk)
+            {
+                found += hash_table_del_bulk_i( &t, &keys[i],
+                        sizeof(uintptr_t), &out[i], m );
+                continue;
+            }
+            for( j=0 ; j<m ; j++ )
+                found += !!hash_table_del_key_safe_i( &t, keys[i+j],
+                        sizeof(uintptr_t) );
+        }
+        elapsed = now_ns() - start;
+        fprintf( stdout, "delete %s: %.1f ns/op (%zu found)\n",
+                bulk ? "bulk  " : "single", elapsed / n, found );
+
+        hash_table_finit(&t);
+    }
+
+    free(entries);
+    free(ptrs);
+    free(keys);
+    free(out);
+    return 0;
+}
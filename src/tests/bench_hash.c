@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "milu.h"
+#include "hashtbl/hashtbl.h"
+#include "hash/hash.h"
+#include "list/list.h"
+
+/*
+ * Chain length distribution of the pointer tracking table.
+ *
+ * "before" hashes keys the way milu_hash_ptr() used to (hash_ptr() down to
+ * 8 bits, so at most 256 buckets are ever used), "after" uses the current
+ * milu_hash_ptr() and lets the table pick as many bits as it has buckets.
+ *
+ * usage: bench_hash [n_entries]
+ * */
+
+#define DEF_ENTRIES 100000
+#define LEGACY_HASHBITS 8
+#define N_HIST 12
+
+struct bench_entry {
+    struct hash_entry hentry;
+    uint64_t pad; /* malloc'ish object size */
+};
+
+static size_t legacy_hash_ptr(const void *ptr, size_t UNUSED(len))
+{
+    return hash_ptr(ptr, LEGACY_HASHBITS);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* histogram slot: 0, 1, 2, 3-4, 5-8, ... , > 512 */
+static int hist_slot(size_t len)
+{
+    int slot = 0;
+
+    if(len <= 2)
+        return (int)len;
+
+    /* 1 + ceil(log2(len)) */
+    len--;
+    slot = 1;
+    while(len)
+    {
+        len >>= 1;
+        slot++;
+    }
+
+    return (slot >= N_HIST ? N_HIST-1 : slot);
+}
+
+static void run(const char *name, __hash fn,
+        struct bench_entry **entries, uint32_t n)
+{
+    struct hash_table t;
+    uint64_t hist[N_HIST];
+    size_t max_chain = 0;
+    size_t used = 0;
+    double start, elapsed;
+    uint32_t i;
+
+    memset(hist, 0, sizeof(hist));
+
+    if(hash_table_init(&t, n, hash64_cmp, fn))
+    {
+        fprintf(stderr, "%s: table init failed\n", name);
+        return;
+    }
+
+    start = now_ns();
+    for( i=0 ; i<n ; i++ )
+    {
+        hash_table_insert_safe_i( &t, &entries[i]->hentry,
+                (const uintptr_t)entries[i], sizeof(uintptr_t) );
+    }
+    elapsed = now_ns() - start;
+    hash_table_finish_resize(&t);
+
+    for( i=0 ; i<t.buckets ; i++ )
+    {
+        size_t len = 0;
+        struct list_head *pos;
+
+        list_for_each(pos, &t.table[i])
+            len++;
+
+        if(len)
+            used++;
+        if(len > max_chain)
+            max_chain = len;
+        hist[hist_slot(len)]++;
+    }
+
+    fprintf( stdout, "== %s ==\n", name );
+    fprintf( stdout, "buckets: %zu used: %zu max chain: %zu avg chain: %.2f\n",
+            t.buckets, used, max_chain, used ? (double)n / used : 0.0 );
+    fprintf( stdout, "insert: %.1f ns/op\n", elapsed / n );
+
+    fprintf( stdout, "chain length histogram (buckets):\n" );
+    for( i=0 ; i<N_HIST ; i++ )
+    {
+        if(i < 3)
+            fprintf( stdout, "  %13u : %" PRIu64 "\n", i, hist[i] );
+        else if(i == N_HIST-1)
+            fprintf( stdout, "  %7s %5u : %" PRIu64 "\n", ">", 1u << (i-2), hist[i] );
+        else
+            fprintf( stdout, "  %6u-%-6u : %" PRIu64 "\n",
+                    (1u << (i-2)) + 1, 1u << (i-1), hist[i] );
+    }
+
+    start = now_ns();
+    for( i=0 ; i<n ; i++ )
+    {
+        if(!hash_table_lookup_key_i( &t, (const uintptr_t)entries[i],
+                    sizeof(uintptr_t) ))
+        {
+            fprintf(stderr, "%s: lost key %p\n", name, (void *)entries[i]);
+        }
+    }
+    elapsed = now_ns() - start;
+    fprintf( stdout, "lookup: %.1f ns/op\n\n", elapsed / n );
+
+    for( i=0 ; i<n ; i++ )
+    {
+        hash_table_del_key_i( &t, (const uintptr_t)entries[i],
+                sizeof(uintptr_t) );
+    }
+    hash_table_finit(&t);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_entry **entries = NULL;
+    uint32_t n = DEF_ENTRIES;
+    uint32_t i;
+
+    if(argc > 1)
+        n = (uint32_t)strtoul(argv[1], NULL, 10);
+    if(!n)
+        return 1;
+
+    /* separate allocations, so keys look like the heap pointers milu tracks */
+    if(!(entries = calloc(n, sizeof(struct bench_entry *))))
+        return 1;
+    for( i=0 ; i<n ; i++ )
+    {
+        if(!(entries[i] = malloc(sizeof(struct bench_entry))))
+            return 1;
+    }
+
+    run("before: hash_ptr(ptr, 8)", legacy_hash_ptr, entries, n);
+    run("after: milu_hash_ptr", milu_hash_ptr, entries, n);
+
+    for( i=0 ; i<n ; i++ )
+        free(entries[i]);
+    free(entries);
+    return 0;
+}
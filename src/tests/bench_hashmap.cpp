@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "milu.h"
+#include "hashtbl/hashtbl.hpp"
+
+/*
+ * Lookups through the C calls (hash function and key compare called
+ * through the table's pointers) vs milu::intrusive_hash_map::find(), both
+ * on the same kind of table and keys. The table fits in the caches and is
+ * looked up over and over, so what's left is the lookup code itself.
+ *
+ * usage: bench_hashmap [n_entries] [rounds]
+ * */
+
+#define DEF_ENTRIES 16384
+#define DEF_ROUNDS 100
+
+struct bench_entry {
+    struct hash_entry hentry;
+    uint64_t pad; /* malloc'ish object size */
+};
+
+typedef milu::intrusive_hash_map<uintptr_t, bench_entry,
+        &bench_entry::hentry> bench_map;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    bench_entry *centries = NULL;
+    bench_entry *mentries = NULL;
+    struct hash_table t;
+    bench_map m;
+    uint32_t n = DEF_ENTRIES;
+    uint32_t rounds = DEF_ROUNDS;
+    uint32_t i, r;
+    size_t found;
+    double start, elapsed;
+
+    if(argc > 1)
+        n = (uint32_t)strtoul(argv[1], NULL, 10);
+    if(argc > 2)
+        rounds = (uint32_t)strtoul(argv[2], NULL, 10);
+    if(!n || !rounds)
+        return 1;
+
+    centries = (bench_entry *)calloc(n, sizeof(bench_entry));
+    mentries = (bench_entry *)calloc(n, sizeof(bench_entry));
+    if(!centries || !mentries)
+        return 1;
+    if(hash_table_init(&t, 16, hash64_cmp, milu_hash_ptr))
+        return 1;
+
+    //same keys for both, the C entries' addresses.
+    for( i=0 ; i<n ; i++ )
+    {
+        hash_table_insert_safe_i( &t, &centries[i].hentry,
+                (uintptr_t)&centries[i], sizeof(uintptr_t) );
+        m.insert( (uintptr_t)&centries[i], mentries[i] );
+    }
+    hash_table_finish_resize(&t);
+    hash_table_finish_resize(m.table());
+
+    fprintf( stdout, "entries: %u rounds: %u\n", n, rounds );
+
+    start = now_ns();
+    for( r=0, found=0 ; r<rounds ; r++ )
+        for( i=0 ; i<n ; i++ )
+            found += !!hash_table_lookup_key_i( &t, (uintptr_t)&centries[i],
+                    sizeof(uintptr_t) );
+    elapsed = now_ns() - start;
+    fprintf( stdout, "C lookup:   %.1f ns/op (%zu found)\n",
+            elapsed / ((double)n * rounds), found );
+
+    start = now_ns();
+    for( r=0, found=0 ; r<rounds ; r++ )
+        for( i=0 ; i<n ; i++ )
+            found += !!m.find( (uintptr_t)&centries[i] );
+    elapsed = now_ns() - start;
+    fprintf( stdout, "C++ find:   %.1f ns/op (%zu found)\n",
+            elapsed / ((double)n * rounds), found );
+
+    hash_table_finit(&t);
+    free(centries);
+    free(mentries);
+    return 0;
+}
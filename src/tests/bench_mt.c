@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * malloc()/free() throughput from 1 to 32 threads. Meant to run with
+ * libmilu interposed, every call then goes through the tracking table:
+ *
+ *   LD_PRELOAD=src/libmilu.so src/tests/bench_mt [ops_per_thread]
+ *
+ * Add MILU_NOBT=1 to leave backtraces out: they cost tens of microseconds
+ * per malloc() and would hide the table's scaling entirely.
+ *
+ * Without LD_PRELOAD it measures the plain libc allocator, which makes
+ * for a baseline. Each thread keeps a small window of live blocks and
+ * replaces one of them per operation, sizes vary between 16 and 512
+ * bytes.
+ * */
+
+#define DEF_OPS 200000
+#define MAX_THREADS 32
+#define WINDOW 64
+
+struct bench_thread {
+    pthread_t tid;
+    uint32_t ops;
+    uint32_t seed;
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void *run(void *arg)
+{
+    struct bench_thread *bt = (struct bench_thread *)arg;
+    void *live[WINDOW];
+    uint32_t x = bt->seed;
+    uint32_t i, j;
+
+    memset(live, 0, sizeof(live));
+
+    for( i=0 ; i<bt->ops ; i++ )
+    {
+        //xorshift, so threads don't contend on rand()'s lock.
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+
+        j = x % WINDOW;
+        free(live[j]);
+        live[j] = malloc(16 + (x >> 8) % 497);
+    }
+
+    for( j=0 ; j<WINDOW ; j++ )
+        free(live[j]);
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_thread threads[MAX_THREADS];
+    uint32_t ops = DEF_OPS;
+    uint32_t nthreads, i;
+    double start, elapsed;
+
+    if(argc > 1)
+        ops = (uint32_t)strtoul(argv[1], NULL, 10);
+    if(!ops)
+        return 1;
+
+    fprintf( stdout, "%8s %14s %14s\n", "threads", "Mops/s", "ns/op" );
+    for( nthreads=1 ; nthreads<=MAX_THREADS ; nthreads*=2 )
+    {
+        start = now_ns();
+        for( i=0 ; i<nthreads ; i++ )
+        {
+            threads[i].ops = ops;
+            threads[i].seed = 2463534242u + i;
+            if(pthread_create(&threads[i].tid, NULL, run, &threads[i]))
+                return 1;
+        }
+        for( i=0 ; i<nthreads ; i++ )
+            pthread_join(threads[i].tid, NULL);
+        elapsed = now_ns() - start;
+
+        //one op is a malloc() and a free()
+        fprintf( stdout, "%8u %14.3f %14.1f\n", nthreads,
+                ((double)ops * nthreads) / elapsed * 1e3,
+                elapsed / ((double)ops * nthreads) );
+        fflush(stdout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "pool/poolbank.h"
+
+/*
+ * Object get/put throughput on one shared bank from 1 to 16 threads,
+ * straight to the bank vs through a per-thread magazine vs through
+ * per-CPU caches (rseq where available). Each thread
+ * keeps a small window of objects and swaps one per operation, like
+ * milu does with memallocs.
+ *
+ * usage: bench_pool [ops_per_thread]
+ * */
+
+#define DEF_OPS 1000000
+#define MAX_THREADS 16
+#define WINDOW 32
+#define OBJSZ 96
+
+#define MODE_BANK 0
+#define MODE_MAG  1
+#define MODE_PCPU 2
+
+struct bench_thread {
+    pthread_t tid;
+    uint32_t ops;
+    int mode;
+};
+
+static struct bank * _bank = NULL;
+static struct bank_pcpu * _pcpu = NULL;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void *run(void *arg)
+{
+    struct bench_thread *bt = (struct bench_thread *)arg;
+    struct bank_magazine m;
+    void *live[WINDOW];
+    uint32_t i, j;
+
+    memset(&m, 0, sizeof(m));
+    memset(live, 0, sizeof(live));
+
+    for( i=0 ; i<bt->ops ; i++ )
+    {
+        j = i % WINDOW;
+        if(bt->mode == MODE_MAG)
+        {
+            if(live[j])
+                bank_mag_put(_bank, &m, live[j]);
+            live[j] = bank_mag_get(_bank, &m);
+        } else if(bt->mode == MODE_PCPU) {
+            if(live[j])
+                bank_pcpu_put(_pcpu, live[j]);
+            live[j] = bank_pcpu_get(_pcpu);
+        } else {
+            if(live[j])
+                bank_put_ptr(_bank, live[j]);
+            live[j] = bank_get_ptr(_bank);
+        }
+    }
+
+    for( j=0 ; j<WINDOW ; j++ )
+        if(live[j])
+            bank_put_ptr(_bank, live[j]);
+    bank_mag_flush(_bank, &m);
+
+    return NULL;
+}
+
+static double bench(uint32_t nthreads, uint32_t ops, int mode)
+{
+    struct bench_thread threads[MAX_THREADS];
+    double start;
+    uint32_t i;
+
+    start = now_ns();
+    for( i=0 ; i<nthreads ; i++ )
+    {
+        threads[i].ops = ops;
+        threads[i].mode = mode;
+        pthread_create(&threads[i].tid, NULL, run, &threads[i]);
+    }
+    for( i=0 ; i<nthreads ; i++ )
+        pthread_join(threads[i].tid, NULL);
+
+    return (now_ns() - start) / ((double)ops * nthreads);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t ops = DEF_OPS;
+    uint32_t nthreads;
+
+    if(argc > 1)
+        ops = (uint32_t)strtoul(argv[1], NULL, 10);
+    if(!ops)
+        return 1;
+
+    if(!(_bank = create_bank(1, 1, 4096, OBJSZ)))
+        return 1;
+    if(!(_pcpu = create_bank_pcpu(_bank, BANK_PCPU_ANY)))
+        return 1;
+
+    fprintf( stdout, "per-cpu caches: %s\n",
+            (_pcpu->mode == BANK_PCPU_RSEQ) ? "rseq" : "locked" );
+    fprintf( stdout, "%8s %14s %14s %14s   (ns/op)\n",
+            "threads", "bank", "magazine", "per-cpu" );
+    for( nthreads=1 ; nthreads<=MAX_THREADS ; nthreads*=2 )
+    {
+        double direct = bench(nthreads, ops, MODE_BANK);
+        double mag = bench(nthreads, ops, MODE_MAG);
+        double pcpu = bench(nthreads, ops, MODE_PCPU);
+
+        fprintf( stdout, "%8u %14.1f %14.1f %14.1f\n", nthreads, direct, mag, pcpu );
+    }
+
+    destroy_bank_pcpu(_pcpu);
+    destroy_bank(_bank);
+    return 0;
+}
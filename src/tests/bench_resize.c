@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "milu.h"
+#include "hashtbl/hashtbl.h"
+
+/*
+ * Per-operation latency of hash_table_insert_safe_i() while the table
+ * grows from its smallest size, with several threads inserting, looking up
+ * and deleting their own keys. Resizes used to rehash the whole table in
+ * one go under the table lock, which showed up as the max latency; they
+ * are now spread over inserts/deletes. Lookups don't lock, so they also
+ * check lockless readers keep up with buckets moving and arrays going away.
+ * Every key is deleted in the end, so the table shrinks back down the
+ * same way while the others still look theirs up.
+ *
+ * usage: bench_resize [n_entries] [n_threads]
+ * */
+
+#define DEF_ENTRIES 1000000
+#define DEF_THREADS 4
+
+struct bench_entry {
+    struct hash_entry hentry;
+    uint64_t pad; /* malloc'ish object size */
+};
+
+struct bench_thread {
+    pthread_t tid;
+    struct hash_table *t;
+    struct bench_entry **entries;
+    uint32_t n;
+    double max_ns;
+    double total_ns;
+    uint64_t lost;
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void *run(void *arg)
+{
+    struct bench_thread *bt = (struct bench_thread *)arg;
+    double start, elapsed;
+    uint32_t i;
+
+    for( i=0 ; i<bt->n ; i++ )
+    {
+        start = now_ns();
+        hash_table_insert_safe_i( bt->t, &bt->entries[i]->hentry,
+                (const uintptr_t)bt->entries[i], sizeof(uintptr_t) );
+        elapsed = now_ns() - start;
+
+        bt->total_ns += elapsed;
+        if(elapsed > bt->max_ns)
+            bt->max_ns = elapsed;
+
+        //check an older key, it may sit in either bucket array.
+        if(!hash_table_lookup_key_lockless_i( bt->t,
+                    (const uintptr_t)bt->entries[i/2], sizeof(uintptr_t) ))
+            bt->lost++;
+    }
+
+    for( i=0 ; i<bt->n ; i+=2 )
+    {
+        if(!hash_table_del_key_safe_i( bt->t,
+                    (const uintptr_t)bt->entries[i], sizeof(uintptr_t) ))
+            bt->lost++;
+        if(i + 1 < bt->n && !hash_table_lookup_key_lockless_i( bt->t,
+                    (const uintptr_t)bt->entries[i+1], sizeof(uintptr_t) ))
+            bt->lost++;
+    }
+
+    for( i=1 ; i<bt->n ; i+=2 )
+    {
+        if(!hash_table_del_key_safe_i( bt->t,
+                    (const uintptr_t)bt->entries[i], sizeof(uintptr_t) ))
+            bt->lost++;
+    }
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_thread *threads = NULL;
+    struct bench_entry **entries = NULL;
+    struct hash_table t;
+    uint32_t n = DEF_ENTRIES;
+    uint32_t nthreads = DEF_THREADS;
+    uint32_t per, i;
+    uint64_t lost = 0;
+    double max_ns = 0, total_ns = 0;
+
+    if(argc > 1)
+        n = (uint32_t)strtoul(argv[1], NULL, 10);
+    if(argc > 2)
+        nthreads = (uint32_t)strtoul(argv[2], NULL, 10);
+    if(!n || !nthreads || n < nthreads)
+        return 1;
+    per = n / nthreads;
+
+    if(!(entries = calloc(n, sizeof(struct bench_entry *))) ||
+            !(threads = calloc(nthreads, sizeof(struct bench_thread))))
+        return 1;
+    for( i=0 ; i<n ; i++ )
+    {
+        if(!(entries[i] = malloc(sizeof(struct bench_entry))))
+            return 1;
+    }
+
+    if(hash_table_init(&t, 16, hash64_cmp, milu_hash_ptr))
+        return 1;
+
+    for( i=0 ; i<nthreads ; i++ )
+    {
+        threads[i].t = &t;
+        threads[i].entries = &entries[i * per];
+        threads[i].n = per;
+        pthread_create(&threads[i].tid, NULL, run, &threads[i]);
+    }
+
+    for( i=0 ; i<nthreads ; i++ )
+    {
+        pthread_join(threads[i].tid, NULL);
+        lost += threads[i].lost;
+        total_ns += threads[i].total_ns;
+        if(threads[i].max_ns > max_ns)
+            max_ns = threads[i].max_ns;
+    }
+
+    hash_table_finish_resize(&t);
+
+    fprintf( stdout, "threads: %u entries: %u\n", nthreads, per * nthreads );
+    fprintf( stdout, "insert: %.1f ns/op avg, %.1f us max\n",
+            total_ns / ((double)per * nthreads), max_ns / 1e3 );
+    fprintf( stdout, "entries left: %zu, buckets: %zu\n", t._nentries,
+            t.buckets );
+    if(lost)
+        fprintf( stderr, "lost keys: %" PRIu64 "\n", lost );
+
+    hash_table_finit(&t);
+    for( i=0 ; i<n ; i++ )
+        free(entries[i]);
+    free(entries);
+    free(threads);
+    return (lost ? 1 : 0);
+}
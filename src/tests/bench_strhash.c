@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "hash/hash.h"
+
+/*
+ * String hash throughput over key lengths from 8 bytes to 4KB: FNV-1a
+ * (byte at a time, what the tests use) vs hash_str_portable() vs
+ * hash_str_crc32c(). Keys are read at an odd offset, the way they show up
+ * in real buffers.
+ *
+ * usage: bench_strhash [bytes_per_run]
+ * */
+
+#define DEF_BYTES (64 << 20)
+
+static const size_t lens[] = { 8, 16, 32, 64, 128, 256, 1024, 4096 };
+
+static size_t fnv1a(const void *key, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)key;
+    uint64_t h = 14695981039346656037ULL;
+
+    while(len--)
+    {
+        h ^= *p++;
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static double run(size_t (* fn)(const void *, size_t), const char *buf,
+        size_t len, size_t total, size_t *sink)
+{
+    size_t iters = total / len;
+    size_t i, acc = 0;
+    double start;
+
+    start = now_ns();
+    //chained, so the calls can't be overlapped or dropped.
+    for( i=0 ; i<iters ; i++ )
+        acc += fn(buf + (acc & 7), len);
+    *sink += acc;
+    return (double)(iters * len) / (now_ns() - start);
+}
+
+int main(int argc, char **argv)
+{
+    size_t total = DEF_BYTES;
+    size_t sink = 0;
+    char *buf = NULL;
+    size_t i;
+
+    if(argc > 1)
+        total = (size_t)strtoull(argv[1], NULL, 10);
+    if(!total)
+        return 1;
+
+    buf = (char *)malloc(4096 + 16);
+    if(!buf)
+        return 1;
+    for( i=0 ; i<4096 + 16 ; i++ )
+        buf[i] = (char)(i * 131 + 7);
+
+    fprintf( stdout, "hash_str(): %s\n",
+            hash_str_accelerated() ? "crc32c" : "portable" );
+    fprintf( stdout, "%6s %12s %12s %12s   (GB/s)\n",
+            "len", "fnv1a", "portable", "crc32c" );
+    for( i=0 ; i<sizeof(lens)/sizeof(lens[0]) ; i++ )
+    {
+        fprintf( stdout, "%6zu %12.2f %12.2f %12.2f\n", lens[i],
+                run(fnv1a, buf + 1, lens[i], total, &sink),
+                run(hash_str_portable, buf + 1, lens[i], total, &sink),
+                run(hash_str_crc32c, buf + 1, lens[i], total, &sink) );
+    }
+
+    free(buf);
+    return (sink == 1);
+}
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "milu.h"
+#include "hashtbl/hashtbl.h"
+#include "hashtbl/swisstbl.h"
+
+/*
+ * Chained struct hash_table vs. group probing struct swiss_table on heap
+ * pointer keys: insert, lookup (hits and misses) and delete.
+ *
+ * usage: bench_swiss [n_entries]
+ * */
+
+#define DEF_ENTRIES 1000000
+
+struct bench_entry {
+    struct hash_entry hentry;
+    uint64_t pad; /* malloc'ish object size */
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* visit keys in a scrambled order, otherwise consecutive keys hit the cache */
+static uint32_t *make_order(uint32_t n)
+{
+    uint32_t *order = malloc(n * sizeof(uint32_t));
+    uint32_t i, j, tmp;
+
+    if(!order)
+        return NULL;
+    for( i=0 ; i<n ; i++ )
+        order[i] = i;
+    srand(42);
+    for( i=n-1 ; i>0 ; i-- )
+    {
+        j = (uint32_t)rand() % (i + 1);
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    return order;
+}
+
+static void report(const char *table, const char *op, double elapsed, uint32_t n)
+{
+    fprintf( stdout, "%-8s %-12s %8.1f ns/op\n", table, op, elapsed / n );
+}
+
+static void bench_chained(struct bench_entry **entries, uintptr_t *misses,
+        uint32_t *order, uint32_t n)
+{
+    struct hash_table t;
+    double start;
+    uint32_t i;
+    uint64_t found = 0;
+
+    hash_table_init(&t, n, hash64_cmp, milu_hash_ptr);
+
+    start = now_ns();
+    for( i=0 ; i<n ; i++ )
+        hash_table_insert_safe_i( &t, &entries[i]->hentry,
+                (const uintptr_t)entries[i], sizeof(uintptr_t) );
+    report("chained", "insert", now_ns() - start, n);
+
+    start = now_ns();
+    for( i=0 ; i<n ; i++ )
+        found += !!hash_table_lookup_key_i( &t,
+                (const uintptr_t)entries[order[i]], sizeof(uintptr_t) );
+    report("chained", "lookup hit", now_ns() - start, n);
+
+    start = now_ns();
+    for( i=0 ; i<n ; i++ )
+        found += !!hash_table_lookup_key_i( &t, misses[i], sizeof(uintptr_t) );
+    report("chained", "lookup miss", now_ns() - start, n);
+
+    start = now_ns();
+    for( i=0 ; i<n ; i++ )
+        found += !!hash_table_del_key_i( &t,
+                (const uintptr_t)entries[order[i]], sizeof(uintptr_t) );
+    report("chained", "delete", now_ns() - start, n);
+
+    if(found != 2 * (uint64_t)n)
+        fprintf( stderr, "chained: expected %" PRIu64 " hits, got %" PRIu64 "\n",
+                2 * (uint64_t)n, found );
+    hash_table_finit(&t);
+}
+
+static void bench_swiss(struct bench_entry **entries, uintptr_t *misses,
+        uint32_t *order, uint32_t n)
+{
+    struct swiss_table t;
+    double start;
+    uint32_t i;
+    uint64_t found = 0;
+
+    swiss_table_init(&t, n, hash64_cmp, milu_hash_ptr);
+
+    start = now_ns();
+    for( i=0 ; i<n ; i++ )
+        swiss_table_insert_i( &t, &entries[i]->hentry,
+                (const uintptr_t)entries[i], sizeof(uintptr_t) );
+    report("swiss", "insert", now_ns() - start, n);
+
+    start = now_ns();
+    for( i=0 ; i<n ; i++ )
+        found += !!swiss_table_lookup_key_i( &t,
+                (const uintptr_t)entries[order[i]], sizeof(uintptr_t) );
+    report("swiss", "lookup hit", now_ns() - start, n);
+
+    start = now_ns();
+    for( i=0 ; i<n ; i++ )
+        found += !!swiss_table_lookup_key_i( &t, misses[i], sizeof(uintptr_t) );
+    report("swiss", "lookup miss", now_ns() - start, n);
+
+    start = now_ns();
+    for( i=0 ; i<n ; i++ )
+        found += !!swiss_table_del_key_i( &t,
+                (const uintptr_t)entries[order[i]], sizeof(uintptr_t) );
+    report("swiss", "delete", now_ns() - start, n);
+
+    if(found != 2 * (uint64_t)n)
+        fprintf( stderr, "swiss: expected %" PRIu64 " hits, got %" PRIu64 "\n",
+                2 * (uint64_t)n, found );
+    swiss_table_finit(&t);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_entry **entries = NULL;
+    uintptr_t *misses = NULL;
+    uint32_t *order = NULL;
+    uint32_t n = DEF_ENTRIES;
+    uint32_t i;
+
+    if(argc > 1)
+        n = (uint32_t)strtoul(argv[1], NULL, 10);
+    if(!n)
+        return 1;
+
+    entries = calloc(n, sizeof(struct bench_entry *));
+    misses = calloc(n, sizeof(uintptr_t));
+    order = make_order(n);
+    if(!entries || !misses || !order)
+        return 1;
+
+    for( i=0 ; i<n ; i++ )
+    {
+        if(!(entries[i] = malloc(sizeof(struct bench_entry))))
+            return 1;
+        //never inserted: same neighbourhood, odd addresses.
+        misses[i] = (uintptr_t)entries[i] + 1;
+    }
+
+#ifdef SWISS_SSE2
+    fprintf( stdout, "%u entries, swiss probing: sse2\n", n );
+#else
+    fprintf( stdout, "%u entries, swiss probing: scalar\n", n );
+#endif
+    bench_chained(entries, misses, order, n);
+    bench_swiss(entries, misses, order, n);
+
+    for( i=0 ; i<n ; i++ )
+        free(entries[i]);
+    free(entries);
+    free(misses);
+    free(order);
+    return 0;
+}
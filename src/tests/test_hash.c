@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h> 
+#include <pthread.h>
+#include <sched.h>
 #include "CUnit/Basic.h"
 
 #include "milu.h"
@@ -96,6 +98,10 @@ void testHASHEXPAND(void)
     struct memalloc * mem = NULL;
     uintptr_t addr = (uintptr_t) ADDRESS_HERE();
     size_t old_hsize = _milu_htable->buckets;
+    uintptr_t * ptrs = NULL;
+
+    ptrs = (uintptr_t *)calloc(old_hsize, sizeof(uintptr_t));
+    CU_ASSERT_FATAL(ptrs != NULL);
 
     for( i = 0 ; i < old_hsize ; i++ )
     {
@@ -110,9 +116,575 @@ void testHASHEXPAND(void)
 
             hash_table_insert_safe_i( _milu_htable, &mem->hentry, 
                     (const uintptr_t)ptr, sizeof(void *) );
+            ptrs[i] = ptr;
         }
     }
     CU_ASSERT((_milu_htable->buckets > old_hsize));
+
+    //entries are found whether or not their bucket was moved yet.
+    for( i = 0 ; i < old_hsize ; i++ )
+    {
+        if(ptrs[i])
+        {
+            CU_ASSERT(NULL != hash_table_lookup_key_safe_i( _milu_htable,
+                        (const uintptr_t)ptrs[i], sizeof(void *) ));
+            CU_ASSERT(NULL != hash_table_lookup_key_lockless_i( _milu_htable,
+                        (const uintptr_t)ptrs[i], sizeof(void *) ));
+        }
+    }
+    CU_ASSERT(NULL == hash_table_lookup_key_lockless_i( _milu_htable,
+                (const uintptr_t)addr, sizeof(void *) ));
+
+    hash_table_finish_resize(_milu_htable);
+    CU_ASSERT(!hash_table_resizing(_milu_htable));
+
+    for( i = 0 ; i < old_hsize ; i++ )
+    {
+        if(ptrs[i])
+            CU_ASSERT(NULL != hash_table_lookup_key_i( _milu_htable,
+                        (const uintptr_t)ptrs[i], sizeof(void *) ));
+    }
+    free(ptrs);
+}
+
+static size_t counted_allocs = 0;
+
+static void * counting_malloc(size_t sz)
+{
+    counted_allocs++;
+    return malloc(sz);
+}
+
+void testHASHSHRINK(void)
+{
+    struct hash_table t;
+    struct hash_entry * entries = NULL;
+    size_t peak = 0, start = 0;
+    uint32_t i = 0;
+    uint32_t n = 4096;
+
+    entries = (struct hash_entry *)calloc(n, sizeof(struct hash_entry));
+    CU_ASSERT_FATAL(entries != NULL);
+    CU_ASSERT_FATAL(0 == hash_table_init(&t, 16, hash64_cmp, milu_hash_ptr));
+    start = t.buckets;
+    CU_ASSERT(-1 == hash_table_set_shrink(&t, _LOAD_FACTOR / 2));
+
+    for( i=0 ; i<n ; i++ )
+        hash_table_insert_safe_i(&t, &entries[i], (uintptr_t)&entries[i],
+                sizeof(uintptr_t));
+    hash_table_finish_resize(&t);
+    peak = t.buckets;
+
+    //no shrinking: the bucket array keeps its peak size.
+    CU_ASSERT(0 == hash_table_set_shrink(&t, 0));
+    for( i=0 ; i<n/2 ; i++ )
+        CU_ASSERT(&entries[i] == hash_table_del_key_safe_i(&t,
+                    (uintptr_t)&entries[i], sizeof(uintptr_t)));
+    CU_ASSERT(t.buckets == peak && !hash_table_resizing(&t));
+
+    //halves as the rest goes, merged buckets still find their keys.
+    CU_ASSERT(0 == hash_table_set_shrink(&t, _SHRINK_FACTOR));
+    for( i=n/2 ; i<n-8 ; i++ )
+    {
+        CU_ASSERT(&entries[i] == hash_table_del_key_safe_i(&t,
+                    (uintptr_t)&entries[i], sizeof(uintptr_t)));
+        CU_ASSERT(&entries[n-1] == hash_table_lookup_key_lockless_i(&t,
+                    (uintptr_t)&entries[n-1], sizeof(uintptr_t)));
+    }
+    hash_table_finish_resize(&t);
+    CU_ASSERT(t.buckets < peak);
+    CU_ASSERT(t.buckets >= start);
+    CU_ASSERT(t._nentries == 8);
+    for( i=n-8 ; i<n ; i++ )
+        CU_ASSERT(&entries[i] == hash_table_lookup_key_safe_i(&t,
+                    (uintptr_t)&entries[i], sizeof(uintptr_t)));
+
+    //never below the starting size.
+    for( i=n-8 ; i<n ; i++ )
+        hash_table_del_key_safe_i(&t, (uintptr_t)&entries[i], sizeof(uintptr_t));
+    hash_table_finish_resize(&t);
+    CU_ASSERT(t.buckets == start);
+    CU_ASSERT(t._nentries == 0 && t._used_buckets == 0);
+
+    hash_table_finit(&t);
+
+    //torn down mid-shrink: the shrink under way ends, no other starts.
+    CU_ASSERT_FATAL(0 == hash_table_init(&t, 16, hash64_cmp, milu_hash_ptr));
+    for( i=0 ; i<n ; i++ )
+        hash_table_insert_safe_i(&t, &entries[i], (uintptr_t)&entries[i],
+                sizeof(uintptr_t));
+    hash_table_finish_resize(&t);
+    CU_ASSERT(0 == hash_table_set_shrink(&t, 0));
+    for( i=0 ; i<n-8 ; i++ )
+        hash_table_del_key_safe_i(&t, (uintptr_t)&entries[i], sizeof(uintptr_t));
+    CU_ASSERT(0 == hash_table_set_shrink(&t, _SHRINK_FACTOR));
+    hash_table_del_key_safe_i(&t, (uintptr_t)&entries[n-8], sizeof(uintptr_t));
+    CU_ASSERT(hash_table_resizing(&t));
+    custom_h_allocator(counting_malloc, free);
+    counted_allocs = 0;
+    hash_table_finit(&t);
+    custom_h_allocator(malloc, free);
+    CU_ASSERT(counted_allocs == 0);
+
+    free(entries);
+}
+
+static void * stats_lookup(void * arg)
+{
+    struct hash_table * t = (struct hash_table *)arg;
+
+    hash_table_lookup_key_safe_i(t, (uintptr_t)t, sizeof(uintptr_t));
+    return NULL;
+}
+
+void testHASHSTATS(void)
+{
+    struct hash_table t;
+    struct hash_table_stats st;
+    struct hash_entry * entries = NULL;
+    pthread_t tid;
+    size_t buckets = 0, chained = 0;
+    uint32_t i = 0;
+    uint32_t n = 2000;
+    unsigned int s = 0;
+
+    entries = (struct hash_entry *)calloc(n, sizeof(struct hash_entry));
+    CU_ASSERT_FATAL(entries != NULL);
+    CU_ASSERT_FATAL(0 == hash_table_init(&t, 16, hash64_cmp, milu_hash_ptr));
+
+    //off: chains only.
+    hash_table_insert_safe_i(&t, &entries[0], (uintptr_t)&entries[0], sizeof(uintptr_t));
+    hash_table_get_stats(&t, &st);
+    CU_ASSERT(st.lookups == 0 && st.lock_acquires == 0);
+    CU_ASSERT(st.chains[1] == 1 && st.chains[0] == t.buckets - 1);
+
+    CU_ASSERT_FATAL(0 == hash_table_stats_enable(&t));
+    for( i=1 ; i<n ; i++ )
+        hash_table_insert_safe_i(&t, &entries[i], (uintptr_t)&entries[i],
+                sizeof(uintptr_t));
+    for( i=0 ; i<n ; i++ )
+        hash_table_lookup_key_lockless_i(&t, (uintptr_t)&entries[i], sizeof(uintptr_t));
+
+    //the histogram covers every bucket and entry, mid resize too.
+    hash_table_get_stats(&t, &st);
+    for( i=0 ; i<HASH_STATS_CHAIN_BINS ; i++ )
+    {
+        buckets += st.chains[i];
+        chained += i * st.chains[i];
+    }
+    CU_ASSERT(st.max_chain < HASH_STATS_CHAIN_BINS);
+    if(!hash_table_resizing(&t))
+        CU_ASSERT(buckets == t.buckets);
+    CU_ASSERT(chained == n);
+    CU_ASSERT(st.lookups == n);
+    CU_ASSERT(st.probes >= n && st.max_probes >= 1);
+    CU_ASSERT(st.resizes > 0 && st.resize_ns > 0);
+    CU_ASSERT(st.lock_acquires >= n - 1);
+
+    //a lookup that finds its stripe taken.
+    s = hash_table_bucket_of_fold(hash_table_key_fold(&t, &t, sizeof(uintptr_t)),
+            t._sbits);
+    pthread_mutex_lock(&t._stripes[s].lock);
+    CU_ASSERT_FATAL(0 == pthread_create(&tid, NULL, stats_lookup, &t));
+    while(!__atomic_load_n(&t._stripes[s].contended, __ATOMIC_RELAXED))
+        sched_yield();
+    pthread_mutex_unlock(&t._stripes[s].lock);
+    pthread_join(tid, NULL);
+    hash_table_get_stats(&t, &st);
+    CU_ASSERT(st.lock_contended >= 1);
+    CU_ASSERT(st.hot_stripe == s && st.hot_contended >= 1);
+
+    hash_table_finit(&t);
+    free(entries);
+}
+
+void testHASHMEM(void)
+{
+    struct hash_table t;
+    struct hash_table_mem m;
+
+    hash_table_mem_usage(_milu_htable, &m);
+    CU_ASSERT(m.buckets == _milu_htable->buckets * sizeof(struct list_head));
+    CU_ASSERT(((size_t)1 << _milu_htable->_sbits) <= _milu_htable->buckets);
+
+    //a few stripes for a large table: most of the per-bucket locks saved.
+    CU_ASSERT_FATAL(0 == hash_table_init_stripes(
+                &t, 4096, hash64_cmp, milu_hash_ptr, 3 ));
+    CU_ASSERT(t._sbits == 2);
+    hash_table_mem_usage(&t, &m);
+    CU_ASSERT(m.locks == 4 * sizeof(struct hash_lock_stripe) +
+            HASH_TABLE_READER_SLOTS * sizeof(struct hash_reader_slot));
+    CU_ASSERT(m.saved == t.buckets * sizeof(pthread_mutex_t) - m.locks);
+    hash_table_finit(&t);
+}
+
+void testHASHSHARD(void)
+{
+    uint32_t counts[MILU_DEF_SHARDS];
+    uint32_t i = 0;
+    uintptr_t base = 0x7f0000001000;
+
+    memset(counts, 0, sizeof(counts));
+
+    //malloc()'ish pointers, 32 bytes apart, should use every shard.
+    for( i=0 ; i<MILU_DEF_SHARDS*64 ; i++ )
+        counts[milu_shard_of((void *)(base + i*32), MILU_DEF_SHARDS)]++;
+
+    for( i=0 ; i<MILU_DEF_SHARDS ; i++ )
+    {
+        CU_ASSERT(counts[i] > 32);
+        CU_ASSERT(counts[i] < 96);
+    }
+    CU_ASSERT(0 == milu_shard_of((void *)base, 1));
+}
+
+static uint32_t strcmp_calls = 0;
+
+static int counting_strcmp(const void * a, const void * b, size_t len)
+{
+    strcmp_calls++;
+    return memcmp(a, b, len);
+}
+
+/* FNV-1a, good enough to spread a few hundred short strings */
+static size_t fnv_hash(const void * key, size_t len)
+{
+    const unsigned char * p = (const unsigned char *)key;
+    uint64_t h = 14695981039346656037ULL;
+
+    while(len--)
+    {
+        h ^= *p++;
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+void testHASHSTRKEY(void)
+{
+    struct hash_table t;
+    struct hash_entry * entries = NULL;
+    struct hash_entry * e = NULL;
+    char key[32];
+    uint32_t i = 0;
+    uint32_t n = 512;
+
+    entries = (struct hash_entry *)calloc(n, sizeof(struct hash_entry));
+    CU_ASSERT_FATAL(entries != NULL);
+    CU_ASSERT_FATAL(0 == hash_table_init(&t, 16, counting_strcmp, fnv_hash));
+
+    //grows a few times: entries are moved by their cached hash.
+    for( i=0 ; i<n ; i++ )
+    {
+        snprintf(key, sizeof(key), "key-%u", i);
+        hash_table_insert_safe_s(&t, &entries[i], key, strlen(key));
+        CU_ASSERT(entries[i]._hash == hash_table_key_fold(&t, key, strlen(key)));
+    }
+    hash_table_finish_resize(&t);
+
+    //only the entry that matches gets compared.
+    strcmp_calls = 0;
+    for( i=0 ; i<n ; i++ )
+    {
+        snprintf(key, sizeof(key), "key-%u", i);
+        e = hash_table_lookup_key_safe_s(&t, key, strlen(key));
+        CU_ASSERT(e == &entries[i]);
+    }
+    CU_ASSERT(strcmp_calls == n);
+    CU_ASSERT(NULL == hash_table_lookup_key_s(&t, "nope", 4));
+
+    for( i=0 ; i<n ; i++ )
+    {
+        snprintf(key, sizeof(key), "key-%u", i);
+        CU_ASSERT(&entries[i] == hash_table_del_key_safe_s(&t, key, strlen(key)));
+        hash_entry_finit(&entries[i]);
+    }
+    CU_ASSERT(t._nentries == 0);
+
+    hash_table_finit(&t);
+    free(entries);
+}
+
+void testHASHKEYS(void)
+{
+    struct hash_table t;
+    struct hash_table_mem m;
+    struct hash_str_entry * entries = NULL;
+    struct hash_entry probe, plain;
+    char * big = NULL;
+    char key[64];
+    uint32_t i = 0;
+    uint32_t n = 1024;
+    size_t biglen = 3 * HASH_KEY_CHUNK;
+
+    entries = (struct hash_str_entry *)calloc(n + 1, sizeof(struct hash_str_entry));
+    big = (char *)malloc(biglen);
+    CU_ASSERT_FATAL(entries && big);
+    memset(big, 'k', biglen);
+    CU_ASSERT_FATAL(0 == hash_table_init(&t, 16, NULL, fnv_hash));
+
+    //short keys stay in the entry, long ones go to the arena.
+    for( i=0 ; i<n ; i++ )
+    {
+        if(i & 1)
+            snprintf(key, sizeof(key), "short-%u", i);
+        else
+            snprintf(key, sizeof(key), "a-rather-long-key-that-needs-the-arena-%u", i);
+        hash_table_insert_safe_str(&t, &entries[i], key, strlen(key));
+        if(i & 1)
+        {
+            CU_ASSERT(entries[i].e._skey == HASH_KEY_INLINE);
+            CU_ASSERT(entries[i].e.key == entries[i]._ikey);
+        } else {
+            CU_ASSERT(entries[i].e._skey == HASH_KEY_ARENA);
+        }
+    }
+    hash_table_insert_str(&t, &entries[n], big, biglen);
+    CU_ASSERT(entries[n].e._skey == HASH_KEY_ARENA);
+
+    //plain entries have no room of their own, even short keys go to the arena.
+    hash_table_insert_safe_s(&t, &plain, "plain", 5);
+    CU_ASSERT(plain._skey == HASH_KEY_ARENA);
+    CU_ASSERT(&plain == hash_table_lookup_key_safe_s(&t, "plain", 5));
+
+    for( i=0 ; i<n ; i++ )
+    {
+        if(i & 1)
+            snprintf(key, sizeof(key), "short-%u", i);
+        else
+            snprintf(key, sizeof(key), "a-rather-long-key-that-needs-the-arena-%u", i);
+        CU_ASSERT(&entries[i].e == hash_table_lookup_key_safe_s(&t, key, strlen(key)));
+    }
+    CU_ASSERT(&entries[n].e == hash_table_lookup_key_s(&t, big, biglen));
+
+    hash_table_mem_usage(&t, &m);
+    CU_ASSERT(m.keys >= (n/2) * 40 + biglen + 5);
+    CU_ASSERT(m.keys < (n/2) * 48 + biglen + 2 * HASH_KEY_CHUNK);
+
+    //entries set up on their own still copy long keys to the heap.
+    CU_ASSERT(0 == hash_entry_init(&probe, big, biglen, 1));
+    CU_ASSERT(probe._skey == HASH_KEY_HEAP);
+    CU_ASSERT(&entries[n].e == hash_table_lookup_hash_entry(&t, &probe));
+    hash_entry_finit(&probe);
+
+    hash_table_finit(&t);
+    free(big);
+    free(entries);
+}
+
+void testHASHSTRFN(void)
+{
+    size_t (* fns[])(const void *, size_t) =
+        { hash_str_portable, hash_str_crc32c, hash_str };
+    struct hash_table t;
+    struct hash_entry * entries = NULL;
+    char buf[4096 + 8];
+    char key[32];
+    size_t seen[64];
+    uint32_t i, j, f;
+    uint32_t n = 512;
+
+    for( i=0 ; i<sizeof(buf) ; i++ )
+        buf[i] = (char)(i * 131 + 7);
+
+    for( f=0 ; f<sizeof(fns)/sizeof(fns[0]) ; f++ )
+    {
+        //every length takes a different tail: all of them differ.
+        for( i=0 ; i<64 ; i++ )
+        {
+            seen[i] = fns[f](buf, i);
+            for( j=0 ; j<i ; j++ )
+                CU_ASSERT(seen[i] != seen[j]);
+        }
+
+        //same bytes at another alignment, same hash.
+        for( i=1 ; i<=4096 ; i<<=1 )
+        {
+            size_t h = fns[f](buf, i);
+
+            memmove(buf + 5, buf, i);
+            CU_ASSERT(fns[f](buf + 5, i) == h);
+            memmove(buf, buf + 5, i);
+        }
+
+        //one bit flipped anywhere in the key changes the hash.
+        for( i=0 ; i<300 ; i+=7 )
+        {
+            size_t h = fns[f](buf, 300);
+
+            buf[i] ^= 0x10;
+            CU_ASSERT(fns[f](buf, 300) != h);
+            buf[i] ^= 0x10;
+        }
+    }
+    CU_ASSERT(hash_str(buf, 100) == (hash_str_accelerated() ?
+                hash_str_crc32c(buf, 100) : hash_str_portable(buf, 100)));
+    CU_ASSERT(hash_str_crc32c(buf, 16) == hash_str_portable(buf, 16));
+
+    entries = (struct hash_entry *)calloc(n, sizeof(struct hash_entry));
+    CU_ASSERT_FATAL(entries != NULL);
+    CU_ASSERT_FATAL(0 == hash_table_init(&t, 16, NULL, hash_str));
+    for( i=0 ; i<n ; i++ )
+    {
+        snprintf(key, sizeof(key), "strfn-%u", i);
+        hash_table_insert_safe_s(&t, &entries[i], key, strlen(key));
+    }
+    for( i=0 ; i<n ; i++ )
+    {
+        snprintf(key, sizeof(key), "strfn-%u", i);
+        CU_ASSERT(&entries[i] == hash_table_lookup_key_safe_s(&t, key, strlen(key)));
+    }
+    hash_table_finit(&t);
+    free(entries);
+}
+
+void testHASHBATCH(void)
+{
+    struct hash_table t;
+    struct hash_entry * entries = NULL;
+    struct hash_entry ** out = NULL;
+    uintptr_t * keys = NULL;
+    uint32_t i = 0;
+    uint32_t n = 1000;
+
+    entries = (struct hash_entry *)calloc(n, sizeof(struct hash_entry));
+    keys = (uintptr_t *)calloc(2*n, sizeof(uintptr_t));
+    out = (struct hash_entry **)calloc(2*n, sizeof(struct hash_entry *));
+    CU_ASSERT_FATAL(entries && keys && out);
+    CU_ASSERT_FATAL(0 == hash_table_init(&t, 16, hash64_cmp, milu_hash_ptr));
+
+    //every other key is missing, the table is likely still resizing.
+    for( i=0 ; i<n ; i++ )
+    {
+        hash_table_insert_safe_i(&t, &entries[i], (uintptr_t)&entries[i],
+                sizeof(uintptr_t));
+        keys[2*i] = (uintptr_t)&entries[i];
+        keys[2*i+1] = (uintptr_t)&entries[i] + 1;
+    }
+
+    CU_ASSERT(n == hash_table_lookup_batch_i(&t, keys, sizeof(uintptr_t), out, 2*n));
+    for( i=0 ; i<n ; i++ )
+    {
+        CU_ASSERT(out[2*i] == &entries[i]);
+        CU_ASSERT(out[2*i+1] == NULL);
+    }
+
+    CU_ASSERT(n == hash_table_del_batch_i(&t, keys, sizeof(uintptr_t), out, 2*n));
+    for( i=0 ; i<n ; i++ )
+        CU_ASSERT(out[2*i] == &entries[i]);
+    CU_ASSERT(t._nentries == 0);
+    CU_ASSERT(0 == hash_table_lookup_batch_i(&t, keys, sizeof(uintptr_t), out, 2*n));
+
+    hash_table_finit(&t);
+    free(out);
+    free(keys);
+    free(entries);
+}
+
+void testHASHBULK(void)
+{
+    struct hash_table t;
+    struct hash_entry * entries = NULL;
+    struct hash_entry ** ptrs = NULL;
+    struct hash_entry ** out = NULL;
+    uintptr_t * keys = NULL;
+    uint32_t i = 0;
+    uint32_t n = 3000;
+
+    entries = (struct hash_entry *)calloc(n, sizeof(struct hash_entry));
+    ptrs = (struct hash_entry **)calloc(n, sizeof(struct hash_entry *));
+    keys = (uintptr_t *)calloc(n, sizeof(uintptr_t));
+    out = (struct hash_entry **)calloc(n, sizeof(struct hash_entry *));
+    CU_ASSERT_FATAL(entries && ptrs && keys && out);
+    CU_ASSERT_FATAL(0 == hash_table_init(&t, 16, hash64_cmp, milu_hash_ptr));
+
+    for( i=0 ; i<n ; i++ )
+    {
+        ptrs[i] = &entries[i];
+        keys[i] = (uintptr_t)&entries[i];
+    }
+
+    //two bulks, the table grows in between and along the way.
+    hash_table_insert_bulk_i(&t, ptrs, keys, sizeof(uintptr_t), n/2);
+    hash_table_insert_bulk_i(&t, &ptrs[n/2], &keys[n/2], sizeof(uintptr_t), n - n/2);
+    CU_ASSERT(t._nentries == n);
+    for( i=0 ; i<n ; i++ )
+        CU_ASSERT(&entries[i] == hash_table_lookup_key_safe_i(&t, keys[i],
+                    sizeof(uintptr_t)));
+
+    keys[0] += 1; //not there
+    CU_ASSERT(n - 1 == hash_table_del_bulk_i(&t, keys, sizeof(uintptr_t), out, n));
+    CU_ASSERT(out[0] == NULL);
+    for( i=1 ; i<n ; i++ )
+        CU_ASSERT(out[i] == &entries[i]);
+    CU_ASSERT(t._nentries == 1);
+
+    hash_table_finit(&t);
+    free(out);
+    free(keys);
+    free(ptrs);
+    free(entries);
+}
+
+static uint64_t walk_count = 0;
+static uint64_t walk_sum = 0;
+
+static void walk_entry(struct hash_entry * e, void * arg)
+{
+    __sync_fetch_and_add(&walk_count, 1);
+    __sync_fetch_and_add(&walk_sum, (uint64_t)e->key);
+    if(arg)
+        hash_table_del_hash_entry((struct hash_table *)arg, e);
+}
+
+void testHASHWALK(void)
+{
+    struct hash_table t;
+    struct hash_table_iter it1, it2;
+    struct hash_entry * entries = NULL;
+    struct hash_entry * e1 = NULL;
+    struct hash_entry * e2 = NULL;
+    uint64_t sum = 0, pairs = 0;
+    uint32_t i = 0;
+    uint32_t n = 20000;
+
+    entries = (struct hash_entry *)calloc(n, sizeof(struct hash_entry));
+    CU_ASSERT_FATAL(entries != NULL);
+    CU_ASSERT_FATAL(0 == hash_table_init(&t, 16, hash64_cmp, milu_hash_ptr));
+
+    for( i=0 ; i<n ; i++ )
+    {
+        hash_table_insert_safe_i(&t, &entries[i], (uintptr_t)&entries[i],
+                sizeof(uintptr_t));
+        sum += (uintptr_t)&entries[i];
+    }
+    hash_table_finish_resize(&t);
+    CU_ASSERT_FATAL(t.buckets > 2 * HASH_TABLE_WALK_CHUNK);
+
+    //walks don't share a cursor, nesting them visits every pair.
+    hash_table_for_each(e1, &t, it1) {
+        if(e1 - entries >= 100)
+            continue;
+        hash_table_for_each(e2, &t, it2)
+            pairs++;
+    }
+    CU_ASSERT(pairs == 100 * (uint64_t)n);
+
+    walk_count = walk_sum = 0;
+    CU_ASSERT(4 == hash_table_parallel_for_each(&t, 4, walk_entry, NULL));
+    CU_ASSERT(walk_count == n);
+    CU_ASSERT(walk_sum == sum);
+
+    //and the walkers may unlink what they are handed.
+    walk_count = walk_sum = 0;
+    hash_table_parallel_for_each(&t, 3, walk_entry, &t);
+    CU_ASSERT(walk_count == n);
+    CU_ASSERT(walk_sum == sum);
+    CU_ASSERT(t._nentries == 0);
+    CU_ASSERT(t._used_buckets == 0);
+
+    hash_table_finit(&t);
+    free(entries);
 }
 
 void testHASHCOLLIDE(void)
@@ -164,6 +736,16 @@ int main()
         (NULL == CU_add_test(pSuite, "test hashtable insertion", testHASHINSERT)) ||
         (NULL == CU_add_test(pSuite, "test hashtable retrieval", testHASHGET)) ||
         (NULL == CU_add_test(pSuite, "test hashtable expansion", testHASHEXPAND)) ||
+        (NULL == CU_add_test(pSuite, "test hashtable shrinking", testHASHSHRINK)) ||
+        (NULL == CU_add_test(pSuite, "test hashtable stats", testHASHSTATS)) ||
+        (NULL == CU_add_test(pSuite, "test hashtable memory usage", testHASHMEM)) ||
+        (NULL == CU_add_test(pSuite, "test tracking table shards", testHASHSHARD)) ||
+        (NULL == CU_add_test(pSuite, "test string keys", testHASHSTRKEY)) ||
+        (NULL == CU_add_test(pSuite, "test inline and arena keys", testHASHKEYS)) ||
+        (NULL == CU_add_test(pSuite, "test string hash functions", testHASHSTRFN)) ||
+        (NULL == CU_add_test(pSuite, "test batched lookups and deletes", testHASHBATCH)) ||
+        (NULL == CU_add_test(pSuite, "test bulk inserts and deletes", testHASHBULK)) ||
+        (NULL == CU_add_test(pSuite, "test table walks", testHASHWALK)) ||
 #if 0
         (NULL == CU_add_test(pSuite, "test hashtable entry removal", testHASHREMOVE)) ||
         (NULL == CU_add_test(pSuite, "test handling of collisions", testHASHCOLLIDE)) ||
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+extern "C" {
+#include "CUnit/Basic.h"
+}
+
+#include "hashtbl/hashtbl.hpp"
+
+#define N_KEYS 5000
+#define MT_THREADS 4
+#define MT_ROUNDS 20
+
+struct test_struct {
+    int    _testint;
+    struct hash_entry hentry;
+};
+
+/* a weak hash, only the top bits differ: folding has to make up for it */
+struct shifted_hash {
+    size_t operator()(const uintptr_t &k) const { return (size_t)k << 40; }
+};
+
+typedef milu::intrusive_hash_map<uintptr_t, test_struct,
+        &test_struct::hentry> ptr_map;
+typedef milu::intrusive_hash_map<int, test_struct,
+        &test_struct::hentry> int_map;
+typedef milu::intrusive_hash_map<uintptr_t, test_struct,
+        &test_struct::hentry, shifted_hash> shifted_map;
+
+static test_struct tss[N_KEYS];
+
+/* The suite initialization function.
+ * Returns zero on success, non-zero otherwise.
+ * */
+int init_suite1(void)
+{
+    return 0;
+}
+
+/* The suite cleanup function.
+ * Returns zero on success, non-zero otherwise.
+ * */
+int clean_suite1(void)
+{
+    return 0;
+}
+
+/* inserts go through several incremental resizes. */
+void testHASHMAPPTR(void)
+{
+    ptr_map m;
+    size_t buckets = m.table()->buckets;
+
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        tss[i]._testint = i;
+        m.insert((uintptr_t)&tss[i], tss[i]);
+    }
+    CU_ASSERT( m.size() == N_KEYS );
+    CU_ASSERT( m.table()->buckets > buckets );
+
+    //some buckets may still sit in the old array.
+    for( int i=0 ; i<N_KEYS ; i++ )
+        CU_ASSERT( m.find((uintptr_t)&tss[i]) == &tss[i] );
+    CU_ASSERT( m.find(0) == NULL );
+
+    //the C calls see the same keys.
+    CU_ASSERT( hash_table_lookup_key_safe_i(m.table(), (uintptr_t)&tss[7],
+                sizeof(uintptr_t)) == &tss[7].hentry );
+
+    for( int i=0 ; i<N_KEYS ; i+=2 )
+        CU_ASSERT( m.erase((uintptr_t)&tss[i]) == &tss[i] );
+    CU_ASSERT( m.erase((uintptr_t)&tss[0]) == NULL );
+    CU_ASSERT( m.size() == N_KEYS / 2 );
+    for( int i=0 ; i<N_KEYS ; i++ )
+        CU_ASSERT( m.find((uintptr_t)&tss[i]) == ((i & 1) ? &tss[i] : NULL) );
+}
+
+struct count_keys {
+    int seen;
+    void operator()(int k, test_struct &obj)
+    {
+        CU_ASSERT( k == obj._testint );
+        seen++;
+    }
+};
+
+struct odd_keys {
+    bool operator()(int k, test_struct &) const { return (k & 1); }
+};
+
+void testHASHMAPINT(void)
+{
+    int_map m(N_KEYS);
+    count_keys f;
+
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        tss[i]._testint = -i;
+        m.insert(-i, tss[i]);
+    }
+    for( int i=0 ; i<N_KEYS ; i++ )
+        CU_ASSERT( m.find(-i) == &tss[i] );
+    CU_ASSERT( m.find(1) == NULL );
+
+    f.seen = 0;
+    f = m.for_each(f);
+    CU_ASSERT( f.seen == N_KEYS );
+
+    CU_ASSERT( m.erase_if(odd_keys()) == N_KEYS / 2 );
+    CU_ASSERT( m.size() == N_KEYS - N_KEYS / 2 );
+    for( int i=0 ; i<N_KEYS ; i++ )
+        CU_ASSERT( m.find(-i) == ((i & 1) ? NULL : &tss[i]) );
+}
+
+void testHASHMAPHASH(void)
+{
+    shifted_map m;
+
+    for( int i=0 ; i<N_KEYS ; i++ )
+        m.insert((uintptr_t)i, tss[i]);
+    for( int i=0 ; i<N_KEYS ; i++ )
+        CU_ASSERT( m.find((uintptr_t)i) == &tss[i] );
+    CU_ASSERT( m.erase((uintptr_t)(N_KEYS - 1)) == &tss[N_KEYS - 1] );
+    CU_ASSERT( m.find((uintptr_t)(N_KEYS - 1)) == NULL );
+}
+
+struct mt_arg {
+    ptr_map *m;
+    int first; /* keys [first, first + N_KEYS / MT_THREADS) are ours */
+    int bad;
+};
+
+/* each thread inserts and erases its own keys while the others resize */
+static void *mt_worker(void *arg)
+{
+    struct mt_arg *a = (struct mt_arg *)arg;
+    int n = N_KEYS / MT_THREADS;
+
+    for( int r=0 ; r<MT_ROUNDS ; r++ ) {
+        for( int i=a->first ; i<a->first + n ; i++ )
+            a->m->insert((uintptr_t)&tss[i], tss[i]);
+        for( int i=a->first ; i<a->first + n ; i++ )
+            if(a->m->erase((uintptr_t)&tss[i]) != &tss[i])
+                a->bad++;
+        if(a->m->erase((uintptr_t)&tss[a->first]) != NULL)
+            a->bad++;
+    }
+    return NULL;
+}
+
+void testHASHMAPMT(void)
+{
+    ptr_map m;
+    pthread_t tids[MT_THREADS];
+    struct mt_arg args[MT_THREADS];
+
+    for( int t=0 ; t<MT_THREADS ; t++ ) {
+        args[t].m = &m;
+        args[t].first = t * (N_KEYS / MT_THREADS);
+        args[t].bad = 0;
+        CU_ASSERT_FATAL( pthread_create(&tids[t], NULL, mt_worker, &args[t]) == 0 );
+    }
+    for( int t=0 ; t<MT_THREADS ; t++ ) {
+        pthread_join(tids[t], NULL);
+        CU_ASSERT( args[t].bad == 0 );
+    }
+    CU_ASSERT( m.empty() );
+}
+
+/* The main() function for setting up and running the tests.
+ *  * Returns a CUE_SUCCESS on successful running, another
+ *   * CUnit error code on failure.
+ *    */
+int main()
+{
+    CU_pSuite pSuite = NULL;
+
+    /* initialize the CUnit test registry */
+    if (CUE_SUCCESS != CU_initialize_registry())
+        return CU_get_error();
+
+    /* add a suite to the registry */
+    pSuite = CU_add_suite("Suite_1", init_suite1, clean_suite1);
+    if (NULL == pSuite) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    /* add the tests to the suite */
+    if ((NULL == CU_add_test(pSuite, "test pointer keys", testHASHMAPPTR)) ||
+        (NULL == CU_add_test(pSuite, "test int keys and walks", testHASHMAPINT)) ||
+        (NULL == CU_add_test(pSuite, "test custom hash", testHASHMAPHASH)) ||
+        (NULL == CU_add_test(pSuite, "test concurrent insert/erase", testHASHMAPMT)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    /* Run all tests using the CUnit Basic interface */
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+    CU_cleanup_registry();
+    return CU_get_error();
+}
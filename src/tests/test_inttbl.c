@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h> 
+#include "CUnit/Basic.h"
+
+#include "hashtbl/inttbl.h"
+
+
+static struct int_table _itable;
+#define N_KEYS 5000
+
+struct test_struct {
+    int    _testint;
+    struct int_entry ientry;
+};
+
+struct test_struct tss[N_KEYS];
+
+/* The suite initialization function.
+ * Returns zero on success, non-zero otherwise.
+ * */
+int init_suite1(void)
+{
+    return 0;
+}
+
+/* The suite cleanup function.
+ * Returns zero on success, non-zero otherwise.
+ * */
+int clean_suite1(void)
+{
+    return 0;
+}
+
+void testINTTBLCREATE(void)
+{
+    CU_ASSERT( sizeof(struct int_entry) == 2 * sizeof(void *) );
+    CU_ASSERT( int_table_init(&_itable, 16) == 0 );
+    CU_ASSERT( _itable.buckets >= 16 );
+    CU_ASSERT( _itable._nentries == 0 );
+}
+
+/* inserts go through several incremental resizes. */
+void testINTTBLINSERT(void)
+{
+    size_t old_buckets = _itable.buckets;
+
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        tss[i]._testint = i;
+        int_table_insert_safe(&_itable, &tss[i].ientry, (uintptr_t)&tss[i]);
+    }
+    CU_ASSERT( _itable._nentries == N_KEYS );
+    CU_ASSERT( _itable.buckets > old_buckets );
+}
+
+void testINTTBLGET(void)
+{
+    struct int_entry * e = NULL;
+
+    //some buckets may still sit in the old array.
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        e = int_table_lookup_safe(&_itable, (uintptr_t)&tss[i]);
+        CU_ASSERT( e == &tss[i].ientry );
+    }
+
+    int_table_finish_resize(&_itable);
+    CU_ASSERT( !int_table_resizing(&_itable) );
+
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        e = int_table_lookup(&_itable, (uintptr_t)&tss[i]);
+        CU_ASSERT( e == &tss[i].ientry );
+    }
+    CU_ASSERT( int_table_lookup(&_itable, (uintptr_t)&e) == NULL );
+}
+
+void testINTTBLREMOVE(void)
+{
+    for( int i=0 ; i<N_KEYS ; i+=2 ) {
+        CU_ASSERT( int_table_del_safe(&_itable, (uintptr_t)&tss[i]) == &tss[i].ientry );
+    }
+    CU_ASSERT( _itable._nentries == N_KEYS/2 );
+
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        if( i % 2 )
+            CU_ASSERT( int_table_lookup(&_itable, (uintptr_t)&tss[i]) == &tss[i].ientry );
+        else
+            CU_ASSERT( int_table_lookup(&_itable, (uintptr_t)&tss[i]) == NULL );
+    }
+    CU_ASSERT( int_table_del(&_itable, (uintptr_t)&tss[0]) == NULL );
+}
+
+void testINTTBLDESTROY(void)
+{
+    size_t i = 0, n = 0;
+    struct int_entry * e = NULL;
+    struct int_entry * next = NULL;
+    struct hash_table_mem m;
+
+    int_table_mem_usage(&_itable, &m);
+    CU_ASSERT( m.buckets == _itable.buckets * sizeof(struct int_entry *) );
+
+    int_table_for_each_safe(e, &_itable, next, i) {
+        CU_ASSERT( int_table_del(&_itable, e->key) == e );
+        n++;
+    }
+    CU_ASSERT( n == N_KEYS/2 );
+    CU_ASSERT( _itable._nentries == 0 );
+    CU_ASSERT( _itable._used_buckets == 0 );
+
+    int_table_finit(&_itable);
+    CU_ASSERT( _itable.table == NULL );
+}
+
+/* The main() function for setting up and running the tests.
+ *  * Returns a CUE_SUCCESS on successful running, another
+ *   * CUnit error code on failure.
+ *    */
+int main()
+{
+    CU_pSuite pSuite = NULL;
+
+    /* initialize the CUnit test registry */
+    if (CUE_SUCCESS != CU_initialize_registry())
+        return CU_get_error();
+
+    /* add a suite to the registry */
+    pSuite = CU_add_suite("Suite_1", init_suite1, clean_suite1);
+    if (NULL == pSuite) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    /* add the tests to the suite */
+    /* NOTE - ORDER IS IMPORTANT */
+    if ((NULL == CU_add_test(pSuite, "test int table creation", testINTTBLCREATE)) ||
+        (NULL == CU_add_test(pSuite, "test int table insertion", testINTTBLINSERT)) ||
+        (NULL == CU_add_test(pSuite, "test int table retrieval", testINTTBLGET)) ||
+        (NULL == CU_add_test(pSuite, "test int table removal", testINTTBLREMOVE)) ||
+        (NULL == CU_add_test(pSuite, "test int table destruction", testINTTBLDESTROY)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    /* Run all tests using the CUnit Basic interface */
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+    CU_cleanup_registry();
+    return CU_get_error();
+}
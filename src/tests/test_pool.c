@@ -1,6 +1,12 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h> 
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "CUnit/Basic.h"
 
 #include "pool/pool.h"
@@ -74,11 +80,533 @@ void testPOOLBANKPUTALL(void)
     }
 }
 
+/* a misplaced pointer is refused, the free list stays intact */
+void testPOOLPUTINVALID(void)
+{
+    struct pool * p = create_pool(POOLSZ, sizeof(struct test_struct));
+    char * obj = NULL;
+
+    CU_ASSERT_FATAL(p != NULL);
+    CU_ASSERT(create_pool(POOLSZ, 2) == NULL);
+
+    obj = pool_get_ptr(p);
+    CU_ASSERT(pool_put_ptr(p, obj + 1) == -1);
+    CU_ASSERT(pool_put_ptr(p, (void *)p->_end_addr) == -1);
+    CU_ASSERT(pool_put_ptr(p, obj) == 0);
+    CU_ASSERT(pool_nfree(p) == POOLSZ);
+    CU_ASSERT(destroy_pool(p) == 0);
+}
+
+#define MANY_POOLS 200
+
+/* puts find their pool through the segment map, not by trying each one */
+void testPOOLBANKMAP(void)
+{
+    struct bank * b = create_bank(MANY_POOLS, 0, POOLSZ, sizeof(struct test_struct));
+    struct test_struct ** objs = NULL;
+    struct test_struct local;
+    void * heap = NULL;
+    int n = MANY_POOLS * POOLSZ;
+
+    CU_ASSERT_FATAL(b != NULL);
+    objs = calloc(n, sizeof(*objs));
+    CU_ASSERT_FATAL(objs != NULL);
+
+    for( int i=0 ; i<n ; i++ ) {
+        struct pool * p = NULL;
+
+        objs[i] = bank_get_ptr(b);
+        CU_ASSERT_FATAL(objs[i] != NULL);
+        p = bank_pool_of(b, objs[i]);
+        CU_ASSERT_FATAL(p != NULL);
+        CU_ASSERT((uintptr_t)objs[i] >= p->_start_addr &&
+                (uintptr_t)objs[i] < p->_end_addr);
+        CU_ASSERT(((uintptr_t)p->_pool_mem & (POOL_SEG_SIZE - 1)) == 0);
+    }
+
+    //not from the bank.
+    heap = malloc(sizeof(struct test_struct));
+    CU_ASSERT(bank_put_ptr(b, heap) == -1);
+    CU_ASSERT(bank_put_ptr(b, &local) == -1);
+    CU_ASSERT(bank_pool_of(b, NULL) == NULL);
+    free(heap);
+
+    //back to front, so puts land all over the map.
+    for( int i=n-1 ; i>=0 ; i-- )
+        CU_ASSERT(bank_put_ptr(b, objs[i]) == 0);
+    for( int i=0 ; i<b->_allocd_pools ; i++ )
+        CU_ASSERT(pool_nfree(bank_pool(b, i)) == POOLSZ);
+
+    free(objs);
+    CU_ASSERT(destroy_bank(b) == 0);
+}
+
+/* exhausted pools drop out of the bitmap, a put brings its pool back */
+void testPOOLBANKAVAIL(void)
+{
+    struct bank * b = create_bank(MANY_POOLS, 0, POOLSZ, sizeof(struct test_struct));
+    struct test_struct ** objs = NULL;
+    struct test_struct * obj = NULL;
+    int n = MANY_POOLS * POOLSZ;
+    int idx = 0;
+
+    CU_ASSERT_FATAL(b != NULL);
+    objs = calloc(n, sizeof(*objs));
+    CU_ASSERT_FATAL(objs != NULL);
+    CU_ASSERT(b->_avail_sum == ((1ULL << ((MANY_POOLS + 63) / 64)) - 1));
+
+    for( int i=0 ; i<n ; i++ ) {
+        objs[i] = bank_get_ptr(b);
+        CU_ASSERT_FATAL(objs[i] != NULL);
+    }
+    CU_ASSERT(bank_get_ptr(b) == NULL);
+    CU_ASSERT(b->_avail_sum == 0);
+    for( int i=0 ; i<BANK_MAX_POOLS / 64 ; i++ )
+        CU_ASSERT(b->_avail[i] == 0);
+
+    //a pool far down the bank is the only one with room.
+    idx = (MANY_POOLS - 3) * POOLSZ + 4;
+    CU_ASSERT(bank_put_ptr(b, objs[idx]) == 0);
+    CU_ASSERT(b->_avail_sum != 0);
+    obj = bank_get_ptr(b);
+    CU_ASSERT(obj == objs[idx]);
+    CU_ASSERT(bank_get_ptr(b) == NULL);
+
+    for( int i=0 ; i<n ; i++ )
+        CU_ASSERT(bank_put_ptr(b, objs[i]) == 0);
+    for( int i=0 ; i<n ; i++ )
+        CU_ASSERT(bank_get_ptr(b) != NULL);
+
+    free(objs);
+    CU_ASSERT(destroy_bank(b) == 0);
+}
+
+#define GROW_OBJS 1000
+
+/* a growing bank adds pools, each twice the previous, when it runs out */
+void testPOOLBANKGROW(void)
+{
+    struct bank * b = create_bank(1, 1, POOLSZ, sizeof(struct test_struct));
+    struct test_struct * objs[GROW_OBJS];
+    uint32_t total = 0;
+
+    CU_ASSERT_FATAL(b != NULL);
+    for( int i=0 ; i<GROW_OBJS ; i++ ) {
+        objs[i] = bank_get_ptr(b);
+        CU_ASSERT_FATAL(objs[i] != NULL);
+        objs[i]->_testint = i;
+    }
+    CU_ASSERT(b->_allocd_pools > 1);
+    for( int i=0 ; i<b->_allocd_pools ; i++ ) {
+        CU_ASSERT(bank_pool(b, i)->_nobjs == (uint32_t)POOLSZ << i);
+        total += bank_pool(b, i)->_nobjs;
+    }
+    //no pool added before the ones there ran out.
+    CU_ASSERT(total - bank_pool(b, b->_allocd_pools - 1)->_nobjs < GROW_OBJS);
+
+    for( int i=0 ; i<GROW_OBJS ; i++ ) {
+        CU_ASSERT(objs[i]->_testint == i);
+        CU_ASSERT(bank_put_ptr(b, objs[i]) == 0);
+    }
+    CU_ASSERT(destroy_bank(b) == 0);
+
+    //big objects: pools stop doubling at BANK_MAX_POOL_BYTES.
+    b = create_bank(1, 1, 8, BANK_MAX_POOL_BYTES / 32);
+    CU_ASSERT_FATAL(b != NULL);
+    for( int i=0 ; i<8 + 16 + 32 + 1 ; i++ )
+        CU_ASSERT_FATAL(bank_get_ptr(b) != NULL);
+    CU_ASSERT(b->_allocd_pools == 4);
+    CU_ASSERT(bank_pool(b, 2)->_nobjs == 32);
+    CU_ASSERT(bank_pool(b, 3)->_nobjs == 32);
+    CU_ASSERT(b->_nextsz == 32);
+    CU_ASSERT(destroy_bank(b) == 0);
+}
+
+/* magazines go to the bank a batch at a time */
+void testPOOLBANKMAG(void)
+{
+    struct bank * b = create_bank(1, 0, 4 * BANK_MAG_BATCH, sizeof(struct test_struct));
+    struct bank_magazine m;
+    struct test_struct * objs[3 * BANK_MAG_BATCH];
+    struct test_struct local;
+    struct pool * p = NULL;
+
+    CU_ASSERT_FATAL(b != NULL);
+    memset(&m, 0, sizeof(m));
+    p = bank_pool(b, 0);
+
+    objs[0] = bank_mag_get(b, &m);
+    CU_ASSERT_FATAL(objs[0] != NULL);
+    CU_ASSERT(m.n == BANK_MAG_BATCH - 1);
+    CU_ASSERT(pool_nfree(p) == 3 * BANK_MAG_BATCH);
+    for( int i=1 ; i<3 * BANK_MAG_BATCH ; i++ ) {
+        objs[i] = bank_mag_get(b, &m);
+        CU_ASSERT_FATAL(objs[i] != NULL);
+    }
+    CU_ASSERT(pool_nfree(p) == BANK_MAG_BATCH);
+
+    CU_ASSERT(bank_mag_put(b, &m, &local) == -1);
+    CU_ASSERT(bank_mag_put(b, &m, (char *)objs[0] + 1) == -1);
+
+    //a full magazine gives its older half back.
+    for( int i=0 ; i<3 * BANK_MAG_BATCH ; i++ )
+        CU_ASSERT(bank_mag_put(b, &m, objs[i]) == 0);
+    CU_ASSERT(m.n == 2 * BANK_MAG_BATCH);
+    CU_ASSERT(pool_nfree(p) == 2 * BANK_MAG_BATCH);
+    CU_ASSERT(m.obj[m.n - 1] == objs[3 * BANK_MAG_BATCH - 1]);
+
+    bank_mag_flush(b, &m);
+    CU_ASSERT(m.n == 0);
+    CU_ASSERT(pool_nfree(p) == 4 * BANK_MAG_BATCH);
+
+    //and the pool is whole again.
+    CU_ASSERT(bank_get_batch(b, (void **)objs, 3 * BANK_MAG_BATCH) == 3 * BANK_MAG_BATCH);
+    CU_ASSERT(bank_put_batch(b, (void **)objs, 3 * BANK_MAG_BATCH) == 0);
+    CU_ASSERT(destroy_bank(b) == 0);
+}
+
+#define TRIM_OBJS 1024
+
+/* pages resident in [@mem, @mem + @len) */
+static size_t resident_pages(void * mem, size_t len)
+{
+    long pg = sysconf(_SC_PAGESIZE);
+    size_t n = (len + pg - 1) / pg;
+    unsigned char * vec = malloc(n);
+    size_t res = 0;
+
+    if(!vec || mincore(mem, len, vec)) {
+        free(vec);
+        return (size_t)-1;
+    }
+    for( size_t i=0 ; i<n ; i++ )
+        res += vec[i] & 1;
+    free(vec);
+    return res;
+}
+
+/* idle mmap'ed pools give their pages back, and come back when needed */
+void testPOOLBANKTRIM(void)
+{
+    struct bank * b = create_bank_flags(2, 0, TRIM_OBJS, 64, POOL_MMAP);
+    struct pool * p0 = NULL;
+    struct pool * p1 = NULL;
+    struct pool * hp = NULL;
+    void ** objs = NULL;
+    void * obj = NULL;
+
+    CU_ASSERT_FATAL(b != NULL);
+    objs = calloc(2 * TRIM_OBJS, sizeof(void *));
+    CU_ASSERT_FATAL(objs != NULL);
+    p0 = bank_pool(b, 0);
+    p1 = bank_pool(b, 1);
+    CU_ASSERT(p0->_flags & POOL_MMAP);
+    CU_ASSERT((p1->_start_addr & (POOL_SEG_SIZE - 1)) == 0);
+
+    //pool 0 in use, pool 1 all free: only pool 1 goes, and not right away.
+    bank_set_idle(b, 0);
+    obj = bank_get_ptr(b);
+    CU_ASSERT(bank_pool_of(b, obj) == p0);
+    CU_ASSERT(bank_trim(b) == 0);
+    CU_ASSERT(resident_pages(p1->_raw_mem, p1->_raw_len) > 0);
+    CU_ASSERT(bank_trim(b) == 1);
+    CU_ASSERT(p1->_flags & POOL_PURGED);
+    CU_ASSERT(!(p0->_flags & POOL_PURGED));
+    CU_ASSERT(resident_pages(p1->_raw_mem, p1->_raw_len) == 0);
+    CU_ASSERT(bank_trim(b) == 0);
+
+    //pool 0 runs out, pool 1 is brought back rather than failing.
+    objs[0] = obj;
+    for( int i=1 ; i<2 * TRIM_OBJS ; i++ ) {
+        objs[i] = bank_get_ptr(b);
+        CU_ASSERT_FATAL(objs[i] != NULL);
+        memset(objs[i], 0xa5, 64);
+    }
+    CU_ASSERT(!(p1->_flags & POOL_PURGED));
+    CU_ASSERT(bank_get_ptr(b) == NULL);
+    for( int i=0 ; i<2 * TRIM_OBJS ; i++ )
+        CU_ASSERT(bank_put_ptr(b, objs[i]) == 0);
+
+    //a pool that's given objects away since isn't idle anymore.
+    CU_ASSERT(bank_trim(b) == 0);
+    obj = bank_get_ptr(b);
+    CU_ASSERT(bank_trim(b) == 1);
+    CU_ASSERT(bank_put_ptr(b, obj) == 0);
+    CU_ASSERT(destroy_bank(b) == 0);
+
+    //huge page pools start on a huge page.
+    hp = create_pool_flags(TRIM_OBJS, 64, POOL_HUGEPAGE);
+    CU_ASSERT_FATAL(hp != NULL);
+    CU_ASSERT(hp->_flags & POOL_MMAP);
+    CU_ASSERT((hp->_start_addr & (POOL_HUGEPAGE_SIZE - 1)) == 0);
+    CU_ASSERT(pool_get_ptr(hp) == hp->_pool_mem);
+    CU_ASSERT(destroy_pool(hp) == 0);
+
+    free(objs);
+}
+
+/* ticks trim on the clock alone, no matter how few calls come by */
+void testPOOLBANKTRIMTICK(void)
+{
+    struct bank * b = create_bank_flags(2, 0, TRIM_OBJS, 64, POOL_MMAP);
+    struct bank * nb = create_bank(2, 0, TRIM_OBJS, 64);
+    struct pool * p1 = NULL;
+    void * obj = NULL;
+
+    CU_ASSERT_FATAL(b != NULL);
+    CU_ASSERT_FATAL(nb != NULL);
+    p1 = bank_pool(b, 1);
+    bank_set_idle(b, 20);
+    obj = bank_get_ptr(b);
+
+    //the first tick only looks, the next one before the interval is free.
+    CU_ASSERT(bank_trim_tick(b) == 0);
+    CU_ASSERT(bank_trim_tick(b) == 0);
+    CU_ASSERT(!(p1->_flags & POOL_PURGED));
+
+    //one tick after the idle time purges, without a single release.
+    usleep(40000);
+    CU_ASSERT(bank_trim_tick(b) == 1);
+    CU_ASSERT(p1->_flags & POOL_PURGED);
+    CU_ASSERT(resident_pages(p1->_raw_mem, p1->_raw_len) == 0);
+
+    //banks on the heap have nothing to trim.
+    CU_ASSERT(bank_trim_tick(nb) == 0);
+
+    CU_ASSERT(bank_put_ptr(b, obj) == 0);
+    CU_ASSERT(destroy_bank(b) == 0);
+    CU_ASSERT(destroy_bank(nb) == 0);
+}
+
+#define MT_THREADS 4
+#define MT_OBJS 64
+#define MT_ROUNDS 100000
+
+static struct pool * _mt_pool = NULL;
+
+/* holds a few objects at a time, any object held twice gets caught */
+static void * _pool_worker(void * arg)
+{
+    struct test_struct * held[4];
+    intptr_t id = (intptr_t)arg;
+    long bad = 0;
+
+    for( int r=0 ; r<MT_ROUNDS ; r++ ) {
+        int n = 1 + (r & 3);
+
+        for( int i=0 ; i<n ; i++ ) {
+            held[i] = pool_get_ptr(_mt_pool);
+            if(!held[i]) {
+                bad++;
+                n = i;
+                break;
+            }
+            held[i]->_testint = (int)id;
+            held[i]->_testptr = (char *)held[i];
+        }
+        for( int i=0 ; i<n ; i++ ) {
+            if(held[i]->_testint != (int)id || held[i]->_testptr != (char *)held[i])
+                bad++;
+            if(pool_put_ptr(_mt_pool, held[i]))
+                bad++;
+        }
+    }
+    return (void *)bad;
+}
+
+void testPOOLCONCURRENT(void)
+{
+    pthread_t th[MT_THREADS];
+    struct test_struct * objs[MT_OBJS];
+    void * bad = NULL;
+    long errors = 0;
+
+    _mt_pool = create_pool(MT_OBJS, sizeof(struct test_struct));
+    CU_ASSERT_FATAL(_mt_pool != NULL);
+
+    for( intptr_t i=0 ; i<MT_THREADS ; i++ )
+        CU_ASSERT_FATAL(0 == pthread_create(&th[i], NULL, _pool_worker, (void *)i));
+    for( int i=0 ; i<MT_THREADS ; i++ ) {
+        pthread_join(th[i], &bad);
+        errors += (long)bad;
+    }
+    CU_ASSERT(errors == 0);
+    CU_ASSERT(pool_nfree(_mt_pool) == MT_OBJS);
+
+    //every object came back exactly once.
+    for( int i=0 ; i<MT_OBJS ; i++ ) {
+        objs[i] = pool_get_ptr(_mt_pool);
+        CU_ASSERT_FATAL(objs[i] != NULL);
+        for( int j=0 ; j<i ; j++ )
+            CU_ASSERT(objs[i] != objs[j]);
+    }
+    CU_ASSERT(pool_get_ptr(_mt_pool) == NULL);
+    CU_ASSERT(destroy_pool(_mt_pool) == 0);
+}
+
 void testPOOLBANKDESTROY(void)
 {
     CU_ASSERT(destroy_bank(_bank) == 0);
 }
 
+static struct bank * _mt_bank = NULL;
+
+/* same as _pool_worker(), through a bank that starts out too small.
+ * odd threads go through a magazine. */
+static void * _bank_worker(void * arg)
+{
+    struct test_struct * held[16];
+    struct bank_magazine m;
+    intptr_t id = (intptr_t)arg;
+    long bad = 0;
+
+    memset(&m, 0, sizeof(m));
+    for( int r=0 ; r<MT_ROUNDS / 4 ; r++ ) {
+        int n = 1 + (r & 15);
+
+        for( int i=0 ; i<n ; i++ ) {
+            held[i] = (id & 1) ? bank_mag_get(_mt_bank, &m) : bank_get_ptr(_mt_bank);
+            if(!held[i]) {
+                bad++;
+                n = i;
+                break;
+            }
+            held[i]->_testint = (int)id;
+            held[i]->_testptr = (char *)held[i];
+        }
+        if(!(r & 255))
+            sched_yield();
+        for( int i=0 ; i<n ; i++ ) {
+            if(held[i]->_testint != (int)id || held[i]->_testptr != (char *)held[i])
+                bad++;
+            if((id & 1) ? bank_mag_put(_mt_bank, &m, held[i]) :
+                    bank_put_ptr(_mt_bank, held[i]))
+                bad++;
+        }
+    }
+    bank_mag_flush(_mt_bank, &m);
+    return (void *)bad;
+}
+
+void testPOOLBANKCONCURRENT(void)
+{
+    pthread_t th[MT_THREADS];
+    void * bad = NULL;
+    long errors = 0;
+    uint32_t total = 0;
+
+    _mt_bank = create_bank(1, 1, 4, sizeof(struct test_struct));
+    CU_ASSERT_FATAL(_mt_bank != NULL);
+
+    for( intptr_t i=0 ; i<MT_THREADS ; i++ )
+        CU_ASSERT_FATAL(0 == pthread_create(&th[i], NULL, _bank_worker, (void *)i));
+    for( int i=0 ; i<MT_THREADS ; i++ ) {
+        pthread_join(th[i], &bad);
+        errors += (long)bad;
+    }
+    CU_ASSERT(errors == 0);
+
+    //everything came back.
+    for( int i=0 ; i<_mt_bank->_allocd_pools ; i++ ) {
+        CU_ASSERT(pool_nfree(bank_pool(_mt_bank, i)) == bank_pool(_mt_bank, i)->_nobjs);
+        total += bank_pool(_mt_bank, i)->_nobjs;
+    }
+    CU_ASSERT(total >= 16);
+    CU_ASSERT(destroy_bank(_mt_bank) == 0);
+}
+
+static struct bank_pcpu * _mt_pcpu = NULL;
+
+static void * _pcpu_worker(void * arg)
+{
+    struct test_struct * held[16];
+    intptr_t id = (intptr_t)arg;
+    long bad = 0;
+
+    for( int r=0 ; r<MT_ROUNDS / 4 ; r++ ) {
+        int n = 1 + (r & 15);
+
+        for( int i=0 ; i<n ; i++ ) {
+            held[i] = bank_pcpu_get(_mt_pcpu);
+            if(!held[i]) {
+                bad++;
+                n = i;
+                break;
+            }
+            held[i]->_testint = (int)id;
+            held[i]->_testptr = (char *)held[i];
+        }
+        if(!(r & 255))
+            sched_yield();
+        for( int i=0 ; i<n ; i++ ) {
+            if(held[i]->_testint != (int)id || held[i]->_testptr != (char *)held[i])
+                bad++;
+            if(bank_pcpu_put(_mt_pcpu, held[i]))
+                bad++;
+        }
+    }
+    return (void *)bad;
+}
+
+/* per-CPU caches, rseq (where there is) and locked */
+void testPOOLBANKPCPU(void)
+{
+    uint8_t modes[] = { BANK_PCPU_RSEQ, BANK_PCPU_LOCK };
+    pthread_t th[MT_THREADS];
+    struct test_struct local;
+    cpu_set_t saved, one;
+    void * obj = NULL;
+    void * bad = NULL;
+    long errors = 0;
+    int pinned = 0;
+    int cpu = 0;
+
+    for( int m=0 ; m<2 ; m++ ) {
+        _mt_bank = create_bank(1, 1, 4, sizeof(struct test_struct));
+        CU_ASSERT_FATAL(_mt_bank != NULL);
+        _mt_pcpu = create_bank_pcpu(_mt_bank, modes[m]);
+        if(!_mt_pcpu) {
+            //no rseq here, the locked mode still has to work.
+            CU_ASSERT(modes[m] == BANK_PCPU_RSEQ);
+            destroy_bank(_mt_bank);
+            continue;
+        }
+        CU_ASSERT(_mt_pcpu->mode == modes[m]);
+
+        obj = bank_pcpu_get(_mt_pcpu);
+        CU_ASSERT_FATAL(obj != NULL);
+        CU_ASSERT(bank_pcpu_put(_mt_pcpu, &local) == -1);
+        //it stays on this CPU, as long as we do.
+        pinned = 0;
+        if(!sched_getaffinity(0, sizeof(saved), &saved) &&
+                (cpu = sched_getcpu()) >= 0) {
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            pinned = !sched_setaffinity(0, sizeof(one), &one);
+        }
+        CU_ASSERT(bank_pcpu_put(_mt_pcpu, obj) == 0);
+        if(pinned) {
+            CU_ASSERT(bank_pcpu_get(_mt_pcpu) == obj);
+            CU_ASSERT(bank_pcpu_put(_mt_pcpu, obj) == 0);
+            sched_setaffinity(0, sizeof(saved), &saved);
+        }
+
+        errors = 0;
+        for( intptr_t i=0 ; i<MT_THREADS ; i++ )
+            CU_ASSERT_FATAL(0 == pthread_create(&th[i], NULL, _pcpu_worker, (void *)i));
+        for( int i=0 ; i<MT_THREADS ; i++ ) {
+            pthread_join(th[i], &bad);
+            errors += (long)bad;
+        }
+        CU_ASSERT(errors == 0);
+
+        destroy_bank_pcpu(_mt_pcpu);
+        for( int i=0 ; i<_mt_bank->_allocd_pools ; i++ )
+            CU_ASSERT(pool_nfree(bank_pool(_mt_bank, i)) == bank_pool(_mt_bank, i)->_nobjs);
+        CU_ASSERT(destroy_bank(_mt_bank) == 0);
+    }
+}
+
 /* The main() function for setting up and running the tests.
  *  * Returns a CUE_SUCCESS on successful running, another
  *   * CUnit error code on failure.
@@ -105,7 +633,17 @@ int main()
         (NULL == CU_add_test(pSuite, "test pool bank object queueing", testPOOLBANKPUT)) ||
         (NULL == CU_add_test(pSuite, "test pool bank object exhaustion", testPOOLBANKGETALL)) ||
         (NULL == CU_add_test(pSuite, "test pool bank object restoration", testPOOLBANKPUTALL)) ||
-        (NULL == CU_add_test(pSuite, "test pool bank destruction", testPOOLBANKDESTROY)))
+        (NULL == CU_add_test(pSuite, "test pool bank destruction", testPOOLBANKDESTROY)) ||
+        (NULL == CU_add_test(pSuite, "test pool invalid pointers", testPOOLPUTINVALID)) ||
+        (NULL == CU_add_test(pSuite, "test pointer to pool map", testPOOLBANKMAP)) ||
+        (NULL == CU_add_test(pSuite, "test pools with room bitmap", testPOOLBANKAVAIL)) ||
+        (NULL == CU_add_test(pSuite, "test bank growth", testPOOLBANKGROW)) ||
+        (NULL == CU_add_test(pSuite, "test thread magazines", testPOOLBANKMAG)) ||
+        (NULL == CU_add_test(pSuite, "test idle pool trimming", testPOOLBANKTRIM)) ||
+        (NULL == CU_add_test(pSuite, "test timed pool trimming", testPOOLBANKTRIMTICK)) ||
+        (NULL == CU_add_test(pSuite, "test concurrent pool get and put", testPOOLCONCURRENT)) ||
+        (NULL == CU_add_test(pSuite, "test concurrent bank get, put and growth", testPOOLBANKCONCURRENT)) ||
+        (NULL == CU_add_test(pSuite, "test per-cpu caches", testPOOLBANKPCPU)))
     {
         CU_cleanup_registry();
         return CU_get_error();
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h> 
+#include "CUnit/Basic.h"
+
+#include "hashtbl/ptrtbl.h"
+
+
+static struct ptr_table _ptable;
+#define N_KEYS 5000
+
+struct test_struct {
+    int    _testint;
+    char * _testptr;
+};
+
+struct test_struct tss[N_KEYS];
+
+/* The suite initialization function.
+ * Returns zero on success, non-zero otherwise.
+ * */
+int init_suite1(void)
+{
+    return 0;
+}
+
+/* The suite cleanup function.
+ * Returns zero on success, non-zero otherwise.
+ * */
+int clean_suite1(void)
+{
+    return 0;
+}
+
+void testPTRTBLCREATE(void)
+{
+    CU_ASSERT( ptr_table_init(&_ptable, 16) == 0 );
+    CU_ASSERT( _ptable.capacity >= 32 );
+    CU_ASSERT( _ptable._nentries == 0 );
+}
+
+void testPTRTBLINSERT(void)
+{
+    size_t old_cap = _ptable.capacity;
+
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        tss[i]._testint = i;
+        CU_ASSERT( ptr_table_insert_safe(&_ptable,
+                    (uintptr_t)&tss[i], &tss[i]) == 0 );
+    }
+    CU_ASSERT( _ptable._nentries == N_KEYS );
+    CU_ASSERT( _ptable.capacity > old_cap );
+
+    //NULL can't be a key, it marks empty slots.
+    CU_ASSERT( ptr_table_insert(&_ptable, 0, &tss[0]) == -1 );
+}
+
+void testPTRTBLGET(void)
+{
+    struct test_struct * ts = NULL;
+
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        ts = ptr_table_lookup_safe(&_ptable, (uintptr_t)&tss[i]);
+        CU_ASSERT( ts == &tss[i] );
+    }
+    CU_ASSERT( ptr_table_lookup(&_ptable, (uintptr_t)&ts) == NULL );
+}
+
+/*
+ * deleting every other key shifts probe runs back, the survivors must
+ * still be reachable.
+ * */
+void testPTRTBLREMOVE(void)
+{
+    for( int i=0 ; i<N_KEYS ; i+=2 ) {
+        CU_ASSERT( ptr_table_del_safe(&_ptable, (uintptr_t)&tss[i]) == &tss[i] );
+    }
+    CU_ASSERT( _ptable._nentries == N_KEYS/2 );
+
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        if( i % 2 )
+            CU_ASSERT( ptr_table_lookup(&_ptable, (uintptr_t)&tss[i]) == &tss[i] );
+        else
+            CU_ASSERT( ptr_table_lookup(&_ptable, (uintptr_t)&tss[i]) == NULL );
+    }
+    CU_ASSERT( ptr_table_del(&_ptable, (uintptr_t)&tss[0]) == NULL );
+}
+
+void testPTRTBLDESTROY(void)
+{
+    size_t i = 0, n = 0;
+    struct ptr_slot * slot = NULL;
+
+    ptr_table_for_each(slot, &_ptable, i) {
+        n++;
+    }
+    CU_ASSERT( n == N_KEYS/2 );
+
+    ptr_table_finit(&_ptable);
+    CU_ASSERT( _ptable.slots == NULL );
+}
+
+/* The main() function for setting up and running the tests.
+ *  * Returns a CUE_SUCCESS on successful running, another
+ *   * CUnit error code on failure.
+ *    */
+int main()
+{
+    CU_pSuite pSuite = NULL;
+
+    /* initialize the CUnit test registry */
+    if (CUE_SUCCESS != CU_initialize_registry())
+        return CU_get_error();
+
+    /* add a suite to the registry */
+    pSuite = CU_add_suite("Suite_1", init_suite1, clean_suite1);
+    if (NULL == pSuite) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    /* add the tests to the suite */
+    /* NOTE - ORDER IS IMPORTANT */
+    if ((NULL == CU_add_test(pSuite, "test ptr table creation", testPTRTBLCREATE)) ||
+        (NULL == CU_add_test(pSuite, "test ptr table insertion", testPTRTBLINSERT)) ||
+        (NULL == CU_add_test(pSuite, "test ptr table retrieval", testPTRTBLGET)) ||
+        (NULL == CU_add_test(pSuite, "test ptr table removal", testPTRTBLREMOVE)) ||
+        (NULL == CU_add_test(pSuite, "test ptr table destruction", testPTRTBLDESTROY)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    /* Run all tests using the CUnit Basic interface */
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+    CU_cleanup_registry();
+    return CU_get_error();
+}
+
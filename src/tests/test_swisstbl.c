@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h> 
+#include "CUnit/Basic.h"
+
+#include "milu.h"
+#include "hashtbl/swisstbl.h"
+
+
+static struct swiss_table _stable;
+#define N_KEYS 5000
+
+struct test_struct {
+    int               _testint;
+    char              _name[16];
+    struct hash_entry hentry;
+};
+
+struct test_struct tss[N_KEYS];
+struct test_struct sss[N_KEYS];
+
+static size_t test_hash_str(const void *key, size_t len)
+{
+    const unsigned char *p = key;
+    size_t h = 5381;
+
+    while(len--)
+        h = h * 33 + *p++;
+    return h;
+}
+
+/* The suite initialization function.
+ * Returns zero on success, non-zero otherwise.
+ * */
+int init_suite1(void)
+{
+    return 0;
+}
+
+/* The suite cleanup function.
+ * Returns zero on success, non-zero otherwise.
+ * */
+int clean_suite1(void)
+{
+    return 0;
+}
+
+void testSWISSCREATE(void)
+{
+    CU_ASSERT( swiss_table_init(&_stable, 16, hash64_cmp, milu_hash_ptr) == 0 );
+    CU_ASSERT( _stable.capacity >= SWISS_GROUP );
+}
+
+void testSWISSINSERT(void)
+{
+    size_t old_cap = _stable.capacity;
+
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        tss[i]._testint = i;
+        CU_ASSERT( swiss_table_insert_safe_i(&_stable, &tss[i].hentry,
+                    (uintptr_t)&tss[i], sizeof(uintptr_t)) == 0 );
+    }
+    CU_ASSERT( _stable._nentries == N_KEYS );
+    CU_ASSERT( _stable.capacity > old_cap );
+}
+
+void testSWISSGET(void)
+{
+    struct hash_entry * entry = NULL;
+
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        entry = swiss_table_lookup_key_safe_i(&_stable,
+                (uintptr_t)&tss[i], sizeof(uintptr_t));
+        CU_ASSERT( entry == &tss[i].hentry );
+    }
+    CU_ASSERT( swiss_table_lookup_key_i(&_stable,
+                (uintptr_t)&entry, sizeof(uintptr_t)) == NULL );
+}
+
+/*
+ * delete and re-insert repeatedly: tombstones must not break probing and
+ * must eventually be purged.
+ * */
+void testSWISSREMOVE(void)
+{
+    for( int round=0 ; round<8 ; round++ ) {
+        for( int i=round%2 ; i<N_KEYS ; i+=2 ) {
+            CU_ASSERT( swiss_table_del_key_safe_i(&_stable,
+                        (uintptr_t)&tss[i], sizeof(uintptr_t)) == &tss[i].hentry );
+        }
+        for( int i=0 ; i<N_KEYS ; i++ ) {
+            struct hash_entry * entry = swiss_table_lookup_key_i(&_stable,
+                    (uintptr_t)&tss[i], sizeof(uintptr_t));
+            CU_ASSERT( (i%2 == round%2) ? entry == NULL : entry == &tss[i].hentry );
+        }
+        for( int i=round%2 ; i<N_KEYS ; i+=2 ) {
+            CU_ASSERT( swiss_table_insert_i(&_stable, &tss[i].hentry,
+                        (uintptr_t)&tss[i], sizeof(uintptr_t)) == 0 );
+        }
+    }
+    CU_ASSERT( _stable._nentries == N_KEYS );
+    CU_ASSERT( _stable._nentries + _stable._ndeleted <= SWISS_MAX_LOAD(_stable.capacity) );
+}
+
+void testSWISSSTRKEYS(void)
+{
+    struct swiss_table st;
+    struct hash_entry * entry = NULL;
+    char key[16];
+
+    CU_ASSERT( swiss_table_init(&st, 0, NULL, test_hash_str) == 0 );
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        snprintf(sss[i]._name, sizeof(sss[i]._name), "key-%d", i);
+        CU_ASSERT( swiss_table_insert_s(&st, &sss[i].hentry,
+                    sss[i]._name, strlen(sss[i]._name)) == 0 );
+    }
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        snprintf(key, sizeof(key), "key-%d", i);
+        entry = swiss_table_lookup_key_s(&st, key, strlen(key));
+        CU_ASSERT( entry == &sss[i].hentry );
+    }
+    CU_ASSERT( swiss_table_lookup_key_s(&st, "key-", 4) == NULL );
+
+    snprintf(key, sizeof(key), "key-%d", 42);
+    entry = swiss_table_del_key_s(&st, key, strlen(key));
+    CU_ASSERT( entry == &sss[42].hentry );
+    CU_ASSERT( swiss_table_lookup_key_s(&st, key, strlen(key)) == NULL );
+
+    for( int i=0 ; i<N_KEYS ; i++ ) {
+        hash_entry_finit(&sss[i].hentry);
+    }
+    swiss_table_finit(&st);
+}
+
+void testSWISSDESTROY(void)
+{
+    size_t i = 0, n = 0;
+    struct hash_entry * entry = NULL;
+
+    swiss_table_for_each(entry, &_stable, i) {
+        n++;
+    }
+    CU_ASSERT( n == N_KEYS );
+
+    swiss_table_finit(&_stable);
+    CU_ASSERT( _stable.ctrl == NULL );
+}
+
+/* The main() function for setting up and running the tests.
+ *  * Returns a CUE_SUCCESS on successful running, another
+ *   * CUnit error code on failure.
+ *    */
+int main()
+{
+    CU_pSuite pSuite = NULL;
+
+    /* initialize the CUnit test registry */
+    if (CUE_SUCCESS != CU_initialize_registry())
+        return CU_get_error();
+
+    /* add a suite to the registry */
+    pSuite = CU_add_suite("Suite_1", init_suite1, clean_suite1);
+    if (NULL == pSuite) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    /* add the tests to the suite */
+    /* NOTE - ORDER IS IMPORTANT */
+    if ((NULL == CU_add_test(pSuite, "test swiss table creation", testSWISSCREATE)) ||
+        (NULL == CU_add_test(pSuite, "test swiss table insertion", testSWISSINSERT)) ||
+        (NULL == CU_add_test(pSuite, "test swiss table retrieval", testSWISSGET)) ||
+        (NULL == CU_add_test(pSuite, "test swiss table removal", testSWISSREMOVE)) ||
+        (NULL == CU_add_test(pSuite, "test swiss table string keys", testSWISSSTRKEYS)) ||
+        (NULL == CU_add_test(pSuite, "test swiss table destruction", testSWISSDESTROY)))
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    /* Run all tests using the CUnit Basic interface */
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+    CU_basic_run_tests();
+    CU_cleanup_registry();
+    return CU_get_error();
+}
+